@@ -23,7 +23,6 @@
 #include "cinder/Utilities.h"
 #include "cinder/Filesystem.h"
 #include "cinder/Font.h"
-#include "cinder/ip/Resize.h"
 #include "cinder/Rect.h"
 
 #include "ciMsaFluidSolver.h"
@@ -31,6 +30,9 @@
 
 #include "CinderOpenCV.h"
 
+#include "FeatureTracker.h"
+#include "GreyDownsampler.h"
+
 #include "PParams.h"
 #include "NI.h"
 #include "Leaves.h"
@@ -86,12 +88,11 @@ class Acacia : public ci::app::AppBasic
 		OpenNI mNI;
 		gl::Texture mOptFlowTexture;
 
-		void chooseFeatures( cv::Mat currentFrame );
-		void trackFeatures( cv::Mat currentFrame );
-
-		cv::Mat mPrevFrame;
+		mndl::FeatureTrackerRef mFeatureTracker;
+		mndl::GreyDownsamplerRef mGreyDownsampler;
 		vector<cv::Point2f> mPrevFeatures, mFeatures;
 		vector<uint8_t> mFeatureStatuses;
+		float mTrackTime;
 
 		static const int MAX_FEATURES = 128;
 		#define CAMERA_WIDTH 160
@@ -131,6 +132,8 @@ void Acacia::setup()
 	mParams.addPersistentParam( "Atmosphere", &mDrawAtmosphere, false );
 	mParams.addPersistentParam( "Camera", &mDrawCamera, false );
 	mParams.addPersistentParam( "Features", &mDrawFeatures, false );
+	mTrackTime = 0.f;
+	mParams.addParam( "Tracking ms", &mTrackTime, "", true );
 
 	mBWTextures = loadTextures( "bw" );
 
@@ -166,6 +169,13 @@ void Acacia::setup()
 	//mNI.setVideoInfrared();
 	mNI.start();
 
+	// features are tracked on a worker thread
+	mFeatureTracker = mndl::FeatureTracker::create();
+	mndl::FeatureTracker::Params trackerParams;
+	trackerParams.maxFeatures = MAX_FEATURES;
+	mFeatureTracker->setParams( trackerParams );
+	mGreyDownsampler = mndl::GreyDownsampler::create();
+
 	mFont = Font("Lucida Grande", 12.0f);
 
 	gl::enableAlphaBlending();
@@ -241,18 +251,6 @@ void Acacia::addToFluid( Vec2f pos, Vec2f vel, bool addColor, bool addForce )
 	}
 }
 
-void Acacia::chooseFeatures( cv::Mat currentFrame )
-{
-	cv::goodFeaturesToTrack( currentFrame, mFeatures, MAX_FEATURES, 0.005, 3.0 );
-}
-
-void Acacia::trackFeatures( cv::Mat currentFrame )
-{
-	vector<float> errors;
-	mPrevFeatures = mFeatures;
-	cv::calcOpticalFlowPyrLK( mPrevFrame, currentFrame, mPrevFeatures, mFeatures, mFeatureStatuses, errors );
-}
-
 void Acacia::update()
 {
 	mFluidSolver.update();
@@ -265,22 +263,27 @@ void Acacia::update()
 
 	if (mNI.checkNewDepthFrame())
 	{
-		Surface surface( Channel8u( mNI.getVideoImage() ) );
-		Surface smallSurface( CAMERA_WIDTH, CAMERA_HEIGHT, false );
-
-		ip::resize( surface, &smallSurface );
-
-		mOptFlowTexture = gl::Texture( smallSurface );
+		Surface8u videoSurf( mNI.getVideoImage() );
+
+		cv::Mat currentFrame = mFeatureTracker->acquireFrame( CAMERA_WIDTH, CAMERA_HEIGHT );
+		mGreyDownsampler->process( videoSurf.getData(), videoSurf.getWidth(), videoSurf.getHeight(),
+				videoSurf.getRowBytes(),
+				mndl::GreyDownsampler::Layout( videoSurf.getPixelInc(), videoSurf.getRedOffset(),
+					videoSurf.getGreenOffset(), videoSurf.getBlueOffset() ),
+				currentFrame );
+		mOptFlowTexture = gl::Texture( fromOcv( currentFrame ) );
+		mFeatureTracker->pushFrame( currentFrame, getElapsedSeconds() );
+	}
 
-		cv::Mat currentFrame( toOcv( Channel( smallSurface ) ) );
-		if ( mPrevFrame.data )
-		{
-			// pick new features once every 30 frames, or the first frame
-			if ( mFeatures.empty() || getElapsedFrames() % 30 == 0 )
-				chooseFeatures( mPrevFrame );
-			trackFeatures( currentFrame );
-		}
-		mPrevFrame = currentFrame;
+	// tracked points are kept between frames, new features are only
+	// detected where the old ones were lost
+	if ( mFeatureTracker->checkNewFeatures() )
+	{
+		mndl::FeatureTracker::Features features = mFeatureTracker->getFeatures();
+		mFeatures.swap( features.points );
+		mPrevFeatures.swap( features.prevPoints );
+		mFeatureStatuses.swap( features.statuses );
+		mTrackTime = mFeatureTracker->getTrackTime();
 	}
 }
 
@@ -0,0 +1,133 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// headless benchmark of the barnes-hut field evaluation against the
+// direct sum, reports the cost per evaluation and the relative error for
+// various charge counts and opening angles up to TREE_MAX_THETA.
+//
+// build from the Charges directory:
+// c++ -std=c++11 -O3 -Iinclude bench/FieldTreeBench.cpp src/FieldTree.cpp -o fieldtreebench
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "FieldTree.h"
+
+#define GRAD_SCALE 200
+#define NUM_POINTS 20000
+
+static const float WIDTH = 1280;
+static const float HEIGHT = 800;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static void direct(int n, const float *cx, const float *cy, const float *cc,
+		float x0, float y0, float *rx, float *ry)
+{
+	float ex = 0, ey = 0;
+	for (int i = 0; i < n; i++)
+	{
+		float dx = x0 - cx[i];
+		float dy = y0 - cy[i];
+		float d2r = cc[i] / (dx * dx + dy * dy);
+		ex += dx * d2r;
+		ey += dy * d2r;
+	}
+	*rx = ex;
+	*ry = ey;
+}
+
+int main()
+{
+	const int counts[] = { 10, 100, 1000, 3000, 10000 };
+	const float thetas[] = { .1f, .2f, .3f, .4f, .5f };
+
+	printf("%8s %6s %12s %12s %12s %12s %12s\n", "charges", "theta",
+			"build us", "tree ns", "direct ns", "mean err", "max err");
+
+	for (int c = 0; c < 5; c++)
+	{
+		int n = counts[c];
+		srand(n);
+
+		std::vector<float> cx(n), cy(n), cc(n);
+		for (int i = 0; i < n; i++)
+		{
+			cx[i] = WIDTH * rand() / RAND_MAX;
+			cy[i] = HEIGHT * rand() / RAND_MAX;
+			cc[i] = ((rand() % 2) ? 1.f : -1.f) * (1 + rand() % 100) * GRAD_SCALE;
+		}
+
+		// sample points are kept away from the charges like the particles,
+		// which die within 10 pixels of an opposite charge
+		std::vector<float> px, py;
+		while ((int)px.size() < NUM_POINTS)
+		{
+			float x = WIDTH * rand() / RAND_MAX;
+			float y = HEIGHT * rand() / RAND_MAX;
+			bool near = false;
+			for (int i = 0; (i < n) && !near; i++)
+				near = ((x - cx[i]) * (x - cx[i]) + (y - cy[i]) * (y - cy[i])) < 100;
+			if (near)
+				continue;
+			px.push_back(x);
+			py.push_back(y);
+		}
+
+		std::vector<float> ex(NUM_POINTS), ey(NUM_POINTS);
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < NUM_POINTS; i++)
+			direct(n, &cx[0], &cy[0], &cc[0], px[i], py[i], &ex[i], &ey[i]);
+		double direct_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / NUM_POINTS;
+
+		for (int t = 0; t < 5; t++)
+		{
+			FieldTree tree;
+			tree.set_theta(thetas[t]);
+
+			start = Clock::now();
+			tree.build(n, &cx[0], &cy[0], &cc[0]);
+			double build_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+			std::vector<float> tx(NUM_POINTS), ty(NUM_POINTS);
+			start = Clock::now();
+			for (int i = 0; i < NUM_POINTS; i++)
+				tree.evaluate(px[i], py[i], &tx[i], &ty[i]);
+			double tree_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / NUM_POINTS;
+
+			double sum = 0, max = 0;
+			for (int i = 0; i < NUM_POINTS; i++)
+			{
+				double m = hypot(ex[i], ey[i]);
+				if (m <= 0)
+					continue;
+				double e = hypot(tx[i] - ex[i], ty[i] - ey[i]) / m;
+				sum += e;
+				if (e > max)
+					max = e;
+			}
+
+			printf("%8d %6.2f %12.2f %12.1f %12.1f %12.2e %12.2e\n", n, tree.get_theta(),
+					build_us, tree_ns, direct_ns, sum / NUM_POINTS, max);
+		}
+	}
+
+	return 0;
+}
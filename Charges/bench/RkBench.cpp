@@ -0,0 +1,207 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// headless benchmark of the field line integrators, compares the function
+// pointer and the templated functor versions of rkqs and rkqs_batch. both
+// versions of a driver call the same derivative kernel, the functor only
+// lets the compiler inline it. the times are the best of NUM_RUNS runs of
+// NUM_STEPS steps.
+//
+// build from the Charges directory:
+// c++ -std=c++11 -O3 -Iinclude bench/RkBench.cpp src/AdarKutta.cpp -o rkbench
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "AdarKutta.h"
+
+#define GRAD_SCALE 200
+#define NUM_CHARGES 5
+#define NUM_PARTICLES 107
+#define NUM_STEPS 150
+#define NUM_RUNS 20
+
+static const float WIDTH = 1024;
+static const float HEIGHT = 768;
+
+static float chargeX[ NUM_CHARGES ];
+static float chargeY[ NUM_CHARGES ];
+static float chargeC[ NUM_CHARGES ];
+
+static void calc_gradients(float x0, float y0, float *rx, float *ry)
+{
+	float ex = 0, ey = 0;
+	for (int i = 0; i < NUM_CHARGES; i++)
+	{
+		float dx = x0 - chargeX[i];
+		float dy = y0 - chargeY[i];
+		float d2r = chargeC[i] * GRAD_SCALE / (dx * dx + dy * dy);
+		ex += dx * d2r;
+		ey += dy * d2r;
+	}
+	*rx = ex;
+	*ry = ey;
+}
+
+// charge-major loop over the particles, the inner loop vectorizes
+static void calc_gradients_batch(int n, const float *x0, const float *y0,
+		float *rx, float *ry)
+{
+	for (int l = 0; l < n; l++)
+	{
+		rx[l] = 0;
+		ry[l] = 0;
+	}
+	for (int i = 0; i < NUM_CHARGES; i++)
+	{
+		const float cx = chargeX[i];
+		const float cy = chargeY[i];
+		const float cc = chargeC[i] * GRAD_SCALE;
+		for (int l = 0; l < n; l++)
+		{
+			float dx = x0[l] - cx;
+			float dy = y0[l] - cy;
+			float d2r = cc / (dx * dx + dy * dy);
+			rx[l] += dx * d2r;
+			ry[l] += dy * d2r;
+		}
+	}
+}
+
+struct Particles
+{
+	Particles()
+	{
+		int n = NUM_CHARGES * NUM_PARTICLES;
+		x.resize(n);
+		y.resize(n);
+		h.resize(n, 1.f);
+		sign.resize(n);
+		for (int j = 0; j < NUM_CHARGES; j++)
+		{
+			for (int i = 0; i < NUM_PARTICLES; i++)
+			{
+				float a = i * 2 * M_PI / NUM_PARTICLES;
+				x[j * NUM_PARTICLES + i] = chargeX[j] + 5 * cos(a);
+				y[j * NUM_PARTICLES + i] = chargeY[j] + 5 * sin(a);
+				sign[j * NUM_PARTICLES + i] = chargeC[j] < 0 ? -1 : 1;
+			}
+		}
+	}
+
+	// keeps particles leaving the screen from blowing up the step count
+	void clamp()
+	{
+		for (size_t i = 0; i < x.size(); i++)
+		{
+			if ((x[i] < 0) || (y[i] < 0) || (x[i] >= WIDTH) || (y[i] >= HEIGHT) ||
+				!(h[i] > 1e-6f))
+			{
+				x[i] = WIDTH * .5f;
+				y[i] = HEIGHT * .5f;
+				h[i] = 1.f;
+			}
+		}
+	}
+
+	double checksum() const
+	{
+		double s = 0;
+		for (size_t i = 0; i < x.size(); i++)
+			s += x[i] + y[i];
+		return s;
+	}
+
+	std::vector<float> x, y, h;
+	std::vector<int> sign;
+};
+
+typedef std::chrono::high_resolution_clock Clock;
+
+template< typename Step >
+static void run(const char *name, Step step)
+{
+	double best = 1e30;
+	double checksum = 0;
+	for (int r = 0; r < NUM_RUNS; r++)
+	{
+		Particles p;
+		Clock::time_point start = Clock::now();
+		for (int s = 0; s < NUM_STEPS; s++)
+		{
+			step(p);
+			p.clamp();
+		}
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		if (ms < best)
+			best = ms;
+		checksum = p.checksum();
+	}
+	printf("%-28s %8.3f ms/%d steps  checksum %.3f\n", name, best, NUM_STEPS, checksum);
+}
+
+int main()
+{
+	srand(1);
+	for (int i = 0; i < NUM_CHARGES; i++)
+	{
+		chargeX[i] = 100 + rand() % int(WIDTH - 200);
+		chargeY[i] = 100 + rand() % int(HEIGHT - 200);
+		chargeC[i] = (rand() % 2) ? 1.f : -1.f;
+	}
+
+	const float eps = .01f;
+	printf("%d charges, %d particles, %d steps\n",
+			NUM_CHARGES, NUM_CHARGES * NUM_PARTICLES, NUM_STEPS);
+
+	run("rkqs, pointer", [&](Particles &p) {
+			for (size_t i = 0; i < p.x.size(); i++)
+				rkqs(p.x[i], p.y[i], calc_gradients, &p.x[i], &p.y[i],
+					p.h[i], eps, &p.h[i], p.sign[i]);
+		});
+
+	run("rkqs, lambda", [&](Particles &p) {
+			auto deriv = [](float x0, float y0, float *rx, float *ry)
+			{
+				calc_gradients(x0, y0, rx, ry);
+			};
+			for (size_t i = 0; i < p.x.size(); i++)
+				adarkutta::rkqs(p.x[i], p.y[i], deriv, &p.x[i], &p.y[i],
+					p.h[i], eps, &p.h[i], p.sign[i]);
+		});
+
+	run("rkqs_batch, pointer", [&](Particles &p) {
+			int n = p.x.size();
+			rkqs_batch(n, &p.x[0], &p.y[0], calc_gradients_batch, &p.x[0], &p.y[0],
+				&p.h[0], eps, &p.h[0], &p.sign[0]);
+		});
+
+	run("rkqs_batch, lambda", [&](Particles &p) {
+			auto deriv = [](int n, const float *x0, const float *y0, float *rx, float *ry)
+			{
+				calc_gradients_batch(n, x0, y0, rx, ry);
+			};
+			int n = p.x.size();
+			adarkutta::rkqs_batch(n, &p.x[0], &p.y[0], deriv, &p.x[0], &p.y[0],
+				&p.h[0], eps, &p.h[0], &p.sign[0]);
+		});
+
+	return 0;
+}
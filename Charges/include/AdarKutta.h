@@ -1,13 +1,22 @@
 #ifndef __ADARKUTTA_H__
 #define __ADARKUTTA_H__
 
+#include <math.h>
+
 #define MAX_RK_STEPS 50	// solver would repeat ode integrating with various
 		// step sizes until the desired accuracy is reached, this variable
 		// limits the number of tries, higher values results better, but
 		// slower output
 
+#define RK_LANES 8	// number of particles the batched solver advances in
+		// lockstep, the inner loops are written to be vectorized over them
+
 typedef void (*DERIVFUNC)(float x0, float y0, float *rx, float *ry);
 
+// batched derivative, evaluates n points at once
+typedef void (*DERIVFUNC_BATCH)(int n, const float *x0, const float *y0,
+	float *rx, float *ry);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -15,8 +24,302 @@ extern "C" {
 void rkqs(float x0, float y0, DERIVFUNC derivfunc, float *xout, float *yout,
 	float htry, float eps, float *hnext, int sign);
 
+void rkqs_batch(int n, const float *x0, const float *y0,
+	DERIVFUNC_BATCH derivfunc, float *xout, float *yout,
+	const float *htry, float eps, float *hnext, const int *sign);
+
 #ifdef __cplusplus
 }
 #endif
-#endif
 
+#ifdef __cplusplus
+
+// templated versions of the solvers, the derivative can be any callable
+// - a function pointer, a lambda or a functor capturing the field state -
+// so the compiler is able to inline it into the runge-kutta stages.
+// scalar derivatives are called as derivfunc(x0, y0, &rx, &ry),
+// batched ones as derivfunc(n, x0, y0, rx, ry).
+
+namespace adarkutta {
+
+const double SAFETY = 0.9;
+const double PGROW = -0.2;
+const double PSHRINK = -0.25;
+const double ERRCON = 1.89e-4;	// equals (5/SAFETY) raised to the power (1/PGROW)
+
+const float b21=0.2, b31=3.0/40.0, b32=9.0/40.0, b41=0.3, b42=-0.9, b43=1.2,
+	b51=-11.0/54.0, b52=2.5, b53=-70.0/27.0, b54=35.0/27.0,
+	b61=1631.0/55296.0, b62=175.0/512.0, b63=575.0/13824.0,
+	b64=44275.0/110592.0, b65=253.0/4096.0;
+const float	c1=37.0/378.0, c3=250.0/621.0, c4=125.0/594.0, c6=512.0/1771.0;
+const float dc1=c1-2825.0/27648.0, dc3=c3-18575.0/48384.0, dc4=c4-13525.0/55296.0,
+	dc5=-277.0/14336.0, dc6=c6-0.25;
+
+// adaptive runge-kutta-fehlberg cash-karp version
+// ordinary differential equation integrator with cash-karp runge-kutta method
+//
+// h - suggested step size
+// x0, y0 - coords
+// derivfunc - function calculating derivatives
+// xout, your - new coordinates at step h
+// xerr, yerr - errors
+// sign - 1, -1  - in the electric field some particles follows the field gradients
+//				   while others move in the opposite direction depending on their charge
+template< typename Deriv >
+inline void rkck(float h, float x0, float y0, const Deriv &derivfunc,
+		  float *xout, float *yout, float *xerr, float *yerr, int sign)
+{
+	float k1x, k2x, k3x, k4x, k5x, k6x;
+	float k1y, k2y, k3y, k4y, k5y, k6y;
+
+	if (sign>0)
+	{
+		derivfunc(x0, y0, &k1x, &k1y);						// 1st
+		k1x*=h;
+		k1y*=h;
+
+		derivfunc(x0+k1x*b21, y0+k1y*b21, &k2x, &k2y);		// 2nd
+		k2x*=h;
+		k2y*=h;
+
+		derivfunc(x0+k1x*b31+k2x*b32,						//3rd
+			y0+k1y*b31+k2y*b32, &k3x, &k3y);
+		k3x*=h;
+		k3y*=h;
+
+		derivfunc(x0+k1x*b41+k2x*b42+k3x*b43,				// 4th
+				  y0+k1y*b41+k2y*b42+k3y*b43, &k4x, &k4y);
+		k4x*=h;
+		k4y*=h;
+
+		derivfunc(x0+k1x*b51+k2x*b52+k3x*b53+k4x*b54,		// 5th
+				  y0+k1y*b51+k2y*b52+k3y*b53+k4y*b54, &k5x, &k5y);
+		k5x*=h;
+		k5y*=h;
+
+		derivfunc(x0+k1x*b61+k2x*b62+k3x*b63+k4x*b64+k5x*b65, // 6th
+				  y0+k1y*b61+k2y*b62+k3y*b63+k4y*b64+k5y*b65, &k6x, &k6y);
+		k6x*=h;
+		k6y*=h;
+
+		*xout = x0 + (c1*k1x + c3*k3x + c4*k4x + c6*k6x);	// output
+		*yout = y0 + (c1*k1y + c3*k3y + c4*k4y + c6*k6y);
+	}
+	else
+	{
+		derivfunc(x0, y0, &k1x, &k1y);						// 1st
+		k1x*=h;
+		k1y*=h;
+
+		derivfunc(x0-k1x*b21, y0-k1y*b21, &k2x, &k2y);		// 2nd
+		k2x*=h;
+		k2y*=h;
+
+		derivfunc(x0-(k1x*b31+k2x*b32),						// 3rd
+				  y0-(k1y*b31+k2y*b32), &k3x, &k3y);
+		k3x*=h;
+		k3y*=h;
+
+		derivfunc(x0-(k1x*b41+k2x*b42+k3x*b43),				// 4th
+				  y0-(k1y*b41+k2y*b42+k3y*b43), &k4x, &k4y);
+		k4x*=h;
+		k4y*=h;
+
+		derivfunc(x0-(k1x*b51+k2x*b52+k3x*b53+k4x*b54),		// 5th
+				  y0-(k1y*b51+k2y*b52+k3y*b53+k4y*b54), &k5x, &k5y);
+		k5x*=h;
+		k5y*=h;
+
+		derivfunc(x0-(k1x*b61+k2x*b62+k3x*b63+k4x*b64+k5x*b65), // 6th
+				  y0-(k1y*b61+k2y*b62+k3y*b63+k4y*b64+k5y*b65), &k6x, &k6y);
+		k6x*=h;
+		k6y*=h;
+
+		*xout = x0 - (c1*k1x + c3*k3x + c4*k4x + c6*k6x);	// output
+		*yout = y0 - (c1*k1y + c3*k3y + c4*k4y + c6*k6y);
+	}
+
+	*xerr = dc1*k1x + dc3*k3x + dc4*k4x + dc5*k5x + dc6*k6x; // errors
+	*yerr = dc1*k1y + dc3*k3y + dc4*k4y + dc5*k5y + dc6*k6y;
+}
+
+// driver for adaptive runge-kutta ode solver
+// most parameters are the same as above
+// htry  - step size to try
+// hnext - new step size
+// eps	 - required accuracy
+template< typename Deriv >
+inline void rkqs(float x0, float y0, const Deriv &derivfunc,
+	float *xout, float *yout, float htry, float eps,
+	float *hnext, int sign)
+{
+	float xerr, yerr, errmax;
+	float h = htry;
+	int k=0;
+	while(k<MAX_RK_STEPS)
+	{
+		rkck(h, x0, y0, derivfunc, xout, yout, &xerr, &yerr, sign);
+
+		errmax = fabs(xerr) + fabs(yerr);
+		if (errmax <= eps)	break;
+
+		float htemp=SAFETY*h*pow(errmax, PSHRINK);
+		h = (htemp < h) ? htemp : 0.1*h;
+		k++;
+	}
+
+	if (errmax>ERRCON)
+		*hnext = SAFETY*h*pow(errmax, PGROW);
+	else
+		*hnext = 5.0*h;
+}
+
+// batched cash-karp step for RK_LANES particles
+// the sign is applied to the derivatives, which gives the same result as
+// the separate sign branches of rkck, the errors only differ in sign
+template< typename DerivBatch >
+inline void rkck_lanes(const float *h, const float *x0, const float *y0,
+		const DerivBatch &derivfunc, const float *sign,
+		float *xout, float *yout, float *xerr, float *yerr)
+{
+	float k1x[RK_LANES], k2x[RK_LANES], k3x[RK_LANES], k4x[RK_LANES], k5x[RK_LANES], k6x[RK_LANES];
+	float k1y[RK_LANES], k2y[RK_LANES], k3y[RK_LANES], k4y[RK_LANES], k5y[RK_LANES], k6y[RK_LANES];
+	float tx[RK_LANES], ty[RK_LANES];
+	int l;
+
+	derivfunc(RK_LANES, x0, y0, k1x, k1y);					// 1st
+	for (l = 0; l < RK_LANES; l++)
+	{
+		k1x[l] *= sign[l] * h[l];
+		k1y[l] *= sign[l] * h[l];
+		tx[l] = x0[l] + k1x[l]*b21;
+		ty[l] = y0[l] + k1y[l]*b21;
+	}
+
+	derivfunc(RK_LANES, tx, ty, k2x, k2y);					// 2nd
+	for (l = 0; l < RK_LANES; l++)
+	{
+		k2x[l] *= sign[l] * h[l];
+		k2y[l] *= sign[l] * h[l];
+		tx[l] = x0[l] + (k1x[l]*b31 + k2x[l]*b32);
+		ty[l] = y0[l] + (k1y[l]*b31 + k2y[l]*b32);
+	}
+
+	derivfunc(RK_LANES, tx, ty, k3x, k3y);					// 3rd
+	for (l = 0; l < RK_LANES; l++)
+	{
+		k3x[l] *= sign[l] * h[l];
+		k3y[l] *= sign[l] * h[l];
+		tx[l] = x0[l] + (k1x[l]*b41 + k2x[l]*b42 + k3x[l]*b43);
+		ty[l] = y0[l] + (k1y[l]*b41 + k2y[l]*b42 + k3y[l]*b43);
+	}
+
+	derivfunc(RK_LANES, tx, ty, k4x, k4y);					// 4th
+	for (l = 0; l < RK_LANES; l++)
+	{
+		k4x[l] *= sign[l] * h[l];
+		k4y[l] *= sign[l] * h[l];
+		tx[l] = x0[l] + (k1x[l]*b51 + k2x[l]*b52 + k3x[l]*b53 + k4x[l]*b54);
+		ty[l] = y0[l] + (k1y[l]*b51 + k2y[l]*b52 + k3y[l]*b53 + k4y[l]*b54);
+	}
+
+	derivfunc(RK_LANES, tx, ty, k5x, k5y);					// 5th
+	for (l = 0; l < RK_LANES; l++)
+	{
+		k5x[l] *= sign[l] * h[l];
+		k5y[l] *= sign[l] * h[l];
+		tx[l] = x0[l] + (k1x[l]*b61 + k2x[l]*b62 + k3x[l]*b63 + k4x[l]*b64 + k5x[l]*b65);
+		ty[l] = y0[l] + (k1y[l]*b61 + k2y[l]*b62 + k3y[l]*b63 + k4y[l]*b64 + k5y[l]*b65);
+	}
+
+	derivfunc(RK_LANES, tx, ty, k6x, k6y);					// 6th
+	for (l = 0; l < RK_LANES; l++)
+	{
+		k6x[l] *= sign[l] * h[l];
+		k6y[l] *= sign[l] * h[l];
+
+		xout[l] = x0[l] + (c1*k1x[l] + c3*k3x[l] + c4*k4x[l] + c6*k6x[l]);	// output
+		yout[l] = y0[l] + (c1*k1y[l] + c3*k3y[l] + c4*k4y[l] + c6*k6y[l]);
+
+		xerr[l] = dc1*k1x[l] + dc3*k3x[l] + dc4*k4x[l] + dc5*k5x[l] + dc6*k6x[l]; // errors
+		yerr[l] = dc1*k1y[l] + dc3*k3y[l] + dc4*k4y[l] + dc5*k5y[l] + dc6*k6y[l];
+	}
+}
+
+// batched driver, advances n particles with the same accuracy semantics as
+// rkqs. particles are processed RK_LANES at a time, every lane retries with
+// its own step size until its error is below eps, lanes that are already
+// accurate enough are masked and keep their result.
+template< typename DerivBatch >
+inline void rkqs_batch(int n, const float *x0, const float *y0,
+	const DerivBatch &derivfunc, float *xout, float *yout,
+	const float *htry, float eps, float *hnext, const int *sign)
+{
+	float bx[RK_LANES], by[RK_LANES], bh[RK_LANES], bsign[RK_LANES];
+	float ox[RK_LANES], oy[RK_LANES], xerr[RK_LANES], yerr[RK_LANES];
+	float rx[RK_LANES], ry[RK_LANES], rerr[RK_LANES];
+	int done[RK_LANES];
+
+	for (int i = 0; i < n; i += RK_LANES)
+	{
+		int lanes = (n - i < RK_LANES) ? n - i : RK_LANES;
+		int l;
+
+		// load lanes, unused lanes duplicate the last particle
+		for (l = 0; l < RK_LANES; l++)
+		{
+			int j = i + ((l < lanes) ? l : lanes - 1);
+			bx[l] = x0[j];
+			by[l] = y0[j];
+			bh[l] = htry[j];
+			bsign[l] = (sign[j] > 0) ? 1.0f : -1.0f;
+			done[l] = (l >= lanes);
+		}
+
+		int pending = lanes;
+		int k = 0;
+		while (pending && (k < MAX_RK_STEPS))
+		{
+			rkck_lanes(bh, bx, by, derivfunc, bsign, ox, oy, xerr, yerr);
+
+			pending = 0;
+			for (l = 0; l < RK_LANES; l++)
+			{
+				if (done[l])
+					continue;
+
+				float errmax = fabs(xerr[l]) + fabs(yerr[l]);
+				rx[l] = ox[l];
+				ry[l] = oy[l];
+				rerr[l] = errmax;
+				if (errmax <= eps)
+				{
+					done[l] = 1;
+					continue;
+				}
+
+				float htemp = SAFETY*bh[l]*pow(errmax, PSHRINK);
+				bh[l] = (htemp < bh[l]) ? htemp : 0.1*bh[l];
+				pending++;
+			}
+			k++;
+		}
+
+		// store lanes
+		for (l = 0; l < lanes; l++)
+		{
+			xout[i + l] = rx[l];
+			yout[i + l] = ry[l];
+			if (rerr[l] > ERRCON)
+				hnext[i + l] = SAFETY*bh[l]*pow(rerr[l], PGROW);
+			else
+				hnext[i + l] = 5.0*bh[l];
+		}
+	}
+}
+
+} // namespace adarkutta
+
+#endif // __cplusplus
+
+#endif
@@ -1,11 +1,21 @@
 #ifndef __CHARGE_H__
 #define __CHARGE_H__
 
+#include <vector>
+
 #include "AdarKutta.h"
+#include "FieldGrid.h"
+#include "FieldTree.h"
 #include "Particle.h"
 
 #define MAX_PARTICLES 107	// maximum number of particles per charge
 #define GRAD_SCALE 200		// scale factor for gradient vectors
+#define TRACE_CHUNKS 4		// particles of a charge are traced in this many
+							// independent chunks, possibly on different threads
+#define CACHE_POS_QUANT 2.f	// charge movement in pixels and charge change
+#define CACHE_CHARGE_QUANT 1.f	// invalidating the cached paths
+
+class ChargeField;
 
 class Charge
 {
@@ -20,7 +30,149 @@ class Charge
 		Particle particles[MAX_PARTICLES];
 
 		void field(float x0, float y0, float *rx, float *ry);
-		int update_particles(DERIVFUNC derivfunc);
+
+		// path cache, the particle paths are only traced again if they are
+		// invalidated. returns 1 if the quantized charge state differs from
+		// the one the paths were traced with. was_traced is set to 1 if there
+		// are traced paths, their position is returned in oldx, oldy
+		int state_changed(float *oldx, float *oldy, int *was_traced) const;
+		void invalidate();
+		// invalidates the paths passing closer than r to any of the points
+		void invalidate_near(int n, const float *px, const float *py, float r);
+
+		// starts tracing of the invalidated particles, returns their number
+		int init_particles();
+		int update_particles(DERIVFUNC_BATCH derivfunc, int begin, int end);
+		void trace(DERIVFUNC_BATCH derivfunc, int chunk);
+		void draw();
+
+	private:
+		int key_x, key_y, key_c;	// quantized state of the traced paths
+		float traced_x, traced_y;
+		int traced;
+		bool dirty[MAX_PARTICLES];
+		bool lines_dirty;
+		LineBuffer lines;
+};
+
+// field gradient functor of a charge configuration, the charges are copied
+// to flat arrays once per frame. the particles are traced with the pointer
+// based rkqs_batch, which was faster than inlining the functor into the
+// templated solver in bench/RkBench.cpp.
+// if a field grid is set it is sampled instead of the exact sum wherever
+// the grid is valid. if a field tree is set it replaces the exact sum.
+class ChargeField
+{
+	public:
+		ChargeField() : n(0), grid(NULL), tree(NULL) {}
+
+		void set(const std::vector<Charge> &charges)
+		{
+			n = charges.size();
+			cx.resize(n);
+			cy.resize(n);
+			cc.resize(n);
+			for (int i = 0; i < n; i++)
+			{
+				cx[i] = charges[i].x;
+				cy[i] = charges[i].y;
+				cc[i] = charges[i].c * GRAD_SCALE;
+			}
+		}
+
+		// updates grid to follow the charges and samples it from now on,
+		// NULL switches back to the exact sum
+		int set_grid(FieldGrid *g)
+		{
+			grid = g;
+			if (!grid)
+				return 0;
+			if (n == 0)
+				return grid->update(0, NULL, NULL, NULL);
+			return grid->update(n, &cx[0], &cy[0], &cc[0]);
+		}
+
+		// builds the barnes-hut tree t of the charges and evaluates it instead
+		// of the exact sum, NULL or less than TREE_MIN_CHARGES charges switch
+		// back to the exact sum
+		void set_tree(FieldTree *t)
+		{
+			tree = (n >= TREE_MIN_CHARGES) ? t : NULL;
+			if (tree)
+				tree->build(n, n ? &cx[0] : NULL, n ? &cy[0] : NULL, n ? &cc[0] : NULL);
+		}
+
+		// compares the grid to the exact field at random points where the
+		// grid is used, the errors are relative to the exact field magnitude
+		void grid_error(int samples, int width, int height,
+				float *mean_error, float *max_error) const;
+
+		void operator()(float x0, float y0, float *rx, float *ry) const
+		{
+			if (grid && grid->sample(x0, y0, rx, ry))
+				return;
+			if (tree)
+			{
+				tree->evaluate(x0, y0, rx, ry);
+				return;
+			}
+			exact(x0, y0, rx, ry);
+		}
+
+		void exact(float x0, float y0, float *rx, float *ry) const
+		{
+			float ex = 0, ey = 0;
+			for (int i = 0; i < n; i++)
+			{
+				float dx = x0 - cx[i];
+				float dy = y0 - cy[i];
+				float d2r = cc[i] / (dx * dx + dy * dy);
+				ex += dx * d2r;
+				ey += dy * d2r;
+			}
+			*rx = ex;
+			*ry = ey;
+		}
+
+		// batched version, the charges are in the outer loop so the inner
+		// loop over the points vectorizes
+		void operator()(int np, const float *x0, const float *y0,
+				float *rx, float *ry) const
+		{
+			if (grid || tree)
+			{
+				for (int l = 0; l < np; l++)
+					(*this)(x0[l], y0[l], &rx[l], &ry[l]);
+				return;
+			}
+
+			for (int l = 0; l < np; l++)
+			{
+				rx[l] = 0;
+				ry[l] = 0;
+			}
+
+			for (int i = 0; i < n; i++)
+			{
+				const float x = cx[i];
+				const float y = cy[i];
+				const float c = cc[i];
+				for (int l = 0; l < np; l++)
+				{
+					float dx = x0[l] - x;
+					float dy = y0[l] - y;
+					float d2r = c / (dx * dx + dy * dy);
+					rx[l] += dx * d2r;
+					ry[l] += dy * d2r;
+				}
+			}
+		}
+
+	private:
+		int n;
+		std::vector<float> cx, cy, cc;
+		FieldGrid *grid;
+		FieldTree *tree;
 };
 
 #endif
@@ -4,6 +4,7 @@
 #include <map>
 
 #include "OpenALAudio.h"
+#include "WorkerPool.h"
 
 #include "Effect.h"
 #include "Charge.h"
@@ -19,7 +20,13 @@
 class EffectCharge : public Effect
 {
 	public:
-		EffectCharge() : mLineWidth( 1.f ) {}
+		EffectCharge() : mLineWidth( 1.f ), mFieldGridEnabled( false ),
+			mFieldGridWidth( 0 ), mFieldGridHeight( 0 ),
+			mFieldGridMeanError( 0.f ), mFieldGridMaxError( 0.f ),
+			mFieldTreeEnabled( false ), mLineCacheEnabled( true ),
+			mLineCacheRadius( 0.f ), mTracedWidth( 0 ), mTracedHeight( 0 ),
+			mTracedGrid( false ), mTracedTree( false ), mTracedTheta( 0.f ),
+			mNumTraced( 0 ) {}
 
 		void setup(void);
 		void draw(void);
@@ -33,11 +40,54 @@ class EffectCharge : public Effect
 
 		void setLineWidth( float w ) { mLineWidth = w; }
 
+		//! Samples a precalculated field grid instead of summing the charges.
+		void enableFieldGrid( bool enable = true ) { mFieldGridEnabled = enable; }
+		//! Sets the charge movement in pixels the grid follows.
+		void setFieldGridThreshold( float t ) { mFieldGrid.set_threshold( t ); }
+		//! Approximates the field with a Barnes-Hut tree from TREE_MIN_CHARGES charges.
+		/*! Below that the direct sum is faster and is used instead. */
+		void enableFieldTree( bool enable = true ) { mFieldTreeEnabled = enable; }
+		//! Sets the opening angle of the tree, smaller is more accurate and slower, at most TREE_MAX_THETA.
+		void setFieldTreeTheta( float theta ) { mFieldTree.set_theta( theta ); }
+
+		//! Keeps the traced field lines while the charges are stationary.
+		/*! All lines are traced again when a charge moves, changes or is removed. */
+		void enableLineCache( bool enable = true ) { mLineCacheEnabled = enable; }
+		//! Retraces only the lines passing closer than \a r to a moved charge, 0 retraces all.
+		/*! Approximate, the field changes everywhere, so the other lines drift
+			from it until the next full trace. */
+		void setLineCacheRadius( float r ) { mLineCacheRadius = r; }
+		//! Number of particles traced in the last frame.
+		int getNumTracedParticles() const { return mNumTraced; }
+
+		//! Relative errors of the grid against the exact field, measured when the grid changes.
+		float getFieldGridMeanError() const { return mFieldGridMeanError; }
+		float getFieldGridMaxError() const { return mFieldGridMaxError; }
+
 	private:
 		mndl::openal::OpenALAudio mAudio;
 		unsigned mSamples[ MAX_SAMPLES ];
 
 		float mLineWidth;
+
+		FieldGrid mFieldGrid;
+		bool mFieldGridEnabled;
+		int mFieldGridWidth, mFieldGridHeight;
+		float mFieldGridMeanError, mFieldGridMaxError;
+
+		FieldTree mFieldTree;
+		bool mFieldTreeEnabled;
+
+		bool mLineCacheEnabled;
+		float mLineCacheRadius;
+		std::vector< float > mChangedX, mChangedY;	// moved or removed charges
+		// settings the cached lines were traced with
+		int mTracedWidth, mTracedHeight;
+		bool mTracedGrid, mTracedTree;
+		float mTracedTheta;
+		int mNumTraced;
+
+		mndl::WorkerPoolRef mWorkerPool;
 };
 
 extern int within_bounds(float *x0, float *y0, float oldx, float oldy, int sign);
@@ -0,0 +1,93 @@
+#ifndef __FIELDGRID_H__
+#define __FIELDGRID_H__
+
+#include <vector>
+
+#define GRID_CELL_SIZE 8		// distance of the grid nodes in pixels
+#define GRID_NEAR_CELLS 4		// cells closer than this to a charge are evaluated
+								// exactly, the field is too steep to interpolate there
+#define GRID_SKIP_CELLS 1.5		// nodes closer than this to a charge do not get its
+								// contribution, they are only used by near cells
+#define GRID_CHARGE_TOLERANCE .01	// relative charge change triggering an update
+#define GRID_REBUILD_INTERVAL 64	// full rebuild after this many incremental
+									// updates to get rid of the accumulated error
+
+// precalculated field gradients on a regular grid, sampled with bicubic
+// interpolation. the grid follows the charges incrementally, only the
+// contributions of the charges moved further than the threshold are
+// replaced.
+class FieldGrid
+{
+	public:
+		FieldGrid();
+
+		void setup(int width, int height);
+
+		// minimum charge movement in pixels triggering an update
+		void set_threshold(float t) { threshold = t; }
+
+		// cx, cy - charge positions, cc - charges scaled by GRAD_SCALE
+		// returns the number of charges updated, -1 on full rebuild
+		int update(int n, const float *cx, const float *cy, const float *cc);
+
+		// returns false if the point is outside of the grid or near a charge
+		inline bool sample(float x0, float y0, float *rx, float *ry) const;
+
+	private:
+		void rebuild(int n, const float *cx, const float *cy, const float *cc);
+		void add_charge(float x, float y, float c);
+		void mark_near(float x, float y, int d);
+
+		int nx, ny;
+		float threshold;
+		int updates;
+
+		std::vector<float> ex, ey;
+		std::vector<unsigned char> near;	// number of charges near the cell
+
+		std::vector<float> sx, sy, sc;		// charges the grid was built from
+};
+
+// catmull-rom weights
+static inline void cubic_weights(float t, float *w)
+{
+	float t2 = t * t;
+	float t3 = t2 * t;
+	w[0] = .5f * (-t3 + 2 * t2 - t);
+	w[1] = .5f * (3 * t3 - 5 * t2 + 2);
+	w[2] = .5f * (-3 * t3 + 4 * t2 + t);
+	w[3] = .5f * (t3 - t2);
+}
+
+inline bool FieldGrid::sample(float x0, float y0, float *rx, float *ry) const
+{
+	// grid node 0 is at -GRID_CELL_SIZE
+	float fx = x0 * (1.f / GRID_CELL_SIZE) + 1.f;
+	float fy = y0 * (1.f / GRID_CELL_SIZE) + 1.f;
+	if ((fx < 1.f) || (fy < 1.f) || (fx >= nx - 2) || (fy >= ny - 2))
+		return false;
+
+	int ix = int(fx);
+	int iy = int(fy);
+	if (near[iy * nx + ix])
+		return false;
+
+	float wx[4], wy[4];
+	cubic_weights(fx - ix, wx);
+	cubic_weights(fy - iy, wy);
+
+	float gx = 0, gy = 0;
+	int o = (iy - 1) * nx + ix - 1;
+	for (int j = 0; j < 4; j++, o += nx)
+	{
+		float rowx = wx[0] * ex[o] + wx[1] * ex[o + 1] + wx[2] * ex[o + 2] + wx[3] * ex[o + 3];
+		float rowy = wx[0] * ey[o] + wx[1] * ey[o + 1] + wx[2] * ey[o + 2] + wx[3] * ey[o + 3];
+		gx += wy[j] * rowx;
+		gy += wy[j] * rowy;
+	}
+	*rx = gx;
+	*ry = gy;
+	return true;
+}
+
+#endif
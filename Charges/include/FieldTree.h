@@ -0,0 +1,59 @@
+#ifndef __FIELDTREE_H__
+#define __FIELDTREE_H__
+
+#include <vector>
+
+#define TREE_LEAF_SIZE 8		// maximum number of charges in a leaf
+#define TREE_MAX_DEPTH 16		// limit for coincident charges
+#define TREE_TERMS 4			// number of multipole expansion terms
+#define TREE_MIN_CHARGES 2000	// the direct sum is faster below this count
+#define TREE_MAX_THETA .5f		// opening angle limit of a bounded error
+
+// barnes-hut quadtree of the charges. nodes seen at an angle smaller than
+// the opening angle are approximated by a multipole expansion around their
+// center of absolute charge, the rest is summed exactly. the cost of an
+// evaluation grows with log(n) instead of n.
+//
+// according to bench/FieldTreeBench.cpp the tree only wins over the direct
+// sum from a few thousand charges at theta .5 (3000 charges: 2.3us vs
+// 4.0us, 10000: 3.1us vs 13.8us), where the mean relative error is 0.2%.
+// larger angles are faster but the error near cancelling charges exceeds
+// 100%.
+//
+// with z = x + iy the field is ex - i ey = sum c / (z - z_c), which expands
+// around the node center as sum a_k / d^(k+1) where d = z - center and
+// a_k = sum c (z_c - center)^k, a_0 being the total charge.
+class FieldTree
+{
+	public:
+		FieldTree();
+
+		// opening angle, node size / distance, 0 is the exact sum, it is
+		// clamped to TREE_MAX_THETA
+		void set_theta(float t) { theta = t < 0 ? 0 : (t > TREE_MAX_THETA ? TREE_MAX_THETA : t); }
+		float get_theta() const { return theta; }
+
+		// cx, cy - charge positions, cc - charges scaled by GRAD_SCALE
+		void build(int n, const float *cx, const float *cy, const float *cc);
+
+		void evaluate(float x0, float y0, float *rx, float *ry) const;
+
+	private:
+		struct Node
+		{
+			float x, y;		// center of absolute charge
+			float size;		// edge length of the node square
+			float are[TREE_TERMS], aim[TREE_TERMS];	// multipole moments a_k
+			int first, count;	// charge range in the sorted arrays
+			int child[4];	// -1 if not present, all -1 for leaves
+		};
+
+		int build_node(int first, int count, float x0, float y0, float size, int depth);
+
+		float theta;
+		std::vector<Node> nodes;
+		std::vector<float> sx, sy, sc;		// charges sorted by node
+		std::vector<int> order, scratch;
+};
+
+#endif
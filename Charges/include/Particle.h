@@ -1,6 +1,8 @@
 #ifndef __PARTICLE_H__
 #define __PARTICLE_H__
 
+#include <vector>
+
 #include "EffectCharge.h"
 #include "AdarKutta.h"
 
@@ -12,13 +14,42 @@
 //#define		PARTICLE_COLOR1 0x251e16
 //#define		PARTICLE_COLOR2 0x0f151a
 
+// line segments with colors, built from the traced particle paths and
+// drawn on the main thread
+struct LineBuffer
+{
+	void clear() { vertices.clear(); colors.clear(); }
+	void add(float x0, float y0, const float *color0,
+			 float x1, float y1, const float *color1);
+	void draw() const;
+
+	std::vector<float> vertices;
+	std::vector<float> colors;
+};
+
 class Particle
 {
 	public:
 		void init(float x, float y, int sign, float chargex, float chargey,
 				int color_index);
 
-		int update(DERIVFUNC derivfunc);
+		// integrator state for the batched update in Charge
+		int is_alive() const { return alive; }
+		float get_x() const { return x; }
+		float get_y() const { return y; }
+		float get_htry() const { return htry; }
+		int get_sign() const { return sign; }
+
+		// moves the particle to the already integrated position and adds
+		// it to the path, returns 1 if alive
+		int advance(float nx, float ny, float hnext);
+		// ends tracing, the path is kept until the next init
+		void stop() { alive = 0; }
+
+		// returns 1 if the path comes closer than r to any of the n points
+		int passes_near(int n, const float *px, const float *py, float r) const;
+		// adds the path to the line buffer
+		void add_lines(LineBuffer &lines) const;
 
 	private:
 		float x, y;
@@ -29,6 +60,8 @@ class Particle
 		int update_count;
 
 		int color_index; //< index in color table
+
+		std::vector<float> path; //< traced positions, x, y pairs
 };
 
 #endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 
 #include "cinder/gl/gl.h"
@@ -14,6 +15,9 @@ Charge::Charge(int id, float x, float y, float c, int color_index)
 	this->y = y;
 	this->c = c;
 	this->color_index = color_index;
+
+	traced = 0;
+	invalidate();
 }
 
 void Charge::field(float x0, float y0, float *rx, float *ry)
@@ -30,18 +34,152 @@ void Charge::field(float x0, float y0, float *rx, float *ry)
 	 *ry = GRAD_SCALE*dy*c/(d2*d); */
 }
 
-// returns 1 if there are particles alive
-int Charge::update_particles(DERIVFUNC derivfunc)
+int Charge::state_changed(float *oldx, float *oldy, int *was_traced) const
+{
+	*oldx = traced_x;
+	*oldy = traced_y;
+	*was_traced = traced;
+	return !traced ||
+		(key_x != (int)floor(x / CACHE_POS_QUANT)) ||
+		(key_y != (int)floor(y / CACHE_POS_QUANT)) ||
+		(key_c != (int)floor(c / CACHE_CHARGE_QUANT));
+}
+
+void Charge::invalidate()
+{
+	for (int i = 0; i < MAX_PARTICLES; i++)
+		dirty[i] = true;
+	lines_dirty = true;
+}
+
+void Charge::invalidate_near(int n, const float *px, const float *py, float r)
 {
-	int r = 0;
-	gl::enable( GL_LINE_SMOOTH );
-	glBegin( GL_LINES );
 	for (int i = 0; i < MAX_PARTICLES; i++)
 	{
-		r |= particles[i].update(derivfunc);
+		if (!dirty[i] && particles[i].passes_near(n, px, py, r))
+		{
+			dirty[i] = true;
+			lines_dirty = true;
+		}
+	}
+}
+
+// places the invalidated particles on a small circle around the charge
+int Charge::init_particles()
+{
+	int n = 0;
+	float a = 0.0;
+	for (int i = 0; i < MAX_PARTICLES; i++)
+	{
+		if (dirty[i])
+		{
+			particles[i].init(x + 5 * cos(a), y + 5 * sin(a),
+					c < 0 ? -1 : 1, x, y, color_index);
+			dirty[i] = false;
+			n++;
+		}
+		a += 2*M_PI / MAX_PARTICLES;
+	}
+
+	key_x = (int)floor(x / CACHE_POS_QUANT);
+	key_y = (int)floor(y / CACHE_POS_QUANT);
+	key_c = (int)floor(c / CACHE_CHARGE_QUANT);
+	traced_x = x;
+	traced_y = y;
+	traced = 1;
+	return n;
+}
+
+// integrates the alive particles in [begin, end) together with the batched
+// solver, returns 1 if there are particles alive
+int Charge::update_particles(DERIVFUNC_BATCH derivfunc, int begin, int end)
+{
+	float x0[MAX_PARTICLES], y0[MAX_PARTICLES], htry[MAX_PARTICLES];
+	float x1[MAX_PARTICLES], y1[MAX_PARTICLES], hnext[MAX_PARTICLES];
+	int sign[MAX_PARTICLES], index[MAX_PARTICLES];
+
+	int n = 0;
+	for (int i = begin; i < end; i++)
+	{
+		if (!particles[i].is_alive())
+			continue;
+		x0[n] = particles[i].get_x();
+		y0[n] = particles[i].get_y();
+		htry[n] = particles[i].get_htry();
+		sign[n] = particles[i].get_sign();
+		index[n] = i;
+		n++;
+	}
+
+	if (n == 0)
+		return 0;
+
+	rkqs_batch(n, x0, y0, derivfunc, x1, y1, htry, ODE_ACCURACY, hnext, sign);
+
+	int r = 0;
+	for (int i = 0; i < n; i++)
+	{
+		r |= particles[index[i]].advance(x1[i], y1[i], hnext[i]);
 	}
-	glEnd();
-	gl::disable( GL_LINE_SMOOTH );
 	return r;
 }
 
+// traces the path of the particles in a chunk until all of them die or
+// the update limit is reached. the paths only depend on the charges, so the
+// chunks can be traced in parallel as long as the charges do not change.
+void Charge::trace(DERIVFUNC_BATCH derivfunc, int chunk)
+{
+	int begin = chunk * MAX_PARTICLES / TRACE_CHUNKS;
+	int end = (chunk + 1) * MAX_PARTICLES / TRACE_CHUNKS;
+
+	int updates = 0;
+	while ((updates < MAX_PART_UPDATES) &&
+		   update_particles(derivfunc, begin, end))
+	{
+		updates++;
+	}
+
+	for (int i = begin; i < end; i++)
+		particles[i].stop();
+}
+
+void Charge::draw()
+{
+	if (lines_dirty)
+	{
+		lines.clear();
+		for (int i = 0; i < MAX_PARTICLES; i++)
+			particles[i].add_lines(lines);
+		lines_dirty = false;
+	}
+	lines.draw();
+}
+
+
+void ChargeField::grid_error(int samples, int width, int height,
+		float *mean_error, float *max_error) const
+{
+	double sum = 0;
+	float max = 0;
+	int count = 0;
+	for (int i = 0; (i < samples) && grid; i++)
+	{
+		float x0 = rand() % width;
+		float y0 = rand() % height;
+		float gx, gy, rx, ry;
+		if (!grid->sample(x0, y0, &gx, &gy))
+			continue;
+		exact(x0, y0, &rx, &ry);
+
+		float m = sqrt(rx * rx + ry * ry);
+		if (m <= 0)
+			continue;
+		float e = sqrt((gx - rx) * (gx - rx) + (gy - ry) * (gy - ry)) / m;
+		sum += e;
+		if (e > max)
+			max = e;
+		count++;
+	}
+	*mean_error = count ? sum / count : 0;
+	*max_error = max;
+}
@@ -20,6 +20,7 @@
 
 #include "cinder/Cinder.h"
 #include "cinder/CinderMath.h"
+#include "cinder/Utilities.h"
 #include "cinder/app/AppBasic.h"
 #include "cinder/gl/Fbo.h"
 #include "cinder/gl/gl.h"
@@ -67,6 +68,16 @@ class ChargesApp : public AppBasic
 		float mLineWidth;
 		float mBloomStrength;
 		float mFingerDisapperanceThreshold;
+
+		bool mFieldTree;
+		float mFieldTreeTheta;
+		bool mLineCache;
+		float mLineCacheRadius;
+		int mNumTraced;
+		bool mFieldGrid;
+		float mFieldGridThreshold;
+		float mFieldGridMeanError;
+		float mFieldGridMaxError;
 };
 
 void ChargesApp::prepareSettings( Settings *settings )
@@ -102,6 +113,19 @@ void ChargesApp::setup()
 	mParams.addPersistentParam( "Line width", &mLineWidth, 4.5f, "min=.5 max=10 step=.1" );
 	mParams.addPersistentParam( "Bloom strength", &mBloomStrength, .8f, "min=0 max=1 step=.05" );
 	mParams.addPersistentParam( "Finger disapperance thr", &mFingerDisapperanceThreshold, .1f, "min=0 max=2 step=.05" );
+	mParams.addSeparator();
+	mParams.addPersistentParam( "Line cache", &mLineCache, true );
+	mParams.addPersistentParam( "Line cache radius", &mLineCacheRadius, 0.f, "min=0 max=500 step=5 "
+			"help='only lines near moved charges are traced again, approximate, 0 traces all'" );
+	mParams.addParam( "Traced particles", &mNumTraced, "", true );
+	mParams.addPersistentParam( "Field tree", &mFieldTree, false,
+			"help='only used from " + toString( TREE_MIN_CHARGES ) +
+			" charges, the direct sum is faster below'" );
+	mParams.addPersistentParam( "Tree opening angle", &mFieldTreeTheta, .5f, "min=0 max=.5 step=.05" );
+	mParams.addPersistentParam( "Field grid", &mFieldGrid, false );
+	mParams.addPersistentParam( "Grid threshold", &mFieldGridThreshold, .5f, "min=0 max=10 step=.1" );
+	mParams.addParam( "Grid mean error", &mFieldGridMeanError, "", true );
+	mParams.addParam( "Grid max error", &mFieldGridMaxError, "", true );
 
 	mndl::kit::params::PInterfaceGl::showAllParams( false );
 }
@@ -194,7 +218,16 @@ void ChargesApp::draw()
 
 	gl::clear( Color::black() );
 	mEffectCharge.setLineWidth( mLineWidth );
+	mEffectCharge.enableLineCache( mLineCache );
+	mEffectCharge.setLineCacheRadius( mLineCacheRadius );
+	mEffectCharge.enableFieldTree( mFieldTree );
+	mEffectCharge.setFieldTreeTheta( mFieldTreeTheta );
+	mEffectCharge.enableFieldGrid( mFieldGrid );
+	mEffectCharge.setFieldGridThreshold( mFieldGridThreshold );
 	mEffectCharge.draw();
+	mFieldGridMeanError = mEffectCharge.getFieldGridMeanError();
+	mFieldGridMaxError = mEffectCharge.getFieldGridMaxError();
+	mNumTraced = mEffectCharge.getNumTracedParticles();
 
 	mFbo.unbindFramebuffer();
 
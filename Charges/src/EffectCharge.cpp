@@ -75,18 +75,14 @@ int within_bounds(float *x0, float *y0, float oldx, float oldy, int sign)
     return 1;
 }
 
-static void calc_gradients(float x0, float y0, float *rx, float *ry)
+static ChargeField field;
+
+// batched gradients of the charges of the frame, the field does not change
+// while the worker pool traces the particles
+static void calc_gradients_batch(int n, const float *x0, const float *y0,
+		float *rx, float *ry)
 {
-	float ex, ey, gx, gy;
-	ex = ey = 0;
-	for (unsigned i = 0; i < charges.size(); i++)
-	{
-		charges[i].field(x0, y0, &gx, &gy);
-		ex += gx;
-		ey += gy;
-	}
-	*rx = ex;
-	*ry = ey;
+	field(n, x0, y0, rx, ry);
 }
 
 #define max(a, b) (((a) > (b)) ? (a) : (b))
@@ -110,6 +106,8 @@ void EffectCharge::setup(void)
 		}
 	}
 
+	mWorkerPool = mndl::WorkerPool::create();
+
 	/* load sounds */
 	for ( int i = 0; i < MAX_SAMPLES; i++ )
 	{
@@ -140,34 +138,102 @@ void EffectCharge::draw(void)
 	gl::enableAlphaBlending();
 
 	glLineWidth( mLineWidth );
+	mNumTraced = 0;
     if (charges.size())
 	{
-		/* generate particles from charges */
+		/* the cached lines are thrown away if the field settings changed */
+		bool useTree = mFieldTreeEnabled && (charges.size() >= TREE_MIN_CHARGES);
+		bool invalidateAll = !mLineCacheEnabled ||
+			(mTracedWidth != width) || (mTracedHeight != height) ||
+			(mTracedGrid != mFieldGridEnabled) || (mTracedTree != useTree) ||
+			(useTree && (mTracedTheta != mFieldTree.get_theta()));
+		mTracedWidth = width;
+		mTracedHeight = height;
+		mTracedGrid = mFieldGridEnabled;
+		mTracedTree = useTree;
+		mTracedTheta = mFieldTree.get_theta();
+
+		/* any moved charge changes the field everywhere, so all lines are
+		 * traced again. with a cache radius only the lines of the moved
+		 * charges and the lines passing near their old and new positions
+		 * are, which is faster, but the other lines drift from the field */
 		for (unsigned j = 0; j < charges.size(); j++)
 		{
-			float a = 0.0;
-			for (int i = 0; i < MAX_PARTICLES; i++)
+			float ox, oy;
+			int traced;
+			if (charges[j].state_changed(&ox, &oy, &traced))
 			{
-				charges[j].particles[i].init(charges[j].x + 5 * cos(a),
-						charges[j].y + 5 * sin(a),
-						charges[j].c < 0 ? -1 : 1,
-						charges[j].x, charges[j].y,
-						charges[j].color_index);
-				a += 2*M_PI / MAX_PARTICLES;
+				charges[j].invalidate();
+				mChangedX.push_back(charges[j].x);
+				mChangedY.push_back(charges[j].y);
+				if (traced)
+				{
+					mChangedX.push_back(ox);
+					mChangedY.push_back(oy);
+				}
 			}
 		}
 
-		/* trace path of particles */
-		int particles_alive, max_updates = 0;
-		do
+		if (!mChangedX.empty() && (mLineCacheRadius <= 0))
+			invalidateAll = true;
+		for (unsigned j = 0; j < charges.size(); j++)
+		{
+			if (invalidateAll)
+				charges[j].invalidate();
+			else if (!mChangedX.empty())
+				charges[j].invalidate_near(mChangedX.size(), &mChangedX[0],
+						&mChangedY[0], mLineCacheRadius);
+		}
+
+		/* generate particles from charges */
+		for (unsigned j = 0; j < charges.size(); j++)
+		{
+			mNumTraced += charges[j].init_particles();
+		}
+	}
+	mChangedX.clear();
+	mChangedY.clear();
+
+	if (mNumTraced)
+	{
+		field.set(charges);
+		field.set_tree(mFieldTreeEnabled ? &mFieldTree : NULL);
+		if (mFieldGridEnabled)
 		{
-			particles_alive = 0;
-			for (unsigned j = 0; j < charges.size(); j++)
+			if ((mFieldGridWidth != width) || (mFieldGridHeight != height))
 			{
-				particles_alive |= charges[j].update_particles(calc_gradients);
+				mFieldGrid.setup(width, height);
+				mFieldGridWidth = width;
+				mFieldGridHeight = height;
 			}
-			max_updates++;
-		} while (particles_alive && (max_updates < MAX_PART_UPDATES));
+
+			/* measure the accuracy whenever the grid changes */
+			if (field.set_grid(&mFieldGrid))
+				field.grid_error(256, width, height, &mFieldGridMeanError, &mFieldGridMaxError);
+		}
+		else
+		{
+			field.set_grid(NULL);
+		}
+
+		/* trace path of particles, the charges do not change during the
+		 * frame, so every chunk of particles is traced on the worker pool */
+		mWorkerPool->parallelFor(charges.size() * TRACE_CHUNKS,
+			[&](int i)
+			{
+				charges[i / TRACE_CHUNKS].trace(calc_gradients_batch, i % TRACE_CHUNKS);
+			});
+	}
+
+    if (charges.size())
+	{
+		/* draw the traced paths */
+		gl::enable( GL_LINE_SMOOTH );
+		for (unsigned j = 0; j < charges.size(); j++)
+		{
+			charges[j].draw();
+		}
+		gl::disable( GL_LINE_SMOOTH );
 	}
 
 	gl::disableAlphaBlending();
@@ -207,6 +273,9 @@ void EffectCharge::removeCursor(int id)
 	{
 		if ((*it).id == id)
 		{
+			/* lines passing near the removed charge are traced again */
+			mChangedX.push_back((*it).x);
+			mChangedY.push_back((*it).y);
 			charges.erase(it);
 			break;
 		}
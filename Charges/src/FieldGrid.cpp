@@ -0,0 +1,122 @@
+#include <math.h>
+
+#include "FieldGrid.h"
+
+FieldGrid::FieldGrid() :
+	nx(0), ny(0), threshold(.5f), updates(0)
+{
+}
+
+void FieldGrid::setup(int width, int height)
+{
+	// one node padding before and two after the screen for the bicubic taps
+	nx = width / GRID_CELL_SIZE + 4;
+	ny = height / GRID_CELL_SIZE + 4;
+
+	ex.assign(nx * ny, 0.f);
+	ey.assign(nx * ny, 0.f);
+	near.assign(nx * ny, 0);
+	sx.clear();
+	sy.clear();
+	sc.clear();
+}
+
+int FieldGrid::update(int n, const float *cx, const float *cy, const float *cc)
+{
+	if ((n != (int)sx.size()) || (updates >= GRID_REBUILD_INTERVAL))
+	{
+		rebuild(n, cx, cy, cc);
+		return -1;
+	}
+
+	int changed = 0;
+	for (int i = 0; i < n; i++)
+	{
+		float dx = cx[i] - sx[i];
+		float dy = cy[i] - sy[i];
+		if ((dx * dx + dy * dy <= threshold * threshold) &&
+			(fabs(cc[i] - sc[i]) <= GRID_CHARGE_TOLERANCE * fabs(sc[i])))
+			continue;
+
+		// replace the contribution of the charge
+		add_charge(sx[i], sy[i], -sc[i]);
+		mark_near(sx[i], sy[i], -1);
+		sx[i] = cx[i];
+		sy[i] = cy[i];
+		sc[i] = cc[i];
+		add_charge(sx[i], sy[i], sc[i]);
+		mark_near(sx[i], sy[i], 1);
+		changed++;
+	}
+
+	if (changed)
+		updates++;
+	return changed;
+}
+
+void FieldGrid::rebuild(int n, const float *cx, const float *cy, const float *cc)
+{
+	ex.assign(nx * ny, 0.f);
+	ey.assign(nx * ny, 0.f);
+	near.assign(nx * ny, 0);
+
+	sx.assign(cx, cx + n);
+	sy.assign(cy, cy + n);
+	sc.assign(cc, cc + n);
+	for (int i = 0; i < n; i++)
+	{
+		add_charge(sx[i], sy[i], sc[i]);
+		mark_near(sx[i], sy[i], 1);
+	}
+	updates = 0;
+}
+
+// adds the field of charge c at (x, y) to the grid nodes
+void FieldGrid::add_charge(float x, float y, float c)
+{
+	const float skip2 = (GRID_SKIP_CELLS * GRID_CELL_SIZE) * (GRID_SKIP_CELLS * GRID_CELL_SIZE);
+	for (int j = 0; j < ny; j++)
+	{
+		float dy = (j - 1) * GRID_CELL_SIZE - y;
+		float *rowx = &ex[j * nx];
+		float *rowy = &ey[j * nx];
+		for (int i = 0; i < nx; i++)
+		{
+			float dx = (i - 1) * GRID_CELL_SIZE - x;
+			float d2 = dx * dx + dy * dy;
+			if (d2 < skip2)
+				continue;
+			float d2r = c / d2;
+			rowx[i] += dx * d2r;
+			rowy[i] += dy * d2r;
+		}
+	}
+}
+
+// changes the near counter of the cells around (x, y) by d
+void FieldGrid::mark_near(float x, float y, int d)
+{
+	const float r = GRID_NEAR_CELLS;
+	float fx = x / GRID_CELL_SIZE + 1.f;
+	float fy = y / GRID_CELL_SIZE + 1.f;
+
+	int j0 = (int)floor(fy - r);
+	int j1 = (int)ceil(fy + r);
+	int i0 = (int)floor(fx - r);
+	int i1 = (int)ceil(fx + r);
+	if (j0 < 0) j0 = 0;
+	if (i0 < 0) i0 = 0;
+	if (j1 > ny - 1) j1 = ny - 1;
+	if (i1 > nx - 1) i1 = nx - 1;
+
+	for (int j = j0; j <= j1; j++)
+	{
+		float dy = j + .5f - fy;
+		for (int i = i0; i <= i1; i++)
+		{
+			float dx = i + .5f - fx;
+			if (dx * dx + dy * dy < r * r)
+				near[j * nx + i] += d;
+		}
+	}
+}
@@ -0,0 +1,210 @@
+#include <math.h>
+
+#include "FieldTree.h"
+
+FieldTree::FieldTree() :
+	theta(.5f)
+{
+}
+
+void FieldTree::build(int n, const float *cx, const float *cy, const float *cc)
+{
+	nodes.clear();
+	if (n == 0)
+		return;
+
+	float xmin = cx[0], xmax = cx[0], ymin = cy[0], ymax = cy[0];
+	for (int i = 1; i < n; i++)
+	{
+		if (cx[i] < xmin) xmin = cx[i];
+		if (cx[i] > xmax) xmax = cx[i];
+		if (cy[i] < ymin) ymin = cy[i];
+		if (cy[i] > ymax) ymax = cy[i];
+	}
+	float size = (xmax - xmin > ymax - ymin) ? xmax - xmin : ymax - ymin;
+	size = size * 1.001f + 1.f;
+
+	// the unsorted charges are kept in sx, sy, sc during the build
+	sx.assign(cx, cx + n);
+	sy.assign(cy, cy + n);
+	sc.assign(cc, cc + n);
+	order.resize(n);
+	scratch.resize(n);
+	for (int i = 0; i < n; i++)
+		order[i] = i;
+
+	build_node(0, n, xmin, ymin, size, 0);
+
+	// reorder charges, so every node covers a continuous range
+	std::vector<float> tx(n), ty(n), tc(n);
+	for (int i = 0; i < n; i++)
+	{
+		tx[i] = sx[order[i]];
+		ty[i] = sy[order[i]];
+		tc[i] = sc[order[i]];
+	}
+	sx.swap(tx);
+	sy.swap(ty);
+	sc.swap(tc);
+}
+
+// builds the node of the charges order[first, first + count) inside the
+// square at (x0, y0), returns the node index
+int FieldTree::build_node(int first, int count, float x0, float y0, float size, int depth)
+{
+	int index = nodes.size();
+	nodes.push_back(Node());
+	Node node;
+	node.size = size;
+	node.first = first;
+	node.count = count;
+	for (int i = 0; i < 4; i++)
+		node.child[i] = -1;
+
+	// moments
+	float qa = 0, mx = 0, my = 0;
+	for (int i = first; i < first + count; i++)
+	{
+		int k = order[i];
+		float a = fabs(sc[k]);
+		qa += a;
+		mx += a * sx[k];
+		my += a * sy[k];
+	}
+	if (qa > 0)
+	{
+		node.x = mx / qa;
+		node.y = my / qa;
+	}
+	else
+	{
+		node.x = x0 + size * .5f;
+		node.y = y0 + size * .5f;
+	}
+	for (int k = 0; k < TREE_TERMS; k++)
+		node.are[k] = node.aim[k] = 0;
+	for (int i = first; i < first + count; i++)
+	{
+		int k = order[i];
+		// c * (z_c - center)^t
+		float dre = sx[k] - node.x;
+		float dim = sy[k] - node.y;
+		float pre = sc[k], pim = 0;
+		for (int t = 0; t < TREE_TERMS; t++)
+		{
+			node.are[t] += pre;
+			node.aim[t] += pim;
+			float re = pre * dre - pim * dim;
+			pim = pre * dim + pim * dre;
+			pre = re;
+		}
+	}
+
+	if ((count > TREE_LEAF_SIZE) && (depth < TREE_MAX_DEPTH))
+	{
+		// sort the charges into quadrants
+		float half = size * .5f;
+		float midx = x0 + half;
+		float midy = y0 + half;
+		int quadrant_count[4] = { 0, 0, 0, 0 };
+		for (int i = first; i < first + count; i++)
+		{
+			int k = order[i];
+			int qd = (sx[k] >= midx) + 2 * (sy[k] >= midy);
+			quadrant_count[qd]++;
+		}
+		int offset[4];
+		offset[0] = first;
+		for (int i = 1; i < 4; i++)
+			offset[i] = offset[i - 1] + quadrant_count[i - 1];
+		int pos[4] = { offset[0], offset[1], offset[2], offset[3] };
+		for (int i = first; i < first + count; i++)
+		{
+			int k = order[i];
+			int qd = (sx[k] >= midx) + 2 * (sy[k] >= midy);
+			scratch[pos[qd]++] = k;
+		}
+		for (int i = first; i < first + count; i++)
+			order[i] = scratch[i];
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (quadrant_count[i] == 0)
+				continue;
+			node.child[i] = build_node(offset[i], quadrant_count[i],
+					x0 + (i & 1) * half, y0 + (i >> 1) * half, half, depth + 1);
+		}
+	}
+
+	nodes[index] = node;
+	return index;
+}
+
+void FieldTree::evaluate(float x0, float y0, float *rx, float *ry) const
+{
+	float ex = 0, ey = 0;
+	if (nodes.empty())
+	{
+		*rx = *ry = 0;
+		return;
+	}
+
+	const float theta2 = theta * theta;
+	int stack[3 * TREE_MAX_DEPTH + 4];
+	int top = 0;
+	stack[top++] = 0;
+	while (top)
+	{
+		const Node &node = nodes[stack[--top]];
+		float dx = x0 - node.x;
+		float dy = y0 - node.y;
+		float d2 = dx * dx + dy * dy;
+
+		bool leaf = (node.child[0] < 0) && (node.child[1] < 0) &&
+					(node.child[2] < 0) && (node.child[3] < 0);
+		if ((node.count > 1) && (node.size * node.size < theta2 * d2))
+		{
+			// multipole approximation, horner scheme in w = 1 / d
+			float id2 = 1.f / d2;
+			float wre = dx * id2;
+			float wim = -dy * id2;
+			float sre = node.are[TREE_TERMS - 1];
+			float sim = node.aim[TREE_TERMS - 1];
+			for (int k = TREE_TERMS - 2; k >= -1; k--)
+			{
+				float re = sre * wre - sim * wim;
+				sim = sre * wim + sim * wre;
+				sre = re;
+				if (k >= 0)
+				{
+					sre += node.are[k];
+					sim += node.aim[k];
+				}
+			}
+			ex += sre;
+			ey -= sim;
+		}
+		else
+		if (leaf)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				float cdx = x0 - sx[i];
+				float cdy = y0 - sy[i];
+				float d2r = sc[i] / (cdx * cdx + cdy * cdy);
+				ex += cdx * d2r;
+				ey += cdy * d2r;
+			}
+		}
+		else
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				if (node.child[i] >= 0)
+					stack[top++] = node.child[i];
+			}
+		}
+	}
+	*rx = ex;
+	*ry = ey;
+}
@@ -23,28 +23,26 @@ void Particle::init(float x, float y, int sign, float chargex, float chargey,
     update_count = 1;
 
 	this->color_index = color_index;
+
+	path.clear();
+	path.push_back(oldx);
+	path.push_back(oldy);
 }
 
 // returns 1 if alive
-int Particle::update(DERIVFUNC derivfunc)
+int Particle::advance(float nx, float ny, float hnext)
 {
-	if (!alive)
-		return 0;
-
-	rkqs(x, y, derivfunc, &x, &y, htry, ODE_ACCURACY, &htry, sign);
+	x = nx;
+	y = ny;
+	htry = hnext;
 
 	if (!within_bounds(&x, &y, oldx, oldy, sign))
 	{
 		alive = 0;
 	}
 
-	float *color0 = colorShadeTab[color_index][update_count - 1];
-	float *color1 = colorShadeTab[color_index][update_count];
-
-	glColor4fv(color0);
-	glVertex2f(oldx, oldy);
-	glColor4fv(color1);
-	glVertex2f(x, y);
+	path.push_back(x);
+	path.push_back(y);
 
 	oldx = x;
 	oldy = y;
@@ -53,3 +51,58 @@ int Particle::update(DERIVFUNC derivfunc)
 	return alive;
 }
 
+int Particle::passes_near(int n, const float *px, const float *py, float r) const
+{
+	float r2 = r * r;
+	for (size_t k = 0; k < path.size(); k += 2)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			float dx = path[k] - px[i];
+			float dy = path[k + 1] - py[i];
+			if (dx * dx + dy * dy < r2)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+// the k-th point of the path gets the k-th shade of the particle color
+void Particle::add_lines(LineBuffer &lines) const
+{
+	int points = path.size() / 2;
+	for (int k = 1; k < points; k++)
+	{
+		int c0 = (k - 1 < MAX_PART_UPDATES) ? k - 1 : MAX_PART_UPDATES - 1;
+		int c1 = (k < MAX_PART_UPDATES) ? k : MAX_PART_UPDATES - 1;
+		lines.add(path[2 * k - 2], path[2 * k - 1], colorShadeTab[color_index][c0],
+				path[2 * k], path[2 * k + 1], colorShadeTab[color_index][c1]);
+	}
+}
+
+void LineBuffer::add(float x0, float y0, const float *color0,
+		float x1, float y1, const float *color1)
+{
+	vertices.push_back(x0);
+	vertices.push_back(y0);
+	vertices.push_back(x1);
+	vertices.push_back(y1);
+	colors.insert(colors.end(), color0, color0 + 4);
+	colors.insert(colors.end(), color1, color1 + 4);
+}
+
+void LineBuffer::draw() const
+{
+	if (vertices.empty())
+		return;
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, &vertices[0]);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glColorPointer(4, GL_FLOAT, 0, &colors[0]);
+
+	glDrawArrays(GL_LINES, 0, vertices.size() / 2);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+}
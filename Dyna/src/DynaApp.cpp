@@ -33,6 +33,7 @@
 
 #include "DynaStroke.h"
 #include "Particles.h"
+#include "EmissionGovernor.h"
 
 using namespace ci;
 using namespace ci::app;
@@ -88,6 +89,11 @@ class DynaApp : public AppBasic
 		void addToFluid(Vec2f pos, Vec2f vel, bool addParticles, bool addForce);
 
 		ParticleManager mParticles;
+		mndl::particles::EmissionGovernor mGovernor;
+		bool mGovernorEnabled;
+		float mGovernorFps;
+		float mGovernorDensity;
+		mndl::particles::EmissionGovernor::State mGovernorState;
 
 		ci::Vec2i mPrevMouse;
 
@@ -116,6 +122,10 @@ DynaApp::DynaApp() :
 	mVelParticleMult( .26 ),
 	mVelParticleMin( 1 ),
 	mVelParticleMax( 60 ),
+	mGovernorEnabled( true ),
+	mGovernorFps( 60 ),
+	mGovernorDensity( 1 ),
+	mGovernorState( mndl::particles::EmissionGovernor::STEADY ),
 	mBloomIterations( 8 ),
 	mBloomStrength( .8 )
 {
@@ -144,6 +154,9 @@ void DynaApp::setup()
 	mParams.addParam("Velocity particle multiplier", &mVelParticleMult, "min=0 max=2 step=.01");
 	mParams.addParam("Velocity particle min", &mVelParticleMin, "min=1 max=100 step=.5");
 	mParams.addParam("Velocity particle max", &mVelParticleMax, "min=1 max=100 step=.5");
+	mParams.addParam("Governor enabled", &mGovernorEnabled);
+	mParams.addParam("Governor target fps", &mGovernorFps, "min=10 max=120 step=1");
+	mParams.addParam("Governor density", &mGovernorDensity, "", true);
 
 	mParams.addParam("Bloom iterations", &mBloomIterations, "min=0 max=8");
 	mParams.addParam("Bloom strength", &mBloomStrength, "min=0 max=1. step=.05");
@@ -221,6 +234,7 @@ void DynaApp::addToFluid( Vec2f pos, Vec2f vel, bool addParticles, bool addForce
 						lmap<float>( vel.length() * mVelParticleMult * getWindowWidth(),
 									 mVelParticleMin, mVelParticleMax,
 									 mParticleMin, mParticleMax ) );
+			count = mGovernor.getEmissionCount( count );
 			if (count > 0)
 			{
 				mParticles.addParticle( pos * Vec2f( mFbo.getSize() ), count);
@@ -275,17 +289,32 @@ void DynaApp::update()
 {
 	mFps = getAverageFps();
 
+	// particle emission governor
+	mGovernor.setEnabled( mGovernorEnabled );
+	mGovernor.setTargetFrameTime( 1. / mGovernorFps );
+	mGovernor.endFrame( mParticles.getNumActive() );
+	mGovernorDensity = mGovernor.getDensity();
+	if ( mGovernor.getState() != mGovernorState )
+	{
+		mGovernorState = mGovernor.getState();
+		console() << mGovernor.getStatus() << endl;
+	}
+
 	if ( mLeftButton && !mDynaStrokes.empty() )
 		mDynaStrokes.back().update( Vec2f( mMousePos ) / getWindowSize() );
 
 	mFluidSolver.update();
 
 	mParticles.setAging( 0.9 );
+	mGovernor.beginUpdate();
 	mParticles.update( getElapsedSeconds() );
+	mGovernor.endUpdate();
+	mGovernor.endWork();
 }
 
 void DynaApp::draw()
 {
+	mGovernor.beginWork();
 	gl::clear( Color::black() );
 
 	mFbo.bindFramebuffer();
@@ -306,7 +335,9 @@ void DynaApp::draw()
 	mBrush.unbind();
 	gl::disableAlphaBlending();
 
+	mGovernor.beginDraw();
 	mParticles.draw();
+	mGovernor.endDraw();
 
 	mFbo.unbindFramebuffer();
 
@@ -354,6 +385,7 @@ void DynaApp::draw()
 	gl::disableAlphaBlending();
 
 	params::InterfaceGl::draw();
+	mGovernor.endWork();
 }
 
 CINDER_APP_BASIC(DynaApp, RendererGl( RendererGl::AA_NONE ))
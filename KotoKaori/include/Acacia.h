@@ -9,7 +9,6 @@
 #include "cinder/Rand.h"
 #include "cinder/Utilities.h"
 #include "cinder/Filesystem.h"
-#include "cinder/ip/Resize.h"
 #include "cinder/Rect.h"
 
 #include "ciMsaFluidSolver.h"
@@ -17,6 +16,9 @@
 
 #include "CinderOpenCV.h"
 
+#include "FeatureTracker.h"
+#include "GreyDownsampler.h"
+
 #include "PParams.h"
 #include "NI.h"
 #include "Leaves.h"
@@ -84,12 +86,11 @@ class Acacia : public Effect
 		ci::OpenNI mNI;
 		ci::gl::Texture mOptFlowTexture;
 
-		void chooseFeatures( cv::Mat currentFrame );
-		void trackFeatures( cv::Mat currentFrame );
-
-		cv::Mat mPrevFrame;
+		mndl::FeatureTrackerRef mFeatureTracker;
+		mndl::GreyDownsamplerRef mGreyDownsampler;
 		std::vector<cv::Point2f> mPrevFeatures, mFeatures;
 		std::vector<uint8_t> mFeatureStatuses;
+		float mTrackTime;
 
 		static const int MAX_FEATURES = 128;
 		#define CAMERA_WIDTH 160
@@ -62,6 +62,8 @@ void Acacia::setup()
 	mParams.addPersistentParam( "Atmosphere", &mDrawAtmosphere, false );
 	mParams.addPersistentParam( "Camera", &mDrawCamera, false );
 	mParams.addPersistentParam( "Features", &mDrawFeatures, false );
+	mTrackTime = 0.f;
+	mParams.addParam( "Tracking ms", &mTrackTime, "", true );
 
 	mBWTextures = loadTextures( "Akac/bw" );
 
@@ -80,6 +82,12 @@ void Acacia::setup()
 	mBloomShader = gl::GlslProg(loadResource(RES_PASSTHROUGH_VERT),
 								loadResource(RES_BLOOM_FRAG));
 
+	// features are tracked on a worker thread
+	mFeatureTracker = mndl::FeatureTracker::create();
+	mndl::FeatureTracker::Params trackerParams;
+	trackerParams.maxFeatures = MAX_FEATURES;
+	mFeatureTracker->setParams( trackerParams );
+	mGreyDownsampler = mndl::GreyDownsampler::create();
 }
 
 void Acacia::instantiate()
@@ -160,18 +168,6 @@ void Acacia::addToFluid( Vec2f pos, Vec2f vel, bool addLeaves, bool addParticles
 	}
 }
 
-void Acacia::chooseFeatures( cv::Mat currentFrame )
-{
-	cv::goodFeaturesToTrack( currentFrame, mFeatures, MAX_FEATURES, 0.005, 3.0 );
-}
-
-void Acacia::trackFeatures( cv::Mat currentFrame )
-{
-	vector<float> errors;
-	mPrevFeatures = mFeatures;
-	cv::calcOpticalFlowPyrLK( mPrevFrame, currentFrame, mPrevFeatures, mFeatures, mFeatureStatuses, errors );
-}
-
 void Acacia::update()
 {
 	mFluidSolver.update();
@@ -187,22 +183,27 @@ void Acacia::update()
 
 	if (mNI.checkNewDepthFrame())
 	{
-		Surface surface( Channel8u( mNI.getVideoImage() ) );
-		Surface smallSurface( CAMERA_WIDTH, CAMERA_HEIGHT, false );
-
-		ip::resize( surface, &smallSurface );
-
-		mOptFlowTexture = gl::Texture( smallSurface );
+		Surface8u videoSurf( mNI.getVideoImage() );
+
+		cv::Mat currentFrame = mFeatureTracker->acquireFrame( CAMERA_WIDTH, CAMERA_HEIGHT );
+		mGreyDownsampler->process( videoSurf.getData(), videoSurf.getWidth(), videoSurf.getHeight(),
+				videoSurf.getRowBytes(),
+				mndl::GreyDownsampler::Layout( videoSurf.getPixelInc(), videoSurf.getRedOffset(),
+					videoSurf.getGreenOffset(), videoSurf.getBlueOffset() ),
+				currentFrame );
+		mOptFlowTexture = gl::Texture( fromOcv( currentFrame ) );
+		mFeatureTracker->pushFrame( currentFrame, getElapsedSeconds() );
+	}
 
-		cv::Mat currentFrame( toOcv( Channel( smallSurface ) ) );
-		if ( mPrevFrame.data )
-		{
-			// pick new features once every 30 frames, or the first frame
-			if ( mFeatures.empty() || getElapsedFrames() % 30 == 0 )
-				chooseFeatures( mPrevFrame );
-			trackFeatures( currentFrame );
-		}
-		mPrevFrame = currentFrame;
+	// tracked points are kept between frames, new features are only
+	// detected where the old ones were lost
+	if ( mFeatureTracker->checkNewFeatures() )
+	{
+		mndl::FeatureTracker::Features features = mFeatureTracker->getFeatures();
+		mFeatures.swap( features.points );
+		mPrevFeatures.swap( features.prevPoints );
+		mFeatureStatuses.swap( features.statuses );
+		mTrackTime = mFeatureTracker->getTrackTime();
 	}
 }
 
@@ -15,6 +15,9 @@
  along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cfloat>
+#include <cstring>
+#include <fstream>
 #include <vector>
 #include <sstream>
 
@@ -23,6 +26,7 @@
 #include "cinder/gl/gl.h"
 #include "cinder/gl/Texture.h"
 #include "cinder/gl/Fbo.h"
+#include "cinder/gl/Vbo.h"
 #include "cinder/gl/GlslProg.h"
 #include "cinder/params/Params.h"
 #include "cinder/Rand.h"
@@ -30,7 +34,6 @@
 #include "cinder/Surface.h"
 #include "cinder/Utilities.h"
 #include "cinder/Capture.h"
-#include "cinder/ip/Resize.h"
 #include "cinder/ImageIo.h"
 #include "cinder/Timeline.h"
 
@@ -41,6 +44,10 @@
 #include "cinderSyphon.h"
 #endif
 
+#include "MpmLiquid.h"
+#include "FlowWorker.h"
+#include "GreyDownsampler.h"
+
 #include "Resources.h"
 
 #include "KawaseBloom.h"
@@ -64,8 +71,7 @@ class LiquidApp : public AppBasic
 		void mouseDown(MouseEvent event);
 		void mouseUp(MouseEvent event);
 		void mouseDrag(MouseEvent event);
-
-		void simulate();
+		void fileDrop(FileDropEvent event);
 
 		void update();
 		void draw();
@@ -73,59 +79,19 @@ class LiquidApp : public AppBasic
 	private:
 		params::PInterfaceGl mParams;
 
-		struct Particle
-		{
-			float x;
-			float y;
-			float u;
-			float v;
-			float gu;
-			float gv;
-			float T00;
-			float T01;
-			float T11;
-			int cx;
-			int cy;
-
-			float px[3];
-			float py[3];
-			float gx[3];
-			float gy[3];
-
-			Particle() {};
-			Particle( float _x, float _y, float _u, float _v)
-				: x(_x), y(_y), u(_u), v(_v)
-			{}
-		};
-
-		struct Node
-		{
-			float m;
-			float gx;
-			float gy;
-			float u;
-			float v;
-			float ax;
-			float ay;
-			bool active;
-			int x;
-			int y;
-
-			void clear()
-			{
-				m = gx = gy = u = v = ax = ay = 0;
-				active = false;
-			}
-		};
-
 		static const int gsizeX = 120 * 2;
 		static const int gsizeY = 90 * 2;
 		float mMulX;
 		float mMulY;
 
-		Node grid[gsizeX][gsizeY];
+		mndl::MpmLiquidRef mLiquid;
+
+		// velocity streaks of the particles as line vertices, written after
+		// each step and drawn with a single call
+		gl::Vbo mStreakVbo;
+		int mStreakCount;
+		void updateStreaks();
 
-		vector<Node *> active;
 		static const int nx = 100;
 		static const int ny = 200;
 		int xPoints[ny];
@@ -146,7 +112,12 @@ class LiquidApp : public AppBasic
 
 		static const int pCount = 14000;
 		Anim<int> pActiveCount;
-		Particle particles[pCount];
+
+		// the particles are reordered along the z-order curve of their cells
+		// every mSortInterval frames, so consecutive particles touch nearby
+		// nodes
+		int mSortInterval;
+		float mSimulateTime;
 
 		void resetParticles();
 
@@ -175,8 +146,12 @@ class LiquidApp : public AppBasic
 		bool mDrawFlow;
 		bool mDrawCapture;
 		float mFlowMultiplier;
+		int mFlowMethod;
+		float mFlowTimeBudget;
+		float mFlowTime;
 
-		cv::Mat mPrevFrame;
+		mndl::FlowWorkerRef mFlowWorker;
+		mndl::GreyDownsamplerRef mGreyDownsampler;
 		cv::Mat mFlow;
 
 		static const int OPTFLOW_WIDTH = gsizeX;
@@ -195,9 +170,26 @@ class LiquidApp : public AppBasic
 		Vec2f mBounds[ gsizeX ][ gsizeY ];
 		float mBoundaryNormals[ gsizeX * gsizeY * 4 ];
 
-		float getField( Surface::ConstIter &iter, int32_t xOff, int32_t yOff );
+		fs::path mBoundaryPath;
+
+		// identifies the mask file and the grid a cached boundary field was
+		// calculated for
+		struct BoundsCacheHeader
+		{
+			uint32_t magic;
+			int32_t gridWidth;
+			int32_t gridHeight;
+			int32_t maskWidth;
+			int32_t maskHeight;
+			uint64_t maskFileSize;
+			int64_t maskFileTime;
+		};
+
+		void loadBoundary( const fs::path &maskPath );
 		void precalcBounds();
-		void spreadBounds();
+		void calcBounds();
+		bool readBoundsCache( const fs::path &cachePath, const BoundsCacheHeader &header );
+		void writeBoundsCache( const fs::path &cachePath, const BoundsCacheHeader &header );
 		void precalcNormals( const Vec2i &windowSize );
 
 		void precalcWhirlpool();
@@ -219,7 +211,7 @@ class LiquidApp : public AppBasic
 
 
 LiquidApp::LiquidApp()
-	: mMouseDrag( false )
+	: mSimulateTime( 0.f ), mMouseDrag( false )
 {
 }
 
@@ -232,6 +224,10 @@ void LiquidApp::setup()
 {
 	gl::disableVerticalSync();
 
+	mLiquid = mndl::MpmLiquid::create( gsizeX, gsizeY, pCount );
+	mFlowWorker = mndl::FlowWorker::create();
+	mGreyDownsampler = mndl::GreyDownsampler::create();
+
 	// capture
 
 	// list out the capture devices
@@ -294,6 +290,13 @@ void LiquidApp::setup()
 	mParams.addPersistentParam( "Draw bound normals", &mDrawBoundNormals, false );
 	mParams.addPersistentParam( "Draw capture", &mDrawCapture, true );
 	mParams.addPersistentParam( "Flow multiplier", &mFlowMultiplier, .02, "min=.001 max=2 step=.001" );
+	vector< string > flowMethodNames;
+	for ( int m = 0; m <= mndl::FLOW_AUTO; m++ )
+		flowMethodNames.push_back( mndl::FlowBackend::getMethodName( mndl::FlowMethod( m ) ) );
+	mParams.addPersistentParam( "Flow method", flowMethodNames, &mFlowMethod, mndl::FLOW_FARNEBACK );
+	mParams.addPersistentParam( "Flow time budget", &mFlowTimeBudget, 10.f, "min=1 max=100 step=.5" );
+	mFlowTime = 0.f;
+	mParams.addParam( "Flow ms", &mFlowTime, "", true );
 	mParams.addSeparator();
 
 	mParams.addPersistentParam( "Draw whirlpool normals", &mDrawWhirlpoolNormals, false );
@@ -329,6 +332,8 @@ void LiquidApp::setup()
 		mCurrentCapture = 0;
 
 	mParams.addParam( "Fps", &mFps, "", true );
+	mParams.addParam( "Simulate ms", &mSimulateTime, "", true );
+	mParams.addPersistentParam( "Sort interval", &mSortInterval, 30, "min=0 max=600" );
 
 	static int sSizeX = gsizeX;
 	static int sSizeY = gsizeY;
@@ -346,6 +351,9 @@ void LiquidApp::setup()
 	mMulX = mFbo.getWidth() / (float)gsizeX;
 	mMulY = mFbo.getHeight() / (float)gsizeY;
 
+	mStreakVbo = gl::Vbo( GL_ARRAY_BUFFER );
+	mStreakCount = 0;
+
 	mKawaseBloom = gl::ip::KawaseBloom( mFbo.getWidth(), mFbo.getHeight() );
 
 	setFrameRate( 60 );
@@ -356,14 +364,7 @@ void LiquidApp::setup()
 #endif
 
 	// bounds
-	mBoundarySurface = loadImage( getAssetPath( "mask.png" ) );
-	/*
-	Surface maskSurf = loadImage( getAssetPath( "mask.png" ) );
-	mBoundarySurface = Surface( OPTFLOW_WIDTH, OPTFLOW_HEIGHT, true );
-	ip::resize( maskSurf, &mBoundarySurface );
-	*/
-	mBoundaryTexture = gl::Texture( mBoundarySurface );
-	precalcBounds();
+	loadBoundary( getAssetPath( "mask.png" ) );
 	precalcWhirlpool();
 
 	mParams.show();
@@ -392,117 +393,183 @@ void LiquidApp::resetParticles()
 		for ( int i = -pc2; i < pc2; i++ )
 		{
 			if ( n < pCount )
-				particles[n] = Particle( ( cx + ( i + Rand::randFloat() ) * mul2 ),
-										 ( cy + ( j + Rand::randFloat() ) * mul2 ),
-										 .0, .0);
+			{
+				mLiquid->setParticle( n, cx + ( i + Rand::randFloat() ) * mul2,
+						cy + ( j + Rand::randFloat() ) * mul2 );
+			}
 			n++;
 		}
 	}
 }
 
-float LiquidApp::getField( Surface::ConstIter &iter, int32_t xOff, int32_t yOff )
-{
-	return iter.r( xOff, yOff) * iter.a( xOff, yOff ) / 255.;
-}
+static const uint32_t BOUNDS_CACHE_MAGIC = 0x31444e42; // "BND1"
 
-void LiquidApp::precalcBounds()
+// squared euclidean distance transform of n samples of f, which are stride
+// elements apart. computes the lower envelope of the parabolas rooted at the
+// samples in linear time (felzenszwalb and huttenlocher). v, z and d are
+// scratch arrays of n, n + 1 and n elements
+static void distanceTransform1d( float *f, int n, int stride, int *v, float *z, float *d )
 {
-	Area area = mBoundarySurface.getBounds();
-	area.expand( -1, -1 );
-	Surface::ConstIter it = mBoundarySurface.getIter( area );
-	float xStep = gsizeX / (float)mBoundarySurface.getWidth();
-	float yStep = gsizeY / (float)mBoundarySurface.getHeight();
-
-	for ( int i = 0; i < gsizeY; i++)
-	{
-		for ( int j = 0; j < gsizeX; j++ )
+	int k = 0;
+	v[ 0 ] = 0;
+	z[ 0 ] = -FLT_MAX;
+	z[ 1 ] = FLT_MAX;
+	for ( int q = 1; q < n; q++ )
+	{
+		float fq = f[ q * stride ] + q * q;
+		int r = v[ k ];
+		float s = ( fq - ( f[ r * stride ] + r * r ) ) / ( 2 * ( q - r ) );
+		while ( s <= z[ k ] )
 		{
-			mBounds[ j ][ i ] = Vec2f();
+			k--;
+			r = v[ k ];
+			s = ( fq - ( f[ r * stride ] + r * r ) ) / ( 2 * ( q - r ) );
 		}
+		k++;
+		v[ k ] = q;
+		z[ k ] = s;
+		z[ k + 1 ] = FLT_MAX;
 	}
 
-	float y = yStep;
-	while ( it.line() )
+	k = 0;
+	for ( int q = 0; q < n; q++ )
 	{
-		float x = xStep;
-		while ( it.pixel() )
-		{
-			float dx = getField( it, -1, 0 ) - getField( it, 1, 0 );
-			float dy = getField( it, 0, -1 ) - getField( it, 0, 1 );
-
-			mBounds[ (int)x ][ (int)y ] += Vec2f( dx, dy );
-			x += xStep;
-		}
-		y += yStep;
+		while ( z[ k + 1 ] < q )
+			k++;
+		int r = v[ k ];
+		d[ q ] = ( q - r ) * ( q - r ) + f[ r * stride ];
 	}
+	for ( int q = 0; q < n; q++ )
+		f[ q * stride ] = d[ q ];
+}
+
+// squared distance transform of a w x h grid stored in columns, 0 marks the
+// features, a large value the rest
+static void distanceTransform( vector< float > &f, int w, int h )
+{
+	int n = max( w, h );
+	vector< int > v( n );
+	vector< float > z( n + 1 ), d( n );
+
+	for ( int x = 0; x < w; x++ )
+		distanceTransform1d( &f[ x * h ], h, 1, &v[ 0 ], &z[ 0 ], &d[ 0 ] );
+	for ( int y = 0; y < h; y++ )
+		distanceTransform1d( &f[ y ], w, h, &v[ 0 ], &z[ 0 ], &d[ 0 ] );
+}
+
+void LiquidApp::loadBoundary( const fs::path &maskPath )
+{
+	mBoundarySurface = loadImage( maskPath );
+	mBoundaryTexture = gl::Texture( mBoundarySurface );
+	mBoundaryPath = maskPath;
+	precalcBounds();
+}
+
+void LiquidApp::precalcBounds()
+{
+	BoundsCacheHeader header;
+	memset( &header, 0, sizeof( header ) );
+	header.magic = BOUNDS_CACHE_MAGIC;
+	header.gridWidth = gsizeX;
+	header.gridHeight = gsizeY;
+	header.maskWidth = mBoundarySurface.getWidth();
+	header.maskHeight = mBoundarySurface.getHeight();
 
-	for ( int i = 0; i < gsizeX / 2; i++ )
+	// the field is cached next to the mask file
+	fs::path cachePath;
+	try
+	{
+		header.maskFileSize = fs::file_size( mBoundaryPath );
+		header.maskFileTime = fs::last_write_time( mBoundaryPath );
+		cachePath = fs::path( mBoundaryPath.string() + ".bounds" );
+	}
+	catch ( const fs::filesystem_error & )
 	{
-		spreadBounds();
 	}
 
-	for ( int i = 0; i < gsizeY; i++ )
+	if ( cachePath.empty() || !readBoundsCache( cachePath, header ) )
 	{
-		for ( int j = 0; j < gsizeX; j++ )
-		{
-			mBounds[ j ][ i ].normalize();
-		}
+		calcBounds();
+		if ( !cachePath.empty() )
+			writeBoundsCache( cachePath, header );
 	}
+
 	precalcNormals( getWindowSize() );
 }
 
-void LiquidApp::spreadBounds()
+void LiquidApp::calcBounds()
 {
+	// cells with transparent mask are outside, the rest is inside
 	Vec2f sc( mBoundarySurface.getWidth() / (float)gsizeX,
 			  mBoundarySurface.getHeight() / (float)gsizeY );
-
-	Vec2f newBounds[ gsizeX ][ gsizeY ];
-
-	for ( int y = 0; y < gsizeY; y++ )
+	const float far = 1e20f;
+	vector< float > outside( gsizeX * gsizeY );
+	vector< float > inside( gsizeX * gsizeY );
+	for ( int x = 0; x < gsizeX; x++ )
 	{
-		for ( int x = 0; x < gsizeX; x++ )
+		for ( int y = 0; y < gsizeY; y++ )
 		{
-			Vec2f n = mBounds[ x ][ y ];
-			if ( ( n.lengthSquared() < .1 ) &&
-				 ( mBoundarySurface.getPixel( static_cast< Vec2i >( sc * Vec2f( x, y ) ) ).a < .1 ) )
-			{
-				int i = 0;
-				if ( x > 0 )
-				{
-					n += mBounds[ x - 1 ][ y ];
-					i++;
-				}
-				if ( x < gsizeX - 1 )
-				{
-					n += mBounds[ x + 1 ][ y ];
-					i++;
-				}
-				if ( y > 0 )
-				{
-					n += mBounds[ x ][ y - 1 ];
-					i++;
-				}
-				if ( y < gsizeY - 1 )
-				{
-					n += mBounds[ x ][ y + 1 ];
-					i++;
-				}
-
-				n /= i;
-			}
-			newBounds[ x ][ y ] = n;
+			Vec2i p = static_cast< Vec2i >( sc * Vec2f( x + .5f, y + .5f ) );
+			bool in = mBoundarySurface.getPixel( p ).a > 0;
+			outside[ x * gsizeY + y ] = in ? 0.f : far;
+			inside[ x * gsizeY + y ] = in ? far : 0.f;
 		}
 	}
 
-	for ( int y = 0; y < gsizeY; y++ )
+	// signed distance to the edge of the mask, negative inside
+	distanceTransform( outside, gsizeX, gsizeY );
+	distanceTransform( inside, gsizeX, gsizeY );
+	vector< float > &dist = outside;
+	for ( size_t i = 0; i < dist.size(); i++ )
+		dist[ i ] = math< float >::sqrt( outside[ i ] ) - math< float >::sqrt( inside[ i ] );
+
+	// the normals point away from the mask outside of it and in a band along
+	// its edge, the particles deeper inside are not affected
+	const float band = 1.5f;
+	for ( int x = 0; x < gsizeX; x++ )
 	{
-		for ( int x = 0; x < gsizeX; x++ )
+		int x0 = math< int >::max( x - 1, 0 );
+		int x1 = math< int >::min( x + 1, gsizeX - 1 );
+		for ( int y = 0; y < gsizeY; y++ )
 		{
-			mBounds[ x ][ y ] = newBounds[ x ][ y ];
+			Vec2f n;
+			if ( dist[ x * gsizeY + y ] > -band )
+			{
+				int y0 = math< int >::max( y - 1, 0 );
+				int y1 = math< int >::min( y + 1, gsizeY - 1 );
+				n.x = dist[ x1 * gsizeY + y ] - dist[ x0 * gsizeY + y ];
+				n.y = dist[ x * gsizeY + y1 ] - dist[ x * gsizeY + y0 ];
+				n.safeNormalize();
+			}
+			mBounds[ x ][ y ] = n;
 		}
 	}
 }
 
+bool LiquidApp::readBoundsCache( const fs::path &cachePath, const BoundsCacheHeader &header )
+{
+	std::ifstream ifs( cachePath.string().c_str(), std::ios::binary );
+	if ( !ifs )
+		return false;
+
+	BoundsCacheHeader cached;
+	ifs.read( reinterpret_cast< char * >( &cached ), sizeof( cached ) );
+	if ( !ifs || memcmp( &cached, &header, sizeof( header ) ) )
+		return false;
+
+	ifs.read( reinterpret_cast< char * >( &mBounds[ 0 ][ 0 ] ), sizeof( mBounds ) );
+	return ifs.good();
+}
+
+void LiquidApp::writeBoundsCache( const fs::path &cachePath, const BoundsCacheHeader &header )
+{
+	std::ofstream ofs( cachePath.string().c_str(), std::ios::binary | std::ios::trunc );
+	ofs.write( reinterpret_cast< const char * >( &header ), sizeof( header ) );
+	ofs.write( reinterpret_cast< const char * >( &mBounds[ 0 ][ 0 ] ), sizeof( mBounds ) );
+	if ( !ofs )
+		console() << "Unable to write boundary cache: " << cachePath << endl;
+}
+
 void LiquidApp::precalcNormals( const Vec2i &windowSize )
 {
 	int i = 0;
@@ -641,6 +708,18 @@ void LiquidApp::mouseUp(MouseEvent event)
 	mMouseDrag = false;
 }
 
+void LiquidApp::fileDrop(FileDropEvent event)
+{
+	try
+	{
+		loadBoundary( event.getFile( 0 ) );
+	}
+	catch ( ... )
+	{
+		console() << "Unable to load boundary mask: " << event.getFile( 0 ) << endl;
+	}
+}
+
 void LiquidApp::update()
 {
 	static int lastCapture = -1;
@@ -662,32 +741,33 @@ void LiquidApp::update()
 	// optical flow
 	if ( mCapture && mCapture.checkNewFrame() )
 	{
-		Surface8u captSurf( Channel8u( mCapture.getSurface() ) );
+		Surface8u captSurf = mCapture.getSurface();
 
-		Surface8u smallSurface( OPTFLOW_WIDTH, OPTFLOW_HEIGHT, false );
-		if ( ( captSurf.getWidth() != OPTFLOW_WIDTH ) ||
-			 ( captSurf.getHeight() != OPTFLOW_HEIGHT ) )
-		{
-			ip::resize( captSurf, &smallSurface );
-		}
-		else
-		{
-			smallSurface = captSurf;
-		}
+		// grey, downsampled and mirrored flow input in a single pass into a
+		// frame recycled by the worker
+		cv::Mat currentFrame = mFlowWorker->acquireFrame( OPTFLOW_WIDTH, OPTFLOW_HEIGHT );
+		mGreyDownsampler->process( captSurf.getData(), captSurf.getWidth(), captSurf.getHeight(),
+				captSurf.getRowBytes(),
+				mndl::GreyDownsampler::Layout( captSurf.getPixelInc(), captSurf.getRedOffset(),
+					captSurf.getGreenOffset(), captSurf.getBlueOffset() ),
+				currentFrame, mFlip );
+		mFlowWorker->pushFrame( currentFrame, getElapsedSeconds() );
 
-		mCaptTexture = gl::Texture( captSurf );
+		mCaptTexture = gl::Texture( Channel8u( captSurf ) );
+	}
 
-		cv::Mat currentFrame( toOcv( Channel( smallSurface ) ) );
-		if ( mFlip )
-			cv::flip( currentFrame, currentFrame, 1 );
-        if ( mPrevFrame.data )
-		{
-			cv::calcOpticalFlowFarneback(
-					mPrevFrame, currentFrame,
-					mFlow,
-					.5, 5, 13, 5, 5, 1.1, 0 );
-		}
-        mPrevFrame = currentFrame;
+	mndl::FlowWorker::Params flowParams;
+	flowParams.method = mndl::FlowMethod( mFlowMethod );
+	flowParams.timeBudget = mFlowTimeBudget;
+	mFlowWorker->setParams( flowParams );
+
+	// the flow is calculated on the worker thread, the latest one is used
+	if ( mFlowWorker->checkNewFlow() )
+	{
+		mFlow = mFlowWorker->getFlow().flow;
+		mFlowTime = mFlowWorker->getFlowTime();
+		// resampled onto the liquid grid once per flow
+		mLiquid->setFlow( (const float *)mFlow.data, mFlow.cols, mFlow.rows, mFlowMultiplier );
 	}
 
 	static float lastWhirlpoolDegree = mWhirlpoolDegree;
@@ -701,367 +781,70 @@ void LiquidApp::update()
 		precalcNormals( getWindowSize() );
 	}
 
-	simulate();
-}
-
-void LiquidApp::simulate()
-{
-	float mdx = 0.0;
-	float mdy = 0.0;
-	if (mMouseDrag)
-	{
-		mdx = (mMousePos.x - mMousePrevPos.x) / mMulX;
-		mdy = (mMousePos.y - mMousePrevPos.y) / mMulY;
-	}
+	mndl::MpmLiquid::Params &params = mLiquid->getParams();
+	params.density = mDensity;
+	params.stiffness = mStiffness;
+	params.bulkViscosity = mBulkViscosity;
+	params.elasticity = mElasticity;
+	params.viscosity = mViscosity;
+	params.yieldRate = mYieldRate;
+	params.gravity = mGravity;
+	params.smoothing = mSmoothing;
 
-	for (vector<Node *>::iterator i = active.begin(); i != active.end(); ++i)
+	if ( mMouseDrag )
 	{
-		(*i)->clear();
+		mLiquid->setDrag( mMousePos.x / mMulX, mMousePos.y / mMulY,
+				( mMousePos.x - mMousePrevPos.x ) / mMulX,
+				( mMousePos.y - mMousePrevPos.y ) / mMulY );
 	}
-	active.clear();
-
-	for (int k = 0; k < pActiveCount; k++)
-	{
-		Particle *p = &particles[k];
-		p->cx = (int)(p->x - 0.5);
-		if (p->cx > gsizeX - 4)
-			p->cx = gsizeX - 4;
-		else
-		if (p->cx < 0)
-			p->cx = 0;
-
-		p->cy = (int)(p->y - 0.5);
-		if (p->cy > gsizeY - 4)
-			p->cy = gsizeY - 4;
-		else
-		if (p->cy < 0)
-			p->cy = 0;
-
-		float x = p->cx - p->x;
-		p->px[0] = (0.5 * x * x + 1.5 * x + 1.125);
-		p->gx[0] = (x + 1.5);
-		x += 1.0;
-		p->px[1] = (-x * x + 0.75);
-		p->gx[1] = (-2.0 * x);
-		x += 1.0;
-		p->px[2] = (0.5 * x * x - 1.5 * x + 1.125);
-		p->gx[2] = (x - 1.5);
-
-		float y = p->cy - p->y;
-		p->py[0] = (0.5 * y * y + 1.5 * y + 1.125);
-		p->gy[0] = (y + 1.5);
-		y += 1.0;
-		p->py[1] = (-y * y + 0.75);
-		p->gy[1] = (-2.0 * y);
-		y += 1.0;
-		p->py[2] = (0.5 * y * y - 1.5F * y + 1.125);
-		p->gy[2] = (y - 1.5);
-
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				int cxi = p->cx + i;
-				int cyj = p->cy + j;
-				Node *n = &grid[cxi][cyj];
-				if (!n->active)
-				{
-					active.push_back(n);
-					n->active = true;
-				}
-				float phi = p->px[i] * p->py[j];
-				n->m += phi;
-				float dx = p->gx[i] * p->py[j];
-				float dy = p->px[i] * p->gy[j];
-				n->gx += dx;
-				n->gy += dy;
-				n->u += phi * p->u;
-				n->v += phi * p->v;
-			}
-		}
-	}
-
-	for (vector<Node *>::iterator i = active.begin(); i != active.end(); ++i)
-	{
-		Node *n = *i;
-		if (n->m > 0)
-		{
-			n->u /= n->m;
-			n->v /= n->m;
-		}
-
-	}
-
-	for (int k = 0; k < pActiveCount; k++)
-	{
-		Particle *p = &particles[k];
-
-		float dudx = 0.0;
-		float dudy = 0.0;
-		float dvdx = 0.0;
-		float dvdy = 0.0;
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				Node *n = &grid[(p->cx + i)][(p->cy + j)];
-				float gx = p->gx[i] * p->py[j];
-				float gy = p->px[i] * p->gy[j];
-				dudx += n->u * gx;
-				dudy += n->u * gy;
-				dvdx += n->v * gx;
-				dvdy += n->v * gy;
-			}
-		}
-
-		float w1 = dudy - dvdx;
-		float wT0 = w1 * p->T01;
-		float wT1 = 0.5F * w1 * (p->T00 - p->T11);
-		float D00 = dudx;
-		float D01 = 0.5F * (dudy + dvdx);
-		float D11 = dvdy;
-		float trace = 0.5F * (D00 + D11);
-		D00 -= trace;
-		D11 -= trace;
-		p->T00 += -wT0 + D00 - mYieldRate * p->T00;
-		p->T01 += wT1 + D01 - mYieldRate * p->T01;
-		p->T11 += wT0 + D11 - mYieldRate * p->T11;
-
-		/*
-		float norm = p->T00 * p->T00 + 2.0 * p->T01 * p->T01 + p->T11 * p->T11;
-		if ((this.mode > -1) || (norm > 5.0)) {
-			p->T00 = (p->T01 = p->T11 = 0.0);
-		}
-		*/
-		float norm = p->T00 * p->T00 + 2.0 * p->T01 * p->T01 + p->T11 * p->T11;
-		if (norm > 5.0)
-			p->T00 = p->T01 = p->T11 = 0.0;
-
-		int cx = (int)p->x;
-		int cy = (int)p->y;
-		if (cx > gsizeX - 5)
-			cx = gsizeX - 5;
-		else
-		if (cx < 0)
-			cx = 0;
-		if (cy > gsizeY - 5)
-			cy = gsizeY - 5;
-		else
-		if (cy < 0)
-			cy = 0;
-		int cxi = cx + 1;
-		int cyi = cy + 1;
-
-		float p00 = grid[cx][cy].m;
-		float x00 = grid[cx][cy].gx;
-		float y00 = grid[cx][cy].gy;
-		float p01 = grid[cx][cyi].m;
-		float x01 = grid[cx][cyi].gx;
-		float y01 = grid[cx][cyi].gy;
-		float p10 = grid[cxi][cy].m;
-		float x10 = grid[cxi][cy].gx;
-		float y10 = grid[cxi][cy].gy;
-		float p11 = grid[cxi][cyi].m;
-		float x11 = grid[cxi][cyi].gx;
-		float y11 = grid[cxi][cyi].gy;
-
-		float pdx = p10 - p00;
-		float pdy = p01 - p00;
-		float C20 = 3.0 * pdx - x10 - 2.0 * x00;
-		float C02 = 3.0 * pdy - y01 - 2.0 * y00;
-		float C30 = -2.0 * pdx + x10 + x00;
-		float C03 = -2.0 * pdy + y01 + y00;
-		float csum1 = p00 + y00 + C02 + C03;
-		float csum2 = p00 + x00 + C20 + C30;
-		float C21 = 3.0 * p11 - 2.0 * x01 - x11 - 3.0 * csum1 - C20;
-		float C31 = -2.0 * p11 + x01 + x11 + 2.0 * csum1 - C30;
-		float C12 = 3.0 * p11 - 2.0 * y10 - y11 - 3.0 * csum2 - C02;
-		float C13 = -2.0 * p11 + y10 + y11 + 2.0 * csum2 - C03;
-		float C11 = x01 - C13 - C12 - x00;
-
-		float u = p->x - cx;
-		float u2 = u * u;
-		float u3 = u * u2;
-		float v = p->y - cy;
-		float v2 = v * v;
-		float v3 = v * v2;
-		float density = p00 + x00 * u + y00 * v + C20 * u2 + C02 * v2 +
-			C30 * u3 + C03 * v3 + C21 * u2 * v + C31 * u3 * v + C12 *
-			u * v2 + C13 * u * v3 + C11 * u * v;
-
-		float pressure = mStiffness / max(1.0f, mDensity) * (density - mDensity);
-		if (pressure > 2.0) {
-			pressure = 2.0;
-		}
-
-		float fx = 0.0;
-		float fy = 0.0;
-		if (p->x < 3.0)
-			fx += 3.0 - p->x;
-		else
-		if (p->x > gsizeX - 4)
-			fx += gsizeX - 4 - p->x;
-
-		if (p->y < 3.0F)
-			fy += 3.0F - p->y;
-		else
-		if (p->y > gsizeY - 4)
-			fy += gsizeY - 4 - p->y;
-
-		trace *= mStiffness;
-		float T00 = mElasticity * p->T00 + mViscosity * D00 + pressure + mBulkViscosity * trace;
-		float T01 = mElasticity * p->T01 + mViscosity * D01;
-		float T11 = mElasticity * p->T11 + mViscosity * D11 + pressure + mBulkViscosity * trace;
-
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				Node *n = &grid[(p->cx + i)][(p->cy + j)];
-				float phi = p->px[i] * p->py[j];
-				float dx = p->gx[i] * p->py[j];
-				float dy = p->px[i] * p->gy[j];
-
-				n->ax += -(dx * T00 + dy * T01) + fx * phi;
-				n->ay += -(dx * T01 + dy * T11) + fy * phi;
-			}
-		}
-	}
-
-	for (vector<Node *>::iterator i = active.begin(); i != active.end(); ++i)
+	else
 	{
-		Node *n = *i;
-		if (n->m > 0)
-		{
-			n->ax /= n->m;
-			n->ay /= n->m;
-			n->u = 0;
-			n->v = 0;
-		}
-
+		mLiquid->clearDrag();
 	}
 
+	mLiquid->setFlowMultiplier( mFlowMultiplier );
+	mLiquid->setBoundary( &mBounds[ 0 ][ 0 ].x );
+	mLiquid->setAttractor( ( mState == STATE_WHIRLPOOL ) ? &mWhirlpool[ 0 ][ 0 ].x : NULL );
 
-	for (int k = 0; k < pActiveCount; k++)
-	{
-		Particle *p = &particles[k];
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				Node *n = &grid[(p->cx + i)][(p->cy + j)];
-				float phi = p->px[i] * p->py[j];
-				p->u += phi * n->ax;
-				p->v += phi * n->ay;
-			}
-		}
-		p->v += mGravity;
-
-		if (mMouseDrag)
-		{
-			float vx = abs(p->x - mMousePos.x / mMulX);
-			float vy = abs(p->y - mMousePos.y / mMulY);
-			if ((vx < 10.0) && (vy < 10.0))
-			{
-				float weight = (1.0 - vx / 10.0) * (1.0 - vy / 10.0);
-				p->u += weight * (mdx - p->u);
-				p->v += weight * (mdy - p->v);
-			}
-		}
-
-		// optical flow
-		if ( mFlow.data )
-		{
-			cv::Point2f v = mFlow.at< cv::Point2f >( static_cast< int >( p->y ),
-					static_cast< int >( p->x ) );
-			p->u += mFlowMultiplier * v.x;
-			p->v += mFlowMultiplier * v.y;
-		}
-
-		int xi = (int)(p->x + p->u);
-		int yi = (int)(p->y + p->v);
-		if ( ( xi >= 0 ) && ( xi < gsizeX ) &&
-			 ( yi >= 0 ) && ( yi < gsizeY ) )
-		{
-			// boundary repels
-			// TODO: why is this condition required?
-			if ( mBounds[ xi ][ yi ].lengthSquared() > 0 )
-			{
-				Vec2f n = mBounds[ xi ][ yi ];
-				p->u -= n.x;
-				p->v -= n.y;
-			}
-			// whirlpool attracts
-			if ( mState == STATE_WHIRLPOOL )
-			{
-				Vec2f n = mWhirlpool[ xi ][ yi ];
-				p->u += n.x;
-				p->v += n.y;
-			}
-		}
-
-		float x = p->x + p->u;
-		float y = p->y + p->v;
-		if (x < 2.0)
-			p->u += 2.0 - x + Rand::randFloat() * 0.01;
-		else
-		if (x > gsizeX - 3)
-			p->u += gsizeX - 3 - x - Rand::randFloat() * 0.01;
-
-		if (y < 2.0)
-			p->v += 2.0 - y + Rand::randFloat() * 0.01;
-		else
-		if (y > gsizeY - 3)
-			p->v += gsizeY - 3 - y - Rand::randFloat() * 0.01;
+	// the order of the particles decides which ones disappear in the
+	// whirlpool, so it is kept in that state
+	mLiquid->setSortInterval( ( mState == STATE_NORMAL ) ? mSortInterval : 0 );
+	mLiquid->setNumParticles( pActiveCount );
 
+	mLiquid->step();
+	updateStreaks();
+	mSimulateTime = mLiquid->getStepTime();
+}
 
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				Node *n = &grid[(p->cx + i)][(p->cy + j)];
-				float phi = p->px[i] * p->py[j];
-				n->u += phi * p->u;
-				n->v += phi * p->v;
-			}
-		}
-	}
+void LiquidApp::updateStreaks()
+{
+	const mndl::MpmLiquid::Particles &particles = mLiquid->getParticles();
+	mStreakCount = mLiquid->getNumParticles();
 
-	for (vector<Node *>::iterator i = active.begin(); i != active.end(); ++i)
+	// the buffer is orphaned, so the driver does not wait for the last
+	// frame to be drawn
+	mStreakVbo.bind();
+	mStreakVbo.bufferData( mStreakCount * 4 * sizeof( float ), NULL, GL_STREAM_DRAW );
+	float *v = reinterpret_cast< float * >( mStreakVbo.map( GL_WRITE_ONLY ) );
+	if ( v )
 	{
-		Node *n = *i;
-		if (n->m > 0)
+		for ( int i = 0; i < mStreakCount; i++ )
 		{
-			n->u /= n->m;
-			n->v /= n->m;
+			float x = particles.x[ i ] - 1.f;
+			float y = particles.y[ i ];
+			v[ 0 ] = mMulX * x;
+			v[ 1 ] = mMulY * y;
+			v[ 2 ] = mMulX * ( x - particles.gu[ i ] );
+			v[ 3 ] = mMulY * ( y - particles.gv[ i ] );
+			v += 4;
 		}
-
+		mStreakVbo.unmap();
 	}
-
-	for (int k = 0; k < pActiveCount; k++)
+	else
 	{
-		Particle *p = &particles[k];
-		float gu = 0.0;
-		float gv = 0.0;
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				Node *n = &grid[(p->cx + i)][(p->cy + j)];
-				float phi = p->px[i] * p->py[j];
-				gu += phi * n->u;
-				gv += phi * n->v;
-			}
-		}
-
-		p->gu = gu;
-		p->gv = gv;
-
-		p->x += gu;
-		p->y += gv;
-		p->u += mSmoothing * (gu - p->u);
-		p->v += mSmoothing * (gv - p->v);
+		mStreakCount = 0;
 	}
+	mStreakVbo.unbind();
 }
 
 void LiquidApp::draw()
@@ -1073,18 +856,16 @@ void LiquidApp::draw()
 	gl::clear( Color::black() );
 
 	gl::color( mParticleColor );
-	Vec2f mul( mMulX, mMulY );
 	gl::enableAdditiveBlending();
 	gl::disableDepthRead();
 	gl::disableDepthWrite();
 
-	for (int i = 0; i < pActiveCount; i++)
-	{
-		Particle *p = &particles[i];
-
-		gl::drawLine( mul * Vec2f(p->x - 1.0, p->y),
-					  mul * Vec2f(p->x - 1.0 - p->gu, p->y - p->gv));
-	}
+	mStreakVbo.bind();
+	glEnableClientState( GL_VERTEX_ARRAY );
+	glVertexPointer( 2, GL_FLOAT, 0, 0 );
+	glDrawArrays( GL_LINES, 0, mStreakCount * 2 );
+	glDisableClientState( GL_VERTEX_ARRAY );
+	mStreakVbo.unbind();
 	gl::disableAlphaBlending();
 
 	mFbo.unbindFramebuffer();
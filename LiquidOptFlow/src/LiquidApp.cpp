@@ -22,16 +22,20 @@
 #include "cinder/gl/gl.h"
 #include "cinder/gl/Texture.h"
 #include "cinder/gl/Fbo.h"
+#include "cinder/gl/Vbo.h"
 #include "cinder/params/Params.h"
 #include "cinder/Rand.h"
 #include "cinder/CinderMath.h"
 #include "cinder/Surface.h"
 #include "cinder/Utilities.h"
 #include "cinder/Capture.h"
-#include "cinder/ip/Resize.h"
 
 #include "CinderOpenCV.h"
 
+#include "MpmLiquid.h"
+#include "FlowWorker.h"
+#include "GreyDownsampler.h"
+
 #include "Sharpen.h"
 #include "KawaseBloom.h"
 
@@ -54,67 +58,25 @@ class LiquidApp : public AppBasic
 		void mouseUp(MouseEvent event);
 		void mouseDrag(MouseEvent event);
 
-		void simulate();
-
 		void update();
 		void draw();
 
 	private:
 		params::InterfaceGl mParams;
 
-		struct Particle
-		{
-			float x;
-			float y;
-			float u;
-			float v;
-			float gu;
-			float gv;
-			float T00;
-			float T01;
-			float T11;
-			int cx;
-			int cy;
-
-			float px[3];
-			float py[3];
-			float gx[3];
-			float gy[3];
-
-			Particle() {};
-			Particle( float _x, float _y, float _u, float _v)
-				: x(_x), y(_y), u(_u), v(_v)
-			{}
-		};
-
-		struct Node
-		{
-			float m;
-			float gx;
-			float gy;
-			float u;
-			float v;
-			float ax;
-			float ay;
-			bool active;
-			int x;
-			int y;
-
-			void clear()
-			{
-				m = gx = gy = u = v = ax = ay = 0;
-				active = false;
-			}
-		};
-
 		static const int gsizeX = 120; //129;
 		static const int gsizeY = 90; //97;
 		float mMulX;
 		float mMulY;
 
-		Node grid[gsizeX][gsizeY];
+		mndl::MpmLiquidRef mLiquid;
+
+		// velocity streaks of the particles as line vertices, written after
+		// each step and drawn with a single call
+		gl::Vbo mStreakVbo;
+		int mStreakCount;
+		void updateStreaks();
 
-		vector<Node *> active;
 		static const int nx = 100;
 		static const int ny = 200;
 		int xPoints[ny];
@@ -135,7 +97,6 @@ class LiquidApp : public AppBasic
 		float mFps;
 
 		static const int pCount = 10000;
-		Particle particles[pCount];
 
 		Vec2i mMousePos;
 		Vec2i mMousePrevPos;
@@ -161,7 +122,8 @@ class LiquidApp : public AppBasic
 		bool mDrawCapture;
 		float mFlowMultiplier;
 
-		cv::Mat mPrevFrame;
+		mndl::FlowWorkerRef mFlowWorker;
+		mndl::GreyDownsamplerRef mGreyDownsampler;
 		cv::Mat mFlow;
 
 		static const int OPTFLOW_WIDTH = 120;
@@ -183,6 +145,10 @@ void LiquidApp::setup()
 {
 	gl::disableVerticalSync();
 
+	mLiquid = mndl::MpmLiquid::create( gsizeX, gsizeY, pCount );
+	mFlowWorker = mndl::FlowWorker::create();
+	mGreyDownsampler = mndl::GreyDownsampler::create();
+
 	mParams = params::InterfaceGl("Parameters", Vec2i( 300, 400 ));
 
 	mFlip = true;
@@ -238,8 +204,8 @@ void LiquidApp::setup()
 		for (int i = 0; i < pc; i++)
 		{
 			if (n < pCount)
-				particles[n] = Particle(((i + Rand::randFloat()) * mul2) + 4.0,
-										((j + Rand::randFloat()) * mul2) + 4.0, 0.0, 0.0);
+				mLiquid->setParticle(n, ((i + Rand::randFloat()) * mul2) + 4.0,
+										((j + Rand::randFloat()) * mul2) + 4.0);
 			n++;
 		}
 	}
@@ -251,6 +217,9 @@ void LiquidApp::setup()
 	mMulX = mFbo.getWidth() / (float)gsizeX;
 	mMulY = mFbo.getHeight() / (float)gsizeY;
 
+	mStreakVbo = gl::Vbo( GL_ARRAY_BUFFER );
+	mStreakCount = 0;
+
 	mSharpenFilter = gl::ip::Sharpen( mFbo.getWidth(), mFbo.getHeight() );
 
 	mKawaseBloom = gl::ip::KawaseBloom( mFbo.getWidth(), mFbo.getHeight() );
@@ -354,372 +323,85 @@ void LiquidApp::update()
 	// optical flow
 	if ( mCapture && mCapture.checkNewFrame() )
 	{
-		Surface8u captSurf( Channel8u( mCapture.getSurface() ) );
-
-		Surface8u smallSurface( OPTFLOW_WIDTH, OPTFLOW_HEIGHT, false );
-		if ( ( captSurf.getWidth() != OPTFLOW_WIDTH ) ||
-			 ( captSurf.getHeight() != OPTFLOW_HEIGHT ) )
-		{
-			ip::resize( captSurf, &smallSurface );
-		}
-		else
-		{
-			smallSurface = captSurf;
-		}
-
-		mCaptTexture = gl::Texture( captSurf );
-
-		cv::Mat currentFrame( toOcv( Channel( smallSurface ) ) );
-		if ( mFlip )
-			cv::flip( currentFrame, currentFrame, 1 );
-        if ( mPrevFrame.data )
-		{
-			cv::calcOpticalFlowFarneback(
-					mPrevFrame, currentFrame,
-					mFlow,
-					.5, 5, 13, 5, 5, 1.1, 0 );
-		}
-        mPrevFrame = currentFrame;
+		Surface8u captSurf = mCapture.getSurface();
+
+		// grey, downsampled and mirrored flow input in a single pass into a
+		// frame recycled by the worker
+		cv::Mat currentFrame = mFlowWorker->acquireFrame( OPTFLOW_WIDTH, OPTFLOW_HEIGHT );
+		mGreyDownsampler->process( captSurf.getData(), captSurf.getWidth(), captSurf.getHeight(),
+				captSurf.getRowBytes(),
+				mndl::GreyDownsampler::Layout( captSurf.getPixelInc(), captSurf.getRedOffset(),
+					captSurf.getGreenOffset(), captSurf.getBlueOffset() ),
+				currentFrame, mFlip );
+		mFlowWorker->pushFrame( currentFrame, getElapsedSeconds() );
+
+		mCaptTexture = gl::Texture( Channel8u( captSurf ) );
 	}
 
-	simulate();
-}
-
-void LiquidApp::simulate()
-{
-	float mdx = 0.0;
-	float mdy = 0.0;
-	if (mMouseDrag)
+	// the flow is calculated on the worker thread, the latest one is used
+	if ( mFlowWorker->checkNewFlow() )
 	{
-		mdx = (mMousePos.x - mMousePrevPos.x) / mMulX;
-		mdy = (mMousePos.y - mMousePrevPos.y) / mMulY;
+		mFlow = mFlowWorker->getFlow().flow;
+		// resampled onto the liquid grid once per flow
+		mLiquid->setFlow( (const float *)mFlow.data, mFlow.cols, mFlow.rows, mFlowMultiplier );
 	}
 
-	for (vector<Node *>::iterator i = active.begin(); i != active.end(); ++i)
+	mndl::MpmLiquid::Params &params = mLiquid->getParams();
+	params.density = mDensity;
+	params.stiffness = mStiffness;
+	params.bulkViscosity = mBulkViscosity;
+	params.elasticity = mElasticity;
+	params.viscosity = mViscosity;
+	params.yieldRate = mYieldRate;
+	params.gravity = mGravity;
+	params.smoothing = mSmoothing;
+
+	if ( mMouseDrag )
 	{
-		(*i)->clear();
-	}
-	active.clear();
-
-	for (int k = 0; k < pCount; k++)
-	{
-		Particle *p = &particles[k];
-		p->cx = (int)(p->x - 0.5);
-		if (p->cx > gsizeX - 4)
-			p->cx = gsizeX - 4;
-		else
-		if (p->cx < 0)
-			p->cx = 0;
-
-		p->cy = (int)(p->y - 0.5);
-		if (p->cy > gsizeY - 4)
-			p->cy = gsizeY - 4;
-		else
-		if (p->cy < 0)
-			p->cy = 0;
-
-		float x = p->cx - p->x;
-		p->px[0] = (0.5 * x * x + 1.5 * x + 1.125);
-		p->gx[0] = (x + 1.5);
-		x += 1.0;
-		p->px[1] = (-x * x + 0.75);
-		p->gx[1] = (-2.0 * x);
-		x += 1.0;
-		p->px[2] = (0.5 * x * x - 1.5 * x + 1.125);
-		p->gx[2] = (x - 1.5);
-
-		float y = p->cy - p->y;
-		p->py[0] = (0.5 * y * y + 1.5 * y + 1.125);
-		p->gy[0] = (y + 1.5);
-		y += 1.0;
-		p->py[1] = (-y * y + 0.75);
-		p->gy[1] = (-2.0 * y);
-		y += 1.0;
-		p->py[2] = (0.5 * y * y - 1.5F * y + 1.125);
-		p->gy[2] = (y - 1.5);
-
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				int cxi = p->cx + i;
-				int cyj = p->cy + j;
-				Node *n = &grid[cxi][cyj];
-				if (!n->active)
-				{
-					active.push_back(n);
-					n->active = true;
-				}
-				float phi = p->px[i] * p->py[j];
-				n->m += phi;
-				float dx = p->gx[i] * p->py[j];
-				float dy = p->px[i] * p->gy[j];
-				n->gx += dx;
-				n->gy += dy;
-				n->u += phi * p->u;
-				n->v += phi * p->v;
-			}
-		}
-	}
-
-	for (vector<Node *>::iterator i = active.begin(); i != active.end(); ++i)
-	{
-		Node *n = *i;
-		if (n->m > 0)
-		{
-			n->u /= n->m;
-			n->v /= n->m;
-		}
-
-	}
-
-	for (int k = 0; k < pCount; k++)
-	{
-		Particle *p = &particles[k];
-
-		float dudx = 0.0;
-		float dudy = 0.0;
-		float dvdx = 0.0;
-		float dvdy = 0.0;
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				Node *n = &grid[(p->cx + i)][(p->cy + j)];
-				float gx = p->gx[i] * p->py[j];
-				float gy = p->px[i] * p->gy[j];
-				dudx += n->u * gx;
-				dudy += n->u * gy;
-				dvdx += n->v * gx;
-				dvdy += n->v * gy;
-			}
-		}
-
-		float w1 = dudy - dvdx;
-		float wT0 = w1 * p->T01;
-		float wT1 = 0.5F * w1 * (p->T00 - p->T11);
-		float D00 = dudx;
-		float D01 = 0.5F * (dudy + dvdx);
-		float D11 = dvdy;
-		float trace = 0.5F * (D00 + D11);
-		D00 -= trace;
-		D11 -= trace;
-		p->T00 += -wT0 + D00 - mYieldRate * p->T00;
-		p->T01 += wT1 + D01 - mYieldRate * p->T01;
-		p->T11 += wT0 + D11 - mYieldRate * p->T11;
-
-		/*
-		float norm = p->T00 * p->T00 + 2.0 * p->T01 * p->T01 + p->T11 * p->T11;
-		if ((this.mode > -1) || (norm > 5.0)) {
-			p->T00 = (p->T01 = p->T11 = 0.0);
-		}
-		*/
-		float norm = p->T00 * p->T00 + 2.0 * p->T01 * p->T01 + p->T11 * p->T11;
-		if (norm > 5.0)
-			p->T00 = p->T01 = p->T11 = 0.0;
-
-		int cx = (int)p->x;
-		int cy = (int)p->y;
-		if (cx > gsizeX - 5)
-			cx = gsizeX - 5;
-		else
-		if (cx < 0)
-			cx = 0;
-		if (cy > gsizeY - 5)
-			cy = gsizeY - 5;
-		else
-		if (cy < 0)
-			cy = 0;
-		int cxi = cx + 1;
-		int cyi = cy + 1;
-
-		float p00 = grid[cx][cy].m;
-		float x00 = grid[cx][cy].gx;
-		float y00 = grid[cx][cy].gy;
-		float p01 = grid[cx][cyi].m;
-		float x01 = grid[cx][cyi].gx;
-		float y01 = grid[cx][cyi].gy;
-		float p10 = grid[cxi][cy].m;
-		float x10 = grid[cxi][cy].gx;
-		float y10 = grid[cxi][cy].gy;
-		float p11 = grid[cxi][cyi].m;
-		float x11 = grid[cxi][cyi].gx;
-		float y11 = grid[cxi][cyi].gy;
-
-		float pdx = p10 - p00;
-		float pdy = p01 - p00;
-		float C20 = 3.0 * pdx - x10 - 2.0 * x00;
-		float C02 = 3.0 * pdy - y01 - 2.0 * y00;
-		float C30 = -2.0 * pdx + x10 + x00;
-		float C03 = -2.0 * pdy + y01 + y00;
-		float csum1 = p00 + y00 + C02 + C03;
-		float csum2 = p00 + x00 + C20 + C30;
-		float C21 = 3.0 * p11 - 2.0 * x01 - x11 - 3.0 * csum1 - C20;
-		float C31 = -2.0 * p11 + x01 + x11 + 2.0 * csum1 - C30;
-		float C12 = 3.0 * p11 - 2.0 * y10 - y11 - 3.0 * csum2 - C02;
-		float C13 = -2.0 * p11 + y10 + y11 + 2.0 * csum2 - C03;
-		float C11 = x01 - C13 - C12 - x00;
-
-		float u = p->x - cx;
-		float u2 = u * u;
-		float u3 = u * u2;
-		float v = p->y - cy;
-		float v2 = v * v;
-		float v3 = v * v2;
-		float density = p00 + x00 * u + y00 * v + C20 * u2 + C02 * v2 +
-			C30 * u3 + C03 * v3 + C21 * u2 * v + C31 * u3 * v + C12 *
-			u * v2 + C13 * u * v3 + C11 * u * v;
-
-		float pressure = mStiffness / max(1.0f, mDensity) * (density - mDensity);
-		if (pressure > 2.0) {
-			pressure = 2.0;
-		}
-
-		float fx = 0.0;
-		float fy = 0.0;
-		if (p->x < 3.0)
-			fx += 3.0 - p->x;
-		else
-		if (p->x > gsizeX - 4)
-			fx += gsizeX - 4 - p->x;
-
-		if (p->y < 3.0F)
-			fy += 3.0F - p->y;
-		else
-		if (p->y > gsizeY - 4)
-			fy += gsizeY - 4 - p->y;
-
-		trace *= mStiffness;
-		float T00 = mElasticity * p->T00 + mViscosity * D00 + pressure + mBulkViscosity * trace;
-		float T01 = mElasticity * p->T01 + mViscosity * D01;
-		float T11 = mElasticity * p->T11 + mViscosity * D11 + pressure + mBulkViscosity * trace;
-
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				Node *n = &grid[(p->cx + i)][(p->cy + j)];
-				float phi = p->px[i] * p->py[j];
-				float dx = p->gx[i] * p->py[j];
-				float dy = p->px[i] * p->gy[j];
-
-				n->ax += -(dx * T00 + dy * T01) + fx * phi;
-				n->ay += -(dx * T01 + dy * T11) + fy * phi;
-			}
-		}
+		mLiquid->setDrag( mMousePos.x / mMulX, mMousePos.y / mMulY,
+				( mMousePos.x - mMousePrevPos.x ) / mMulX,
+				( mMousePos.y - mMousePrevPos.y ) / mMulY );
 	}
-
-	for (vector<Node *>::iterator i = active.begin(); i != active.end(); ++i)
+	else
 	{
-		Node *n = *i;
-		if (n->m > 0)
-		{
-			n->ax /= n->m;
-			n->ay /= n->m;
-			n->u = 0;
-			n->v = 0;
-		}
-
+		mLiquid->clearDrag();
 	}
 
+	mLiquid->setFlowMultiplier( mFlowMultiplier );
 
-	for (int k = 0; k < pCount; k++)
-	{
-		Particle *p = &particles[k];
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				Node *n = &grid[(p->cx + i)][(p->cy + j)];
-				float phi = p->px[i] * p->py[j];
-				p->u += phi * n->ax;
-				p->v += phi * n->ay;
-			}
-		}
-		p->v += mGravity;
-
-		if (mMouseDrag)
-		{
-			float vx = abs(p->x - mMousePos.x / mMulX);
-			float vy = abs(p->y - mMousePos.y / mMulY);
-			if ((vx < 10.0) && (vy < 10.0))
-			{
-				float weight = (1.0 - vx / 10.0) * (1.0 - vy / 10.0);
-				p->u += weight * (mdx - p->u);
-				p->v += weight * (mdy - p->v);
-			}
-		}
-
-		// optical flow
-		if ( mFlow.data )
-		{
-			cv::Point2f v = mFlow.at< cv::Point2f >( static_cast< int >( p->y ),
-					static_cast< int >( p->x ) );
-			p->u += mFlowMultiplier * v.x;
-			p->v += mFlowMultiplier * v.y;
-		}
-
-		float x = p->x + p->u;
-		float y = p->y + p->v;
-		if (x < 2.0)
-			p->u += 2.0 - x + Rand::randFloat() * 0.01;
-		else
-		if (x > gsizeX - 3)
-			p->u += gsizeX - 3 - x - Rand::randFloat() * 0.01;
-
-		if (y < 2.0)
-			p->v += 2.0 - y + Rand::randFloat() * 0.01;
-		else
-		if (y > gsizeY - 3)
-			p->v += gsizeY - 3 - y - Rand::randFloat() * 0.01;
-
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				Node *n = &grid[(p->cx + i)][(p->cy + j)];
-				float phi = p->px[i] * p->py[j];
-				n->u += phi * p->u;
-				n->v += phi * p->v;
-			}
-		}
-	}
+	mLiquid->step();
+	updateStreaks();
+}
 
-	for (vector<Node *>::iterator i = active.begin(); i != active.end(); ++i)
+void LiquidApp::updateStreaks()
+{
+	const mndl::MpmLiquid::Particles &particles = mLiquid->getParticles();
+	mStreakCount = mLiquid->getNumParticles();
+
+	// the buffer is orphaned, so the driver does not wait for the last
+	// frame to be drawn
+	mStreakVbo.bind();
+	mStreakVbo.bufferData( mStreakCount * 4 * sizeof( float ), NULL, GL_STREAM_DRAW );
+	float *v = reinterpret_cast< float * >( mStreakVbo.map( GL_WRITE_ONLY ) );
+	if ( v )
 	{
-		Node *n = *i;
-		if (n->m > 0)
+		for ( int i = 0; i < mStreakCount; i++ )
 		{
-			n->u /= n->m;
-			n->v /= n->m;
+			float x = particles.x[ i ] - 1.f;
+			float y = particles.y[ i ];
+			v[ 0 ] = mMulX * x;
+			v[ 1 ] = mMulY * y;
+			v[ 2 ] = mMulX * ( x - particles.gu[ i ] );
+			v[ 3 ] = mMulY * ( y - particles.gv[ i ] );
+			v += 4;
 		}
-
+		mStreakVbo.unmap();
 	}
-
-	for (int k = 0; k < pCount; k++)
+	else
 	{
-		Particle *p = &particles[k];
-		float gu = 0.0;
-		float gv = 0.0;
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				Node *n = &grid[(p->cx + i)][(p->cy + j)];
-				float phi = p->px[i] * p->py[j];
-				gu += phi * n->u;
-				gv += phi * n->v;
-			}
-		}
-
-		p->gu = gu;
-		p->gv = gv;
-
-		p->x += gu;
-		p->y += gv;
-		p->u += mSmoothing * (gu - p->u);
-		p->v += mSmoothing * (gv - p->v);
+		mStreakCount = 0;
 	}
+	mStreakVbo.unbind();
 }
 
 void LiquidApp::draw()
@@ -732,43 +414,17 @@ void LiquidApp::draw()
 
 	//gl::color( Color::white() );
 	gl::color( mParticleColor );
-	Vec2f mul( mMulX, mMulY );
 	gl::enableAdditiveBlending();
 	gl::disableDepthRead();
 	gl::disableDepthWrite();
 	//mParticleTexture.enableAndBind();
 
-	Vec2f pSize = Vec2f( 1, 1 ) * mFbo.getWidth() * mParticleSize;
-	for (int i = 0; i < pCount; i++)
-	{
-		Particle *p = &particles[i];
-
-		//*
-		gl::drawLine( mul * Vec2f(p->x - 1.0, p->y),
-					  mul * Vec2f(p->x - 1.0 - p->gu, p->y - p->gv));
-		//*/
-		/*
-		Vec2f pos( p->x, p->y);
-		pos *= mul;
-		gl::drawSolidRect( Rectf( pos - pSize, pos + pSize ) );
-		*/
-
-		/*
-		float r = toDegrees( math< float >::atan2( p->gv, p->gu ) );
-		Vec2f pos( p->x, p->y);
-		Vec2f vel( p->gu, p->gv);
-		float s = vel.length();
-		Vec2f velScale( 1. + s, 1. / ( 1. + s ) );
-
-		pos *= mul;
-		velScale *= pSize;
-		gl::pushModelView();
-		gl::translate( pos );
-		gl::rotate( r );
-		gl::drawSolidRect( Rectf( - velScale, velScale ) );
-		gl::popModelView();
-		*/
-	}
+	mStreakVbo.bind();
+	glEnableClientState( GL_VERTEX_ARRAY );
+	glVertexPointer( 2, GL_FLOAT, 0, 0 );
+	glDrawArrays( GL_LINES, 0, mStreakCount * 2 );
+	glDisableClientState( GL_VERTEX_ARRAY );
+	mStreakVbo.unbind();
 	mParticleTexture.unbind();
 	gl::disableAlphaBlending();
 
@@ -24,10 +24,11 @@
 #include "cinder/Utilities.h"
 #include "cinder/Capture.h"
 
-#include "cinder/ip/Resize.h"
-
 #include "CinderOpenCV.h"
 
+#include "FlowWorker.h"
+#include "GreyDownsampler.h"
+
 using namespace ci;
 using namespace ci::app;
 using namespace std;
@@ -55,8 +56,16 @@ class OptFlowApp : public AppBasic
 		bool mFlip;
 		bool mDrawFlow;
 
-		cv::Mat mPrevFrame;
+		mndl::FlowWorkerRef mFlowWorker;
+		mndl::GreyDownsamplerRef mGreyDownsampler;
 		cv::Mat mFlow;
+		float mFlowTime;
+		float mFlowError;
+		std::string mFlowMethodName;
+
+		int mFlowMethod;
+		float mFlowTimeBudget;
+		int mFlowQualityInterval;
 
 		float mPyrScale;
 		int mOptFlowLevels;
@@ -80,6 +89,9 @@ void OptFlowApp::setup()
 	mParams = params::InterfaceGl( "Parameters", Vec2i( 200, 300 ) );
 
 	mParams.addParam( "Fps", &mFps, "", false );
+	mParams.addParam( "Flow ms", &mFlowTime, "", true );
+	mParams.addParam( "Flow method", &mFlowMethodName, "", true );
+	mParams.addParam( "Flow error", &mFlowError, "", true );
 	mFlip = true;
 	mParams.addParam( "Flip", &mFlip );
 	mDrawFlow = true;
@@ -87,6 +99,17 @@ void OptFlowApp::setup()
 	mFlowMultiplier = .3;
 	mParams.addParam( "Flow multiplier", &mFlowMultiplier, "min=.05 max=2 step=.05" );
 
+	mParams.addSeparator();
+	vector< string > methodNames;
+	for ( int m = 0; m <= mndl::FLOW_AUTO; m++ )
+		methodNames.push_back( mndl::FlowBackend::getMethodName( mndl::FlowMethod( m ) ) );
+	mFlowMethod = mndl::FLOW_FARNEBACK;
+	mParams.addParam( "Method", methodNames, &mFlowMethod );
+	mFlowTimeBudget = 10.f;
+	mParams.addParam( "Time budget ms", &mFlowTimeBudget, "min=1 max=100 step=.5" );
+	mFlowQualityInterval = 0;
+	mParams.addParam( "Quality interval", &mFlowQualityInterval, "min=0 max=100" );
+
 	mParams.addSeparator();
 	mPyrScale = .5;
 	mParams.addParam( "Pyramid scale", &mPyrScale, "min=.01 max=.99 step=.01" );
@@ -102,6 +125,11 @@ void OptFlowApp::setup()
 	mParams.addParam( "Poly sigma", &mOptFlowPolySigma, "min=.1 max=5 step=.1" );
 	mParams.addSeparator();
 
+	mFlowWorker = mndl::FlowWorker::create();
+	mGreyDownsampler = mndl::GreyDownsampler::create();
+	mFlowTime = 0.f;
+	mFlowError = -1.f;
+
 	// capture
 	try
 	{
@@ -131,38 +159,41 @@ void OptFlowApp::update()
 
 	if ( mCapture && mCapture.checkNewFrame() )
 	{
-		Surface8u captSurf( Channel8u( mCapture.getSurface() ) );
-
-		Surface8u smallSurface( OPTFLOW_WIDTH, OPTFLOW_HEIGHT, false );
-		if ( ( captSurf.getWidth() != OPTFLOW_WIDTH ) ||
-			 ( captSurf.getHeight() != OPTFLOW_HEIGHT ) )
-		{
-			ip::resize( captSurf, &smallSurface );
-		}
-		else
-		{
-			smallSurface = captSurf;
-		}
-
-		mCaptTexture = gl::Texture( captSurf );
+		Surface8u captSurf = mCapture.getSurface();
+
+		// grey, downsampled and mirrored flow input in a single pass into a
+		// frame recycled by the worker
+		cv::Mat currentFrame = mFlowWorker->acquireFrame( OPTFLOW_WIDTH, OPTFLOW_HEIGHT );
+		mGreyDownsampler->process( captSurf.getData(), captSurf.getWidth(), captSurf.getHeight(),
+				captSurf.getRowBytes(),
+				mndl::GreyDownsampler::Layout( captSurf.getPixelInc(), captSurf.getRedOffset(),
+					captSurf.getGreenOffset(), captSurf.getBlueOffset() ),
+				currentFrame, mFlip );
+		mFlowWorker->pushFrame( currentFrame, getElapsedSeconds() );
+
+		mCaptTexture = gl::Texture( Channel8u( captSurf ) );
+	}
 
-		cv::Mat currentFrame( toOcv( Channel( smallSurface ) ) );
-		if ( mFlip )
-			cv::flip( currentFrame, currentFrame, 1 );
-        if ( mPrevFrame.data )
-		{
-			cv::calcOpticalFlowFarneback(
-					mPrevFrame, currentFrame,
-					mFlow,
-					mPyrScale,
-					mOptFlowLevels,
-					mOptFlowWinSize,
-					mOptFlowIterations,
-					mOptFlowPolyN,
-					mOptFlowPolySigma,
-					0 );
-		}
-        mPrevFrame = currentFrame;
+	mndl::FlowWorker::Params params;
+	params.method = mndl::FlowMethod( mFlowMethod );
+	params.timeBudget = mFlowTimeBudget;
+	params.qualityInterval = mFlowQualityInterval;
+	params.pyrScale = mPyrScale;
+	params.levels = mOptFlowLevels;
+	params.winSize = mOptFlowWinSize;
+	params.iterations = mOptFlowIterations;
+	params.polyN = mOptFlowPolyN;
+	params.polySigma = mOptFlowPolySigma;
+	mFlowWorker->setParams( params );
+
+	// the flow is calculated on the worker thread, the latest one is used
+	if ( mFlowWorker->checkNewFlow() )
+	{
+		mndl::FlowWorker::Flow flow = mFlowWorker->getFlow();
+		mFlow = flow.flow;
+		mFlowMethodName = mndl::FlowBackend::getMethodName( flow.method );
+		mFlowTime = mFlowWorker->getFlowTime();
+		mFlowError = mFlowWorker->getFlowError();
 	}
 }
 
@@ -20,16 +20,18 @@
 #include "cinder/gl/gl.h"
 #include "cinder/gl/Fbo.h"
 #include "cinder/gl/Texture.h"
-#include "cinder/ip/Resize.h"
 
 #include "ciMsaFluidDrawerGl.h"
 #include "ciMsaFluidSolver.h"
 #include "CinderOpenCV.h"
+#include "FlowWorker.h"
+#include "GreyDownsampler.h"
 #include "mndlkit/params/PParams.h"
 #include "KawaseStreak.h"
 
 #include "CaptureSource.h"
 #include "FluidParticles.h"
+#include "EmissionGovernor.h"
 #include "FluidLetters.h"
 
 using namespace ci;
@@ -74,7 +76,8 @@ class FludParticlesApp : public AppBasic
 		float mCaptureAlpha;
 		float mFlowMultiplier;
 
-		cv::Mat mPrevFrame;
+		mndl::FlowWorkerRef mFlowWorker;
+		mndl::GreyDownsamplerRef mGreyDownsampler;
 		cv::Mat mFlow;
 
 		int mOptFlowWidth;
@@ -105,7 +108,23 @@ class FludParticlesApp : public AppBasic
 		float mVelParticleMin;
 		float mVelParticleMax;
 
+		mndl::particles::EmissionGovernor mGovernor;
+		bool mGovernorEnabled;
+		float mGovernorFps;
+		float mGovernorDensity;
+		mndl::particles::EmissionGovernor::State mGovernorState;
+
 		void addToFluid( Vec2f pos, Vec2f vel, bool addParticles = true, bool addForce = true, bool addColor = true, bool addLetters = false );
+		void addFlowToFluid( Area area );
+
+		// flow accumulated per fluid cell by addFlowToFluid
+		std::vector< int > mFlowCellX;
+		std::vector< float > mFlowRowVelX, mFlowRowVelY;
+		std::vector< float > mFlowRowMoving, mFlowRowEmission;
+		std::vector< Vec2f > mCellForces;
+		std::vector< float > mCellMoving;
+		std::vector< float > mCellEmission;
+		std::vector< Vec2f > mCellEmissionPos;
 		LetterManagerRef mLetterManager;
 		bool mLettersEnabled;
 		string mLetters;
@@ -164,6 +183,9 @@ void FludParticlesApp::setup()
 	mParams.addPersistentParam( "Velocity particle multiplier", &mVelParticleMult, .57, "min=0 max=2 step=.01" );
 	mParams.addPersistentParam( "Velocity particle min", &mVelParticleMin, 1.f, "min=1 max=100 step=.5" );
 	mParams.addPersistentParam( "Velocity particle max", &mVelParticleMax, 60.f, "min=1 max=100 step=.5" );
+	mParams.addPersistentParam( "Governor enabled", &mGovernorEnabled, true );
+	mParams.addPersistentParam( "Governor target fps", &mGovernorFps, 60.f, "min=10 max=120 step=1" );
+	mParams.addParam( "Governor density", &mGovernorDensity, "", true );
 	mParams.addSeparator();
 
 	mParams.addText( "Letters" );
@@ -184,6 +206,12 @@ void FludParticlesApp::setup()
 
 	mCaptureSource.setup();
 
+	mFlowWorker = mndl::FlowWorker::create();
+	mGreyDownsampler = mndl::GreyDownsampler::create();
+	mndl::FlowWorker::Params flowParams;
+	flowParams.flags = cv::OPTFLOW_FARNEBACK_GAUSSIAN;
+	mFlowWorker->setParams( flowParams );
+
 	// fluid
 	mParams.addText( "Fluid" );
 	mParams.addPersistentParam( "Fluid width", &mFluidWidth, 160, "min=16 max=512", true );
@@ -224,6 +252,7 @@ void FludParticlesApp::setup()
 	mKawaseStreak = mndl::gl::fx::KawaseStreak( mParticlesFbo.getWidth(), mParticlesFbo.getHeight() );
 
 	mOptFlowClipRectNorm = Rectf( 0, 0, 1, 1 );
+	mGovernorState = mGovernor.getState();
 }
 
 void FludParticlesApp::resize()
@@ -251,81 +280,46 @@ void FludParticlesApp::update()
 	if ( mVerticalSyncEnabled != gl::isVerticalSyncEnabled() )
 		gl::enableVerticalSync( mVerticalSyncEnabled );
 
+	// particle emission governor
+	mGovernor.setEnabled( mGovernorEnabled );
+	mGovernor.setTargetFrameTime( 1. / mGovernorFps );
+	mGovernor.endFrame( mParticles.getNumActive() );
+	mGovernorDensity = mGovernor.getDensity();
+	if ( mGovernor.getState() != mGovernorState )
+	{
+		mGovernorState = mGovernor.getState();
+		console() << mGovernor.getStatus() << endl;
+	}
+
 	mCaptureSource.update();
 
 	// optical flow
 	if ( mCaptureSource.isCapturing() && mCaptureSource.checkNewFrame() )
 	{
-		Surface8u captSurf( Channel8u( mCaptureSource.getSurface() ) );
-
-		Surface8u smallSurface( mOptFlowWidth, mOptFlowHeight, false );
-		if ( ( captSurf.getWidth() != mOptFlowWidth ) ||
-				( captSurf.getHeight() != mOptFlowHeight ) )
-		{
-			ip::resize( captSurf, &smallSurface );
-		}
-		else
-		{
-			smallSurface = captSurf;
-		}
-
-		mCaptureTexture = gl::Texture( captSurf );
+		Surface8u captSurf = mCaptureSource.getSurface();
+
+		// grey, downsampled and mirrored flow input in a single pass into a
+		// frame recycled by the worker
+		cv::Mat currentFrame = mFlowWorker->acquireFrame( mOptFlowWidth, mOptFlowHeight );
+		mGreyDownsampler->process( captSurf.getData(), captSurf.getWidth(), captSurf.getHeight(),
+				captSurf.getRowBytes(),
+				mndl::GreyDownsampler::Layout( captSurf.getPixelInc(), captSurf.getRedOffset(),
+					captSurf.getGreenOffset(), captSurf.getBlueOffset() ),
+				currentFrame, mFlip );
+		mFlowWorker->pushFrame( currentFrame, getElapsedSeconds() );
+
+		mCaptureTexture = gl::Texture( Channel8u( captSurf ) );
+	}
 
-		cv::Mat currentFrame( toOcv( Channel( smallSurface ) ) );
-		if ( mFlip )
-			cv::flip( currentFrame, currentFrame, 1 );
-		if ( ( mPrevFrame.data ) &&
-			 ( mPrevFrame.size() == cv::Size( mOptFlowWidth, mOptFlowHeight ) ) )
-		{
-			/*
-
-			   void calcOpticalFlowFarneback( const Mat& prevImg, const Mat& nextImg, Mat& flow,
-					double pyrScale, int levels, int winsize, int iterations, int polyN, double polySigma, int flags)
-
-				pyrScale – Specifies the image scale (<1) to build the pyramids
-					for each image. pyrScale=0.5 means the classical pyramid, where
-					each next layer is twice smaller than the previous
-				levels – The number of pyramid layers, including the initial
-					image. levels=1 means that no extra layers are created and only
-					the original images are used
-				winsize – The averaging window size; The larger values increase
-					the algorithm robustness to image noise and give more chances
-					for fast motion detection, but yield more blurred motion field
-				iterations – The number of iterations the algorithm does at
-					each pyramid level
-				polyN – Size of the pixel neighborhood used to find polynomial
-					expansion in each pixel. The larger values mean that the image
-					will be approximated with smoother surfaces, yielding more
-					robust algorithm and more blurred motion field. Typically,
-					polyN =5 or 7
-				polySigma – Standard deviation of the Gaussian that is used to
-					smooth derivatives that are used as a basis for the polynomial
-					expansion. For polyN=5 you can set polySigma=1.1 , for polyN=7
-					a good value would be polySigma=1.5
-				flags – The operation flags; can be a combination of the
-					following:
-					OPTFLOW_USE_INITIAL_FLOW Use the input flow as the initial
-						flow approximation
-					OPTFLOW_FARNEBACK_GAUSSIAN Use a Gaussian filter instead of box
-						filter of the same size for optical flow estimation. Usually, this option gives
-						more accurate flow than with a box filter, at the cost of lower speed (and
-						normally winsize for a Gaussian window should be set to a larger value to
-						achieve the same level of robustness)
-			*/
-
-			cv::calcOpticalFlowFarneback(
-					mPrevFrame, currentFrame,
-					mFlow,
-					.5, 5, 13, 5, 5, 1.1, cv::OPTFLOW_FARNEBACK_GAUSSIAN );
-		}
-		mPrevFrame = currentFrame;
+	// the flow is calculated on the worker thread, the fluid is updated
+	// when a new one arrives
+	if ( mFlowWorker->checkNewFlow() )
+	{
+		mFlow = mFlowWorker->getFlow().flow;
 
 		// fluid update
 		if ( mFlow.data )
 		{
-			RectMapping ofNorm( Area( 0, 0, mFlow.cols, mFlow.rows ),
-					Rectf( 0.f, 0.f, 1.f, 1.f ) );
-
 			// calculate mask
 			Rectf maskRectNorm = mOptFlowClipRectNorm.getClipBy( mPreviewRectNorm );
 			if ( ( maskRectNorm.getWidth() > 0 ) && maskRectNorm.getHeight() > 0 )
@@ -334,15 +328,7 @@ void FludParticlesApp::update()
 				maskRect.scale( Vec2f::one() / mPreviewRectNorm.getSize() );
 				Area maskArea( maskRect.scaled( Vec2f( mFlow.cols, mFlow.rows ) ) );
 
-				for ( int y = maskArea.y1; y < maskArea.y2; y++ )
-				{
-					for ( int x = maskArea.x1; x < maskArea.x2; x++ )
-					{
-						Vec2f v = fromOcv( mFlow.at< cv::Point2f >( y, x ) );
-						Vec2f p( x + .5, y + .5 );
-						addToFluid( ofNorm.map( p ), ofNorm.map( v ) * mFlowMultiplier );
-					}
-				}
+				addFlowToFluid( maskArea );
 			}
 		}
 	}
@@ -356,11 +342,113 @@ void FludParticlesApp::update()
 	mFluidSolver.update();
 
 	mParticles.setAging( mParticleAging );
+	mGovernor.beginUpdate();
 	mParticles.update( getElapsedSeconds() );
+	mGovernor.endUpdate();
 
 	mLetterManager->setLetters( mLetters );
 	mLetterManager->setSize( mFontSizeMin, mFontSizeMax );
 	mLetterManager->update( getElapsedSeconds() );
+	mGovernor.endWork();
+}
+
+// The flow inside area is added to the fluid as if addToFluid was called
+// for every flow pixel, but the pixels are summed per fluid cell first.
+// Forces and colors add up to the same, the particles of a cell are
+// emitted at once from the emission weighted center of its pixels.
+void FludParticlesApp::addFlowToFluid( Area area )
+{
+	area.clipBy( Area( 0, 0, mFlow.cols, mFlow.rows ) );
+	if ( ( area.getWidth() <= 0 ) || ( area.getHeight() <= 0 ) )
+		return;
+
+	const int nx = mFluidSolver.getWidth() - 2;
+	const int ny = mFluidSolver.getHeight() - 2;
+	const float invFlowWidth = 1.f / mFlow.cols;
+	const float invFlowHeight = 1.f / mFlow.rows;
+
+	// fluid cell columns of the flow columns, the cell addForceAtPos would pick
+	mFlowCellX.resize( mFlow.cols );
+	for ( int x = 0; x < mFlow.cols; x++ )
+		mFlowCellX[ x ] = math< int >::min( int( ( x + .5f ) * invFlowWidth * nx ), nx - 1 );
+
+	mCellForces.assign( nx * ny, Vec2f::zero() );
+	mCellMoving.assign( nx * ny, 0.f );
+	mCellEmission.assign( nx * ny, 0.f );
+	mCellEmissionPos.assign( nx * ny, Vec2f::zero() );
+
+	const int width = area.getWidth();
+	mFlowRowVelX.resize( width );
+	mFlowRowVelY.resize( width );
+	mFlowRowMoving.resize( width );
+	mFlowRowEmission.resize( width );
+	float *velX = &mFlowRowVelX[ 0 ];
+	float *velY = &mFlowRowVelY[ 0 ];
+	float *moving = &mFlowRowMoving[ 0 ];
+	float *emission = &mFlowRowEmission[ 0 ];
+
+	const float scaleX = invFlowWidth * mFlowMultiplier;
+	const float scaleY = invFlowHeight * mFlowMultiplier;
+	// lmap of the velocity to the particle count as in addToFluid
+	const float emissionScale = mVelParticleMult * mParticlesFbo.getWidth() *
+		( mParticleMax - mParticleMin ) / ( mVelParticleMax - mVelParticleMin );
+	const float emissionOffset = mParticleMin - mVelParticleMin *
+		( mParticleMax - mParticleMin ) / ( mVelParticleMax - mVelParticleMin );
+
+	for ( int y = area.y1; y < area.y2; y++ )
+	{
+		// scale and threshold the row without branches, so the loop is vectorized
+		const float *flow = mFlow.ptr< float >( y ) + area.x1 * 2;
+		for ( int i = 0; i < width; i++ )
+		{
+			float vx = flow[ i * 2 ] * scaleX;
+			float vy = flow[ i * 2 + 1 ] * scaleY;
+			float l2 = vx * vx + vy * vy;
+			float m = ( l2 > 0.000001f ) ? 1.f : 0.f;
+			velX[ i ] = vx * m;
+			velY[ i ] = vy * m;
+			moving[ i ] = m;
+			float count = float( int( math< float >::sqrt( l2 ) * emissionScale + emissionOffset ) );
+			emission[ i ] = math< float >::max( count, 0.f ) * m;
+		}
+
+		// sum the row into the cells
+		const int cellY = math< int >::min( int( ( y + .5f ) * invFlowHeight * ny ), ny - 1 );
+		const int rowOffset = cellY * nx;
+		const float py = y + .5f;
+		for ( int i = 0; i < width; i++ )
+		{
+			if ( moving[ i ] == 0.f )
+				continue;
+			int c = rowOffset + mFlowCellX[ area.x1 + i ];
+			mCellForces[ c ] += Vec2f( velX[ i ], velY[ i ] );
+			mCellMoving[ c ] += 1.f;
+			mCellEmission[ c ] += emission[ i ];
+			mCellEmissionPos[ c ] += Vec2f( area.x1 + i + .5f, py ) * emission[ i ];
+		}
+	}
+
+	const Vec2f posScale = Vec2f( mParticlesFbo.getSize() ) * Vec2f( invFlowWidth, invFlowHeight );
+	for ( int j = 0; j < ny; j++ )
+	{
+		for ( int i = 0; i < nx; i++ )
+		{
+			int c = j * nx + i;
+			if ( mCellMoving[ c ] == 0.f )
+				continue;
+
+			mFluidSolver.addForceAtCell( i + 1, j + 1, mCellForces[ c ] * mFluidVelocityMult );
+			mFluidSolver.addColorAtCell( i + 1, j + 1, mCellMoving[ c ] * mFluidColorMult,
+					mCellMoving[ c ] * mFluidColorMult, mCellMoving[ c ] * mFluidColorMult );
+
+			if ( mCellEmission[ c ] > 0.f )
+			{
+				int particleCount = mGovernor.getEmissionCount( int( mCellEmission[ c ] ) );
+				if ( particleCount > 0 )
+					mParticles.addParticle( mCellEmissionPos[ c ] / mCellEmission[ c ] * posScale, particleCount );
+			}
+		}
+	}
 }
 
 void FludParticlesApp::addToFluid( Vec2f pos, Vec2f vel, bool addParticles, bool addForce, bool addColor, bool addLetters )
@@ -379,7 +467,11 @@ void FludParticlesApp::addToFluid( Vec2f pos, Vec2f vel, bool addParticles, bool
 			if (count > 0)
 			{
 				if ( addParticles )
-					mParticles.addParticle( pos * Vec2f( mParticlesFbo.getSize() ), count );
+				{
+					int particleCount = mGovernor.getEmissionCount( count );
+					if ( particleCount > 0 )
+						mParticles.addParticle( pos * Vec2f( mParticlesFbo.getSize() ), particleCount );
+				}
 				if ( addLetters )
 					mLetterManager->addLetter( pos * Vec2f( getWindowSize() ) );
 			}
@@ -396,10 +488,13 @@ void FludParticlesApp::addToFluid( Vec2f pos, Vec2f vel, bool addParticles, bool
 
 void FludParticlesApp::draw()
 {
+	// the work of both windows is measured without their buffer swaps
+	mGovernor.beginWork();
 	if ( getWindow() == mControlWindow )
 		drawControl();
 	else
 		drawOutput();
+	mGovernor.endWork();
 }
 
 void FludParticlesApp::drawControl()
@@ -463,7 +558,9 @@ void FludParticlesApp::drawOutput()
 
 		//gl::color( Color( .9f, .5f, .1f ) );
 		//gl::drawSolidCircle( mParticlesFbo.getSize() / 2.f, 10 );
+		mGovernor.beginDraw();
 		mParticles.draw();
+		mGovernor.endDraw();
 		mParticlesFbo.unbindFramebuffer();
 
 		gl::Texture output = mKawaseStreak.process( mParticlesFbo.getTexture(), mStreakAttenuation, mStreakIterations, mStreakStrength );
@@ -17,6 +17,10 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <boost/bind.hpp>
@@ -37,6 +41,9 @@
 #include "mndlkit/params/PParams.h"
 
 #include "Blob.h"
+#include "BlobExtractor.h"
+#include "BlobMatcher.h"
+#include "SpscQueue.h"
 
 namespace mndl {
 
@@ -45,7 +52,10 @@ class NIBlobTracker
 	public:
 		NIBlobTracker() :
 			mSavingVideo( false ),
-			mIdCounter( 1 )
+			mIdCounter( 1 ),
+			mMovieFrameWaiting( false ),
+			mQuit( false ),
+			mMessages( MESSAGE_QUEUE_SIZE )
 		{}
 
 		void setup();
@@ -134,21 +144,82 @@ class NIBlobTracker
 		int mBlurSize;
 		float mMinArea;
 		float mMaxArea;
+		float mMaxDistance;
 
-		std::vector< BlobRef > mBlobs;
-		void trackBlobs( std::vector< BlobRef > newBlobs );
-		int32_t findClosestBlobKnn( const std::vector< BlobRef > &newBlobs,
-				BlobRef track, int k, double thresh );
+		mndl::BlobExtractorRef mBlobExtractor;
+
+		std::vector< BlobRef > mBlobs; //!< tracked blobs of the latest frame, used on the main thread
+		std::vector< BlobRef > mTracks; //!< tracked blobs on the tracker thread
+		void trackBlobs( std::vector< BlobRef > newBlobs, float maxDistance );
 		int32_t mIdCounter;
 
+		mndl::BlobMatcherRef mBlobMatcher;
+		std::vector< cv::Point2f > mTrackPositions;
+		std::vector< cv::Point2f > mBlobPositions;
+		std::vector< int > mAssignment;
+
+		// tracker thread
+		struct TrackerParams
+		{
+			bool camera;
+			bool flip;
+			int threshold;
+			int blurSize;
+			float minArea;
+			float maxArea;
+			float maxDistance;
+		};
+
+		//! Images and tracked blobs of a processed frame.
+		struct TrackerFrame
+		{
+			ci::Surface8u input;
+			cv::Mat orig;
+			cv::Mat blurred;
+			cv::Mat thresholded;
+			std::vector< BlobRef > blobs;
+		};
+		typedef std::shared_ptr< TrackerFrame > TrackerFrameRef;
+
+		struct TrackerMessage
+		{
+			enum Type
+			{
+				BLOB_BEGAN = 0,
+				BLOB_MOVED,
+				BLOB_ENDED
+			};
+
+			TrackerMessage( Type type = BLOB_MOVED, BlobRef blob = BlobRef() ) :
+				type( type ), blob( blob ) {}
+
+			Type type;
+			BlobRef blob;
+		};
+
+		void updateTrackerParams();
+		void trackerThreadFn();
+		void processFrame( ci::Surface8u inputSurface, const TrackerParams &params );
+		void postMessage( const TrackerMessage &msg );
+
+		std::thread mTrackerThread;
+		std::mutex mTrackerMutex;
+		std::condition_variable mTrackerCond;
+		TrackerParams mTrackerParams;
+		ci::Surface8u mMovieFrame; //!< movie frame waiting for the tracker thread
+		bool mMovieFrameWaiting;
+		TrackerFrameRef mLatestFrame; //!< latest processed frame, replaced by the next one
+		bool mQuit;
+
+		// blob events from the tracker thread to the main thread
+		static const size_t MESSAGE_QUEUE_SIZE = 4096;
+		SpscQueue< TrackerMessage > mMessages;
+
 		// signals
 		BlobSignal mBlobsBeganSig;
 		BlobSignal mBlobsMovedSig;
 		BlobSignal mBlobsEndedSig;
 
-		// normalizes blob coordinates from camera 2d coords to [0, 1]
-		ci::RectMapping mNormMapping;
-
 		// params
 		mndl::kit::params::PInterfaceGl mParams;
 };
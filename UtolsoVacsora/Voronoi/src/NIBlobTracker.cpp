@@ -19,8 +19,7 @@
  https://github.com/patriciogonzalezvivo/ofxBlobTracker
 */
 
-#include <list>
-#include <map>
+#include <chrono>
 
 #include "boost/date_time.hpp"
 
@@ -43,10 +42,18 @@ void NIBlobTracker::setup()
 	mKinectProgress = "Connecting...\0\0\0\0\0\0\0\0\0";
 	mKinectThread = thread( bind( &NIBlobTracker::openKinect, this, fs::path() ) );
 
+	mBlobExtractor = BlobExtractor::create();
+	mBlobMatcher = BlobMatcher::create();
+
 	mParams = mndl::kit::params::PInterfaceGl( "Tracker", Vec2i( 350, 400 ) );
 	mParams.addPersistentSizeAndPosition();
 
 	setupGui();
+
+	// depth processing and tracking run on the tracker thread at the rate
+	// of the source, blob events are passed back in a lock-free queue
+	updateTrackerParams();
+	mTrackerThread = thread( &NIBlobTracker::trackerThreadFn, this );
 }
 
 void NIBlobTracker::setupGui()
@@ -78,6 +85,7 @@ void NIBlobTracker::setupGui()
 	mParams.addPersistentParam( "Blur size", &mBlurSize, 10, "min=1 max=15" );
 	mParams.addPersistentParam( "Min area", &mMinArea, 0.0001f, "min=0.0 max=1.0 step=0.0001" );
 	mParams.addPersistentParam( "Max area", &mMaxArea, 0.2f, "min=0.0 max=1.0 step=0.001" );
+	mParams.addPersistentParam( "Max distance", &mMaxDistance, 0.1f, "min=0.001 max=1.0 step=0.001" );
 
 	mParams.addSeparator();
 	mParams.addText( "Debug" );
@@ -124,124 +132,82 @@ void NIBlobTracker::update()
 {
 	static int lastSource = mSource;
 
-	// select source
-	bool processFrame = false;
-	// TODO: make this work with Surface16u
-	Surface8u inputSurface;
-
 	if ( mSource == SOURCE_CAMERA )
 	{
 		// start kinect
 		if ( lastSource == SOURCE_RECORDING )
 		{
+			std::lock_guard< std::mutex > lock( mKinectMutex );
 			mNI.start();
 			mKinectProgress = "Started";
 		}
-
-		{
-			std::lock_guard< std::mutex > lock( mKinectMutex );
-			// normalized camera coordinates mapping
-			mNormMapping = RectMapping( Rectf( 0.0f, 0.0f, (float)CAPTURE_WIDTH, (float)CAPTURE_HEIGHT ),
-					Rectf( 0.0f, 0.0f, 1.0f, 1.0f ) );
-
-			processFrame = mNI && mNI.checkNewDepthFrame();
-			if ( processFrame )
-			{
-				inputSurface = mNI.getDepthImage();
-
-				Surface::Iter iter = inputSurface.getIter();
-				while ( iter.line() )
-				{
-					while( iter.pixel() )
-					{
-						// leave self-shadow pixels and invert the rest
-						if ( iter.r() != 0 )
-						{
-							iter.r() = 255 - iter.r();
-							iter.g() = 255 - iter.g();
-							iter.b() = 255 - iter.b();
-						}
-					}
-				}
-			}
-		}
 	}
 	else // SOURCE_RECORDING
 	{
 		// stop kinect
 		if ( lastSource == SOURCE_CAMERA )
 		{
+			std::lock_guard< std::mutex > lock( mKinectMutex );
 			mNI.stop();
 			mKinectProgress = "Stopped";
 		}
 
-		if ( mMovie )
+		// movie frames are decoded here and handed over to the tracker
+		// thread, a frame not processed yet is replaced by the new one
+		if ( mMovie && mMovie.checkNewFrame() )
 		{
-			// normalized movie coordinates mapping
-			mNormMapping = RectMapping( Rectf( 0.0f, 0.0f, (float)mMovie.getWidth(), (float)mMovie.getHeight() ),
-					Rectf( 0.0f, 0.0f, 1.0f, 1.0f ) );
-
-			processFrame = mMovie.checkNewFrame();
-			if ( processFrame )
-				inputSurface = mMovie.getSurface();
+			{
+				std::lock_guard< std::mutex > lock( mTrackerMutex );
+				mMovieFrame = mMovie.getSurface();
+				mMovieFrameWaiting = true;
+			}
+			mTrackerCond.notify_one();
 		}
 	}
 
-	// process source image
-	if ( processFrame )
-	{
-		if ( mSavingVideo )
-			mMovieWriter.addFrame( inputSurface );
-
-		// opencv
-		cv::Mat input( toOcv( Channel8u( inputSurface ) ) );
-		if ( mFlip )
-			cv::flip( input, input, 1 );
+	updateTrackerParams();
 
-		cv::Mat blurred, thresholded;
+	// the latest frame of the tracker thread, its events were posted before
+	// it, so they are all drained below
+	TrackerFrameRef frame;
+	{
+		std::lock_guard< std::mutex > lock( mTrackerMutex );
+		frame.swap( mLatestFrame );
+	}
 
-		cv::blur( input, blurred, cv::Size( mBlurSize, mBlurSize ) );
-		cv::threshold( blurred, thresholded, mThreshold, 255, CV_THRESH_BINARY );
+	// events posted by the tracker thread since the last update, the
+	// callbacks are called here on the main thread in their order
+	TrackerMessage msg;
+	while ( mMessages.pop( msg ) )
+	{
+		switch ( msg.type )
+		{
+			case TrackerMessage::BLOB_BEGAN:
+				mBlobsBeganSig( BlobEvent( msg.blob ) );
+				break;
 
-		mTextureOrig = gl::Texture( fromOcv( input ) );
-		mTextureBlurred = gl::Texture( fromOcv( blurred ) );
-		mTextureThresholded = gl::Texture( fromOcv( thresholded ) );
+			case TrackerMessage::BLOB_MOVED:
+				mBlobsMovedSig( BlobEvent( msg.blob ) );
+				break;
 
-		vector< vector< cv::Point > > contours;
-		cv::findContours( thresholded, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE );
+			case TrackerMessage::BLOB_ENDED:
+				mBlobsEndedSig( BlobEvent( msg.blob ) );
+				break;
+		}
+	}
 
-		float surfArea = inputSurface.getWidth() * inputSurface.getHeight();
-		float minAreaLimit = surfArea * mMinArea;
-		float maxAreaLimit = surfArea * mMaxArea;
+	if ( frame )
+	{
+		if ( mSavingVideo )
+			mMovieWriter.addFrame( frame->input );
+		mBlobs = frame->blobs;
 
-		vector< BlobRef > newBlobs;
-		for ( vector< vector< cv::Point > >::iterator cit = contours.begin(); cit < contours.end(); ++cit )
+		if ( mDrawCapture != DRAW_NONE )
 		{
-			BlobRef b = BlobRef( new Blob() );
-			cv::Mat pmat = cv::Mat( *cit );
-			cv::Rect cvRect = cv::boundingRect( pmat );
-			b->mBbox = Rectf( cvRect.x, cvRect.y,
-							cvRect.x + cvRect.width, cvRect.y + cvRect.height );
-			float area = b->mBbox.calcArea();
-			if ( ( minAreaLimit <= area ) && ( area < maxAreaLimit ) )
-			{
-				cv::Moments m = cv::moments( pmat );
-				b->mCentroid = Vec2f( m.m10 / m.m00, m.m01 / m.m00 );
-
-				b->mBbox = mNormMapping.map( b->mBbox );
-				b->mCentroid = b->mPrevCentroid = mNormMapping.map( b->mCentroid );
-
-				cv::RotatedRect cvRotRect = cv::fitEllipse( pmat );
-				Vec2f center( fromOcv( cvRotRect.center ) );
-				Vec2f size( cvRotRect.size.width, cvRotRect.size.height );
-				b->mRotatedRect = mNormMapping.map( Rectf( center - size * .5f, center + size * .5f ) );
-				b->mAngle = cvRotRect.angle;
-
-				newBlobs.push_back( b );
-			}
+			mTextureOrig = gl::Texture( fromOcv( frame->orig ) );
+			mTextureBlurred = gl::Texture( fromOcv( frame->blurred ) );
+			mTextureThresholded = gl::Texture( fromOcv( frame->thresholded ) );
 		}
-
-		trackBlobs( newBlobs );
 	}
 
 	// change gui buttons if switched between capture and playback
@@ -250,220 +216,245 @@ void NIBlobTracker::update()
 		setupGui();
 		lastSource = mSource;
 	}
-
 }
 
-void NIBlobTracker::trackBlobs( vector< BlobRef > newBlobs )
+void NIBlobTracker::updateTrackerParams()
 {
-	// all new blob id's initialized with -1
+	std::lock_guard< std::mutex > lock( mTrackerMutex );
+	mTrackerParams.camera = ( mSource == SOURCE_CAMERA );
+	mTrackerParams.flip = mFlip;
+	mTrackerParams.threshold = mThreshold;
+	mTrackerParams.blurSize = mBlurSize;
+	mTrackerParams.minArea = mMinArea;
+	mTrackerParams.maxArea = mMaxArea;
+	mTrackerParams.maxDistance = mMaxDistance;
+}
 
-	// step 1: match new blobs with existing nearest ones
-	for ( size_t i = 0; i < mBlobs.size(); i++ )
+void NIBlobTracker::trackerThreadFn()
+{
+	while ( true )
 	{
-		int32_t winner = findClosestBlobKnn( newBlobs, mBlobs[ i ], 3, 0 );
-
-		if ( winner == -1 ) // track has died
+		TrackerParams params;
+		// TODO: make this work with Surface16u
+		Surface8u inputSurface;
 		{
-			mBlobsEndedSig( BlobEvent( mBlobs[ i ] ) );
-			mBlobs[ i ]->mId = -1; // marked for deletion
+			std::lock_guard< std::mutex > lock( mTrackerMutex );
+			if ( mQuit )
+				return;
+
+			params = mTrackerParams;
+			if ( mMovieFrameWaiting )
+			{
+				if ( !params.camera )
+					inputSurface = mMovieFrame;
+				mMovieFrame = Surface8u();
+				mMovieFrameWaiting = false;
+			}
 		}
-		else
+
+		if ( params.camera )
 		{
-			// if winning new blob was labeled winner by another track
-			// then compare with this track to see which is closer
-			if ( newBlobs[ winner ]->mId != -1 )
+			std::lock_guard< std::mutex > lock( mKinectMutex );
+			if ( mNI && mNI.checkNewDepthFrame() )
 			{
-				// find the currently assigned blob
-				int j; // j will be the index of it
-				for ( j = 0; j < mBlobs.size(); j++ )
-				{
-					if ( mBlobs[ j ]->mId == newBlobs[ winner ]->mId )
-						break;
-				}
+				inputSurface = mNI.getDepthImage();
 
-				if ( j == mBlobs.size() ) // got to end without finding it
-				{
-					newBlobs[ winner ]->mId = mBlobs[ i ]->mId;
-					mBlobs[ i ] = newBlobs[ winner ];
-				}
-				else // found it, compare with current blob
+				Surface::Iter iter = inputSurface.getIter();
+				while ( iter.line() )
 				{
-					Vec2f p = newBlobs[ winner ]->mCentroid;
-					Vec2f pOld = mBlobs[ j ]->mCentroid;
-					Vec2f pNew = mBlobs[ i ]->mCentroid;
-					float distOld = p.distanceSquared( pOld );
-					float distNew = p.distanceSquared( pNew );
-
-					// if this track is closer, update the Id of the blob
-					// otherwise delete this track.. it's dead
-					if ( distNew < distOld ) // update
-					{
-						newBlobs[ winner ]->mId = mBlobs[ i ]->mId;
-						/* TODO
-						   now the old winning blob has lost the win.
-						   I should also probably go through all the newBlobs
-						   at the end of this loop and if there are ones without
-						   any winning matches, check if they are close to this
-						   one. Right now I'm not doing that to prevent a
-						   recursive mess. It'll just be a new track.
-						 */
-						mBlobsEndedSig( BlobEvent( mBlobs[ j ] ) );
-						// mark the blob for deletion
-						mBlobs[ j ]->mId = -1;
-					}
-					else // delete
+					while( iter.pixel() )
 					{
-						mBlobsEndedSig( BlobEvent( mBlobs[ i ] ) );
-						// mark the blob for deletion
-						mBlobs[ i ]->mId = -1;
+						// leave self-shadow pixels and invert the rest
+						if ( iter.r() != 0 )
+						{
+							iter.r() = 255 - iter.r();
+							iter.g() = 255 - iter.g();
+							iter.b() = 255 - iter.b();
+						}
 					}
 				}
 			}
-			else // no conflicts, so simply update
+		}
+
+		if ( inputSurface )
+		{
+			// an exception would end the thread and the app, the frame is
+			// skipped instead
+			try
 			{
-				newBlobs[ winner ]->mId = mBlobs[ i ]->mId;
+				processFrame( inputSurface, params );
+			}
+			catch ( const cv::Exception &exc )
+			{
+				app::console() << "Tracker frame skipped: " << exc.what() << endl;
 			}
 		}
+		else
+		{
+			// the kinect is polled, movie frames wake the thread up
+			std::unique_lock< std::mutex > lock( mTrackerMutex );
+			mTrackerCond.wait_for( lock, std::chrono::milliseconds( 2 ),
+					[ this ]() { return mQuit || mMovieFrameWaiting; } );
+		}
 	}
+}
 
-	// step 2: blob update
-	//
-	// update all current tracks
-	// remove every track labeled as dead, id = -1
-	// find every track that's alive and copy its data from newBlobs
-	for ( size_t i = 0; i < mBlobs.size(); i++ )
+void NIBlobTracker::processFrame( Surface8u inputSurface, const TrackerParams &params )
+{
+	TrackerFrameRef frame( new TrackerFrame() );
+	frame->input = inputSurface;
+
+	// opencv
+	cv::Mat input( toOcv( Channel8u( inputSurface ) ) );
+	if ( params.flip )
+		cv::flip( input, input, 1 );
+
+	cv::Mat blurred;
+
+	cv::blur( input, blurred, cv::Size( params.blurSize, params.blurSize ) );
+	// thresholding and blob labelling in a single pass, the blob
+	// properties are summed without tracing contours
+	mBlobExtractor->process( blurred, params.threshold );
+
+	frame->orig = input;
+	frame->blurred = blurred;
+	// the extractor reuses its mask for the next frame
+	frame->thresholded = mBlobExtractor->getThresholded().clone();
+
+	// normalized camera or movie coordinates mapping
+	RectMapping normMapping( Rectf( 0.0f, 0.0f, (float)inputSurface.getWidth(), (float)inputSurface.getHeight() ),
+			Rectf( 0.0f, 0.0f, 1.0f, 1.0f ) );
+
+	float surfArea = inputSurface.getWidth() * inputSurface.getHeight();
+	float minAreaLimit = surfArea * params.minArea;
+	float maxAreaLimit = surfArea * params.maxArea;
+
+	const vector< BlobExtractor::Component > &components = mBlobExtractor->getComponents();
+	vector< BlobRef > newBlobs;
+	vector< cv::Point > contour;
+	for ( size_t i = 0; i < components.size(); i++ )
 	{
-		if ( mBlobs[ i ]->mId == -1 ) // dead
-		{
-			// erase track
-			mBlobs.erase( mBlobs.begin() + i, mBlobs.begin() + i + 1 );
-			i--; // decrement one since we removed an element
-		}
-		else // living, so update its data
+		const BlobExtractor::Component &c = components[ i ];
+		BlobRef b = BlobRef( new Blob() );
+		b->mBbox = Rectf( c.bbox.x, c.bbox.y,
+						c.bbox.x + c.bbox.width, c.bbox.y + c.bbox.height );
+		float area = b->mBbox.calcArea();
+		if ( ( minAreaLimit <= area ) && ( area < maxAreaLimit ) )
 		{
-			for ( int j = 0; j < newBlobs.size(); j++ )
-			{
-				if ( mBlobs[ i ]->mId == newBlobs[ j ]->mId )
-				{
-					// update track
-					// store the last centroid
-					newBlobs[ j ]->mPrevCentroid = mBlobs[ i ]->mCentroid;
-					mBlobs[ i ] = newBlobs[ j ];
-
-					Vec2f tD = mBlobs[ i ]->mCentroid - mBlobs[ i ]->mPrevCentroid;
+			b->mCentroid = fromOcv( c.centroid );
 
-					// calculate the acceleration
-					float posDelta = tD.length();
-					if ( posDelta > 0.001 )
-					{
-						mBlobsMovedSig( BlobEvent( mBlobs[ i ] ) );
-					}
+			b->mBbox = normMapping.map( b->mBbox );
+			b->mCentroid = b->mPrevCentroid = normMapping.map( b->mCentroid );
 
-					// TODO: add other blob features
-				}
+			// the contour is only traced for the blobs kept
+			mBlobExtractor->getContour( i, contour );
+			// fitEllipse needs at least 5 points, small blobs keep their box
+			if ( contour.size() >= 5 )
+			{
+				cv::RotatedRect cvRotRect = cv::fitEllipse( cv::Mat( contour ) );
+				Vec2f center( fromOcv( cvRotRect.center ) );
+				Vec2f size( cvRotRect.size.width, cvRotRect.size.height );
+				b->mRotatedRect = normMapping.map( Rectf( center - size * .5f, center + size * .5f ) );
+				b->mAngle = cvRotRect.angle;
 			}
+			else
+			{
+				b->mRotatedRect = b->mBbox;
+				b->mAngle = 0.f;
+			}
+
+			newBlobs.push_back( b );
 		}
 	}
 
-	// step 3: add tracked blobs to touchevents
-	// -- add new living tracks
-	// now every new blob should be either labeled with a tracked id or
-	// have id of -1. if the id is -1, we need to make a new track.
-	for ( size_t i = 0; i < newBlobs.size(); i++ )
-	{
-		if ( newBlobs[ i ]->mId == -1 )
-		{
-			// add new track
-			newBlobs[ i ]->mId = mIdCounter;
-			mIdCounter++;
+	trackBlobs( newBlobs, params.maxDistance );
 
-			mBlobs.push_back( newBlobs[ i ] );
-
-			mBlobsBeganSig( BlobEvent( newBlobs[ i ] ) );
-		}
+	// only the latest frame is kept for the main thread, the images are
+	// not queued, a frame not taken yet is released outside the lock
+	frame->blobs = mTracks;
+	{
+		std::lock_guard< std::mutex > lock( mTrackerMutex );
+		mLatestFrame.swap( frame );
 	}
 }
 
-/** Finds the blob in newBlobs that is closest to the blob \a track.
- * \param newBlobs list of blobs detected in the last frame
- * \param track current blob
- * \param k number of nearest neighbours, must be odd number (1, 3, 5 are common)
- * \param thres optimization threshold
- * Returns the closest blob id if found or -1
- */
-int32_t NIBlobTracker::findClosestBlobKnn( const vector< BlobRef > &newBlobs, BlobRef track,
-		int k, double thresh )
+void NIBlobTracker::postMessage( const TrackerMessage &msg )
 {
-	int32_t winner = -1;
-	if ( thresh > 0. )
-		thresh *= thresh;
-
-	// list of neighbour point index and respective distances
-	list< pair< size_t, double > > nbors;
-	list< pair< size_t, double > >::iterator iter;
-
-	// find 'k' closest neighbors of testpoint
-	Vec2f p;
-	Vec2f pT = track->mCentroid;
-	float distSquared;
-
-	// search for blobs
-	for ( size_t i = 0; i < newBlobs.size(); i++ )
+	// the queue is drained every frame, it only fills up if the main
+	// thread stalls, events are not dropped but wait for the space
+	while ( !mMessages.push( msg ) )
 	{
-		p = newBlobs[ i ]->mCentroid;
-		distSquared = p.distanceSquared( pT );
-
-		if ( distSquared <= thresh )
 		{
-			winner = i;
-			return winner;
+			std::lock_guard< std::mutex > lock( mTrackerMutex );
+			if ( mQuit )
+				return;
 		}
+		this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+}
 
-		// check if this blob is closer to the point than what we've seen
-		// so far and add it to the index/distance list if positive
+void NIBlobTracker::trackBlobs( vector< BlobRef > newBlobs, float maxDistance )
+{
+	// all new blob id's initialized with -1
 
-		// search the list for the first point with a longer distance
-		for ( iter = nbors.begin();
-				iter != nbors.end() && distSquared >= iter->second; ++iter );
+	// step 1: optimal assignment of the new blobs to the tracks within
+	// the max distance, tracks are compared at the position predicted
+	// from their last movement, which keeps the ids of crossing blobs
+	mTrackPositions.resize( mTracks.size() );
+	for ( size_t i = 0; i < mTracks.size(); i++ )
+		mTrackPositions[ i ] = toOcv( mTracks[ i ]->mCentroid * 2.f - mTracks[ i ]->mPrevCentroid );
+	mBlobPositions.resize( newBlobs.size() );
+	for ( size_t i = 0; i < newBlobs.size(); i++ )
+		mBlobPositions[ i ] = toOcv( newBlobs[ i ]->mCentroid );
+	mBlobMatcher->match( mTrackPositions, mBlobPositions, maxDistance, mAssignment );
+
+	// step 2: tracks without a blob have died
+	for ( size_t i = 0; i < mTracks.size(); i++ )
+	{
+		if ( mAssignment[ i ] == -1 )
+			postMessage( TrackerMessage( TrackerMessage::BLOB_ENDED, mTracks[ i ] ) );
+	}
 
-		if ( ( iter != nbors.end() ) || ( nbors.size() < k ) )
+	// step 3: blob update
+	//
+	// living tracks continue with the data of their new blob
+	vector< BlobRef > tracks;
+	for ( size_t i = 0; i < mTracks.size(); i++ )
+	{
+		int32_t j = mAssignment[ i ];
+		if ( j == -1 )
+			continue;
+
+		newBlobs[ j ]->mId = mTracks[ i ]->mId;
+		// store the last centroid
+		newBlobs[ j ]->mPrevCentroid = mTracks[ i ]->mCentroid;
+		tracks.push_back( newBlobs[ j ] );
+
+		Vec2f tD = newBlobs[ j ]->mCentroid - newBlobs[ j ]->mPrevCentroid;
+		float posDelta = tD.length();
+		if ( posDelta > 0.001 )
 		{
-			nbors.insert( iter, 1, std::pair< size_t, double >( i, distSquared ));
-			// too many items in list, get rid of farthest neighbor
-			if ( nbors.size() > k )
-				nbors.pop_back();
+			postMessage( TrackerMessage( TrackerMessage::BLOB_MOVED, newBlobs[ j ] ) );
 		}
 	}
+	mTracks.swap( tracks );
 
-
-	/********************************************************************
-	 * we now have k nearest neighbors who cast a vote, and the majority
-	 * wins. we use each class average distance to the target to break any
-	 * possible ties.
-	 *********************************************************************/
-
-	// a mapping from labels (IDs) to count/distance
-	map< int32_t, pair< size_t, double > > votes;
-
-	// remember:
-	// iter->first = index of newBlob
-	// iter->second = distance of newBlob to current tracked blob
-	for ( iter = nbors.begin(); iter != nbors.end(); ++iter )
+	// step 4: add new living tracks
+	// now every new blob should be either labeled with a tracked id or
+	// have id of -1. if the id is -1, we need to make a new track.
+	for ( size_t i = 0; i < newBlobs.size(); i++ )
 	{
-		// add up how many counts each neighbor got
-		size_t count = ++( votes[ iter->first ].first );
-		double dist = ( votes[ iter->first ].second += iter->second );
-
-		// check for a possible tie and break with distance
-		if ( ( count > votes[ winner ].first ) ||
-				( ( count == votes[ winner ].first ) &&
-				  ( dist < votes[ winner ].second ) ) )
+		if ( newBlobs[ i ]->mId == -1 )
 		{
-			winner = iter->first;
+			// add new track
+			newBlobs[ i ]->mId = mIdCounter;
+			mIdCounter++;
+
+			mTracks.push_back( newBlobs[ i ] );
+
+			postMessage( TrackerMessage( TrackerMessage::BLOB_BEGAN, newBlobs[ i ] ) );
 		}
 	}
-
-	return winner;
 }
 
 size_t NIBlobTracker::getBlobNum() const
@@ -616,6 +607,14 @@ void NIBlobTracker::saveVideoCB()
 
 void NIBlobTracker::shutdown()
 {
+	{
+		std::lock_guard< std::mutex > lock( mTrackerMutex );
+		mQuit = true;
+	}
+	mTrackerCond.notify_one();
+	if ( mTrackerThread.joinable() )
+		mTrackerThread.join();
+
 	mKinectThread.join();
 
 	if ( mNI )
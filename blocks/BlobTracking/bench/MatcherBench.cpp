@@ -0,0 +1,303 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// headless benchmark of the blob to track assignment. simulated dancers
+// walk and cross each other in the unit square, the detected blobs are
+// their noisy positions in shuffled order. compares the k nearest
+// neighbour matcher NIBlobTracker used with BlobMatcher, and BlobMatcher
+// with a gate covering the whole square, which leaves a single dense
+// problem. reports the matching time per frame and the identity switches,
+// frames where the track of a dancer changed.
+//
+// build from the blocks/BlobTracking directory:
+// c++ -std=c++11 -O3 -Iinclude bench/MatcherBench.cpp src/BlobMatcher.cpp
+//     -lopencv_core -o matcherbench
+//
+// usage: matcherbench [frames] [gate] [blobs...]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <vector>
+
+#include "BlobMatcher.h"
+
+using namespace mndl;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+enum Method { METHOD_KNN = 0, METHOD_MATCHER, METHOD_DENSE, METHOD_COUNT };
+static const char *methodNames[ METHOD_COUNT ] = { "knn", "matcher", "dense" };
+
+struct Track
+{
+	int id;
+	cv::Point2f pos;
+	cv::Point2f prevPos;
+};
+
+static unsigned sSeed = 1;
+
+static float randFloat()
+{
+	sSeed = sSeed * 1664525u + 1013904223u;
+	return ( sSeed >> 8 ) / 16777216.f;
+}
+
+// dancers bouncing off the walls, the detections are shuffled with the
+// index of their dancer
+static void simulate( int numBlobs, int frames, std::vector< std::vector< cv::Point2f > > &detections,
+		std::vector< std::vector< int > > &dancers )
+{
+	sSeed = 1;
+	std::vector< cv::Point2f > pos( numBlobs ), vel( numBlobs );
+	for ( int i = 0; i < numBlobs; i++ )
+	{
+		pos[ i ] = cv::Point2f( randFloat(), randFloat() );
+		float a = randFloat() * 6.2831853f;
+		float s = .003f + .01f * randFloat();
+		vel[ i ] = cv::Point2f( s * std::cos( a ), s * std::sin( a ) );
+	}
+
+	detections.resize( frames );
+	dancers.resize( frames );
+	for ( int f = 0; f < frames; f++ )
+	{
+		std::vector< int > order( numBlobs );
+		for ( int i = 0; i < numBlobs; i++ )
+		{
+			order[ i ] = i;
+			// slow turns
+			float a = ( randFloat() - .5f ) * .1f;
+			float c = std::cos( a ), s = std::sin( a );
+			vel[ i ] = cv::Point2f( c * vel[ i ].x - s * vel[ i ].y, s * vel[ i ].x + c * vel[ i ].y );
+			pos[ i ] += vel[ i ];
+			if ( ( pos[ i ].x < 0.f ) || ( pos[ i ].x > 1.f ) )
+				vel[ i ].x = -vel[ i ].x;
+			if ( ( pos[ i ].y < 0.f ) || ( pos[ i ].y > 1.f ) )
+				vel[ i ].y = -vel[ i ].y;
+		}
+		for ( int i = numBlobs - 1; i > 0; i-- )
+			std::swap( order[ i ], order[ (int)( randFloat() * ( i + 1 ) ) % ( i + 1 ) ] );
+
+		for ( int i = 0; i < numBlobs; i++ )
+		{
+			int d = order[ i ];
+			detections[ f ].push_back( pos[ d ] + cv::Point2f( ( randFloat() - .5f ) * .002f,
+						( randFloat() - .5f ) * .002f ) );
+			dancers[ f ].push_back( d );
+		}
+	}
+}
+
+static float distanceSquared( const cv::Point2f &a, const cv::Point2f &b )
+{
+	cv::Point2f d = a - b;
+	return d.x * d.x + d.y * d.y;
+}
+
+// the k nearest neighbour vote of NIBlobTracker::findClosestBlobKnn
+static int findClosestBlobKnn( const std::vector< cv::Point2f > &newBlobs, const cv::Point2f &track, size_t k )
+{
+	int winner = -1;
+	std::list< std::pair< size_t, double > > nbors;
+	std::list< std::pair< size_t, double > >::iterator iter;
+	for ( size_t i = 0; i < newBlobs.size(); i++ )
+	{
+		float distSquared = distanceSquared( newBlobs[ i ], track );
+		for ( iter = nbors.begin(); iter != nbors.end() && distSquared >= iter->second; ++iter );
+		if ( ( iter != nbors.end() ) || ( nbors.size() < k ) )
+		{
+			nbors.insert( iter, 1, std::pair< size_t, double >( i, distSquared ) );
+			if ( nbors.size() > k )
+				nbors.pop_back();
+		}
+	}
+
+	std::map< int, std::pair< size_t, double > > votes;
+	for ( iter = nbors.begin(); iter != nbors.end(); ++iter )
+	{
+		size_t count = ++( votes[ iter->first ].first );
+		double dist = ( votes[ iter->first ].second += iter->second );
+		if ( ( count > votes[ winner ].first ) ||
+			 ( ( count == votes[ winner ].first ) && ( dist < votes[ winner ].second ) ) )
+			winner = iter->first;
+	}
+	return winner;
+}
+
+// the matching steps of the former NIBlobTracker::trackBlobs
+static void trackKnn( std::vector< Track > &tracks, const std::vector< cv::Point2f > &blobs, std::vector< int > &ids )
+{
+	ids.assign( blobs.size(), -1 );
+	for ( size_t i = 0; i < tracks.size(); i++ )
+	{
+		int winner = findClosestBlobKnn( blobs, tracks[ i ].pos, 3 );
+		if ( winner == -1 )
+		{
+			tracks[ i ].id = -1;
+		}
+		else
+		if ( ids[ winner ] != -1 )
+		{
+			size_t j;
+			for ( j = 0; j < tracks.size(); j++ )
+			{
+				if ( tracks[ j ].id == ids[ winner ] )
+					break;
+			}
+			if ( j == tracks.size() )
+			{
+				ids[ winner ] = tracks[ i ].id;
+			}
+			else
+			if ( distanceSquared( blobs[ winner ], tracks[ i ].pos ) <
+					distanceSquared( blobs[ winner ], tracks[ j ].pos ) )
+			{
+				ids[ winner ] = tracks[ i ].id;
+				tracks[ j ].id = -1;
+			}
+			else
+			{
+				tracks[ i ].id = -1;
+			}
+		}
+		else
+		{
+			ids[ winner ] = tracks[ i ].id;
+		}
+	}
+}
+
+// the assignment with constant velocity prediction
+static void trackMatcher( BlobMatcherRef matcher, float gate, std::vector< Track > &tracks,
+		const std::vector< cv::Point2f > &blobs, std::vector< int > &ids )
+{
+	static std::vector< cv::Point2f > predicted;
+	static std::vector< int > assignment;
+	predicted.resize( tracks.size() );
+	for ( size_t i = 0; i < tracks.size(); i++ )
+		predicted[ i ] = tracks[ i ].pos * 2.f - tracks[ i ].prevPos;
+	matcher->match( predicted, blobs, gate, assignment );
+
+	ids.assign( blobs.size(), -1 );
+	for ( size_t i = 0; i < tracks.size(); i++ )
+	{
+		if ( assignment[ i ] >= 0 )
+			ids[ assignment[ i ] ] = tracks[ i ].id;
+	}
+}
+
+static void run( Method method, int numBlobs, float gate, const std::vector< std::vector< cv::Point2f > > &detections,
+		const std::vector< std::vector< int > > &dancers )
+{
+	BlobMatcherRef matcher = BlobMatcher::create();
+	std::vector< Track > tracks;
+	std::vector< int > ids;
+	std::vector< int > dancerTrack( numBlobs, -1 );
+	std::vector< double > times;
+	int idCounter = 1;
+	int switches = 0;
+	size_t candidates = 0;
+
+	for ( size_t f = 0; f < detections.size(); f++ )
+	{
+		const std::vector< cv::Point2f > &blobs = detections[ f ];
+
+		Clock::time_point start = Clock::now();
+		if ( method == METHOD_KNN )
+			trackKnn( tracks, blobs, ids );
+		else
+			trackMatcher( matcher, ( method == METHOD_DENSE ) ? 2.f : gate, tracks, blobs, ids );
+		times.push_back( std::chrono::duration< double, std::micro >( Clock::now() - start ).count() );
+		candidates += matcher->getNumCandidates();
+
+		// tracks continue with their blob, unmatched blobs start new tracks
+		std::vector< Track > next;
+		for ( size_t i = 0; i < tracks.size(); i++ )
+		{
+			if ( tracks[ i ].id == -1 )
+				continue;
+			for ( size_t j = 0; j < blobs.size(); j++ )
+			{
+				if ( ids[ j ] == tracks[ i ].id )
+				{
+					Track t = { ids[ j ], blobs[ j ], tracks[ i ].pos };
+					next.push_back( t );
+				}
+			}
+		}
+		for ( size_t j = 0; j < blobs.size(); j++ )
+		{
+			if ( ids[ j ] == -1 )
+			{
+				ids[ j ] = idCounter++;
+				Track t = { ids[ j ], blobs[ j ], blobs[ j ] };
+				next.push_back( t );
+			}
+		}
+		tracks.swap( next );
+
+		for ( size_t j = 0; j < blobs.size(); j++ )
+		{
+			int d = dancers[ f ][ j ];
+			if ( ( f > 0 ) && ( dancerTrack[ d ] != ids[ j ] ) )
+				switches++;
+			dancerTrack[ d ] = ids[ j ];
+		}
+	}
+
+	std::sort( times.begin(), times.end() );
+	double mean = 0.;
+	for ( size_t i = 0; i < times.size(); i++ )
+		mean += times[ i ];
+	mean /= times.size();
+	printf( "%-8s %6d %10.1f %10.1f %10.1f %10d\n", methodNames[ method ], numBlobs, mean,
+			times[ times.size() * 99 / 100 ], (double)candidates / detections.size(), switches );
+}
+
+int main( int argc, char **argv )
+{
+	int frames = ( argc > 1 ) ? atoi( argv[ 1 ] ) : 600;
+	float gate = ( argc > 2 ) ? (float)atof( argv[ 2 ] ) : .05f;
+	std::vector< int > blobCounts;
+	for ( int i = 3; i < argc; i++ )
+		blobCounts.push_back( atoi( argv[ i ] ) );
+	if ( blobCounts.empty() )
+	{
+		blobCounts.push_back( 10 );
+		blobCounts.push_back( 50 );
+		blobCounts.push_back( 200 );
+	}
+
+	printf( "%d frames, gate %.3f, times in microseconds\n", frames, gate );
+	printf( "%-8s %6s %10s %10s %10s %10s\n", "method", "blobs", "mean", "p99", "pairs", "switches" );
+	for ( size_t b = 0; b < blobCounts.size(); b++ )
+	{
+		std::vector< std::vector< cv::Point2f > > detections;
+		std::vector< std::vector< int > > dancers;
+		simulate( blobCounts[ b ], frames, detections, dancers );
+		for ( int m = 0; m < METHOD_COUNT; m++ )
+			run( Method( m ), blobCounts[ b ], gate, detections, dancers );
+	}
+
+	return 0;
+}
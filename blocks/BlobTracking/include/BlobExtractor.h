@@ -0,0 +1,103 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+namespace mndl {
+
+typedef std::shared_ptr< class BlobExtractor > BlobExtractorRef;
+
+//! Thresholds a grey image and labels its blobs in a single pass.
+/*! The pixels above the threshold are collected into horizontal runs while
+	the image is thresholded, and the runs touching each other are joined
+	into 8-connected components with union-find. The area, bounding box,
+	centroid and second moments of the components are summed from the runs,
+	so no contours are traced unless asked for. The background gaps between
+	the runs are joined into 4-connected regions the same way, and the
+	components lying in a hole of another one are dropped, like with the
+	external contours of findContours. */
+class BlobExtractor
+{
+	public:
+		static BlobExtractorRef create() { return BlobExtractorRef( new BlobExtractor() ); }
+
+		//! 8-connected component of the thresholded image.
+		struct Component
+		{
+			int area;				//!< number of pixels
+			cv::Rect bbox;			//!< bounding box in pixels
+			cv::Point2f centroid;	//!< mean pixel position
+			float mu20, mu11, mu02;	//!< central second moments divided by the area
+		};
+
+		//! Labels the pixels of the single channel 8-bit \a image above \a threshold.
+		/*! The components are listed in the raster order of their first pixel.
+			Components inside the holes of others are not listed. */
+		void process( const cv::Mat &image, int threshold );
+
+		const std::vector< Component > & getComponents() const { return mComponents; }
+		//! The thresholded image of the last process() call, 255 above the threshold, 0 elsewhere.
+		const cv::Mat & getThresholded() const { return mThresholded; }
+
+		//! Traces the outer contour of component \a i into \a contour.
+		/*! The points are in image coordinates, with the straight segments
+			compressed like CV_CHAIN_APPROX_SIMPLE. */
+		void getContour( size_t i, std::vector< cv::Point > &contour );
+
+	private:
+		BlobExtractor() {}
+		BlobExtractor( const BlobExtractor & );
+		BlobExtractor & operator=( const BlobExtractor & );
+
+		struct Run
+		{
+			int y;
+			int x0, x1;	//!< pixel range, x1 is exclusive
+			int label;	//!< union-find parent while labelling, then the component index, -1 if dropped
+		};
+
+		static void addRun( std::vector< Run > &runs, int y, int x0, int x1 );
+		//! Joins the runs of two rows, \a slack 0 joins diagonal neighbours, 1 only overlapping runs.
+		static void linkRows( std::vector< Run > &runs, int prevBegin, int begin, int end, int slack );
+		static int findRoot( std::vector< Run > &runs, int r );
+
+		void labelGaps( int width, int height );
+		void dropNested( int width, int height );
+
+		cv::Mat mThresholded;
+		std::vector< Run > mRuns;
+		std::vector< int > mRowStart;	//!< first run of every row, and the end of the runs
+		std::vector< Component > mComponents;
+		std::vector< double > mSums;	//!< x, y, xx, xy, yy pixel sums of the components
+		std::vector< int > mLeftRuns;	//!< leftmost run of the components
+
+		std::vector< Run > mGaps;		//!< background runs between the runs
+		std::vector< int > mLeftGaps;	//!< gap left of every run, -1 at the image border
+		std::vector< char > mOutside;	//!< gap roots connected to the image border
+
+		cv::Mat mContourMask;
+		std::vector< std::vector< cv::Point > > mContours;
+};
+
+} // namespace mndl
@@ -0,0 +1,90 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+namespace mndl {
+
+typedef std::shared_ptr< class BlobMatcher > BlobMatcherRef;
+
+//! Optimal assignment of blobs to tracks.
+/*! Pairs farther than the gate distance are never matched. The candidate
+	pairs are found with a grid of gate sized cells, and the tracks and
+	blobs linked by candidate pairs are split into independent groups,
+	which are solved with the Hungarian method. The assignment minimizes
+	the sum of the squared distances of the matched pairs plus the squared
+	gate distance for every unmatched track, so a track is only left
+	without a blob if that is cheaper for the whole group. */
+class BlobMatcher
+{
+	public:
+		static BlobMatcherRef create() { return BlobMatcherRef( new BlobMatcher() ); }
+
+		//! Matches the \a blobs to the \a tracks within \a gate distance.
+		/*! \a assignment is resized to the number of tracks and receives the
+			index of the blob matched to every track, or -1. */
+		void match( const std::vector< cv::Point2f > &tracks, const std::vector< cv::Point2f > &blobs,
+				float gate, std::vector< int > &assignment );
+
+		//! Number of candidate pairs within the gate in the last match() call.
+		size_t getNumCandidates() const { return mEdgeBlob.size(); }
+
+	private:
+		BlobMatcher() {}
+		BlobMatcher( const BlobMatcher & );
+		BlobMatcher & operator=( const BlobMatcher & );
+
+		void findCandidates( const std::vector< cv::Point2f > &tracks, const std::vector< cv::Point2f > &blobs,
+				float gate );
+		void solveGroup( const std::vector< int > &groupTracks, const std::vector< int > &groupBlobs,
+				float gate, std::vector< int > &assignment );
+		int findRoot( int n );
+
+		// blobs binned into the grid cells
+		std::vector< int > mCellStart;
+		std::vector< int > mCellBlobs;
+		std::vector< int > mBlobCell;
+
+		// candidate pairs of the tracks, the pairs of track i are in
+		// mEdgeStart[ i ] .. mEdgeStart[ i + 1 ]
+		std::vector< int > mEdgeStart;
+		std::vector< int > mEdgeBlob;
+		std::vector< float > mEdgeCost;
+
+		// groups of tracks and blobs, blobs follow the tracks
+		std::vector< int > mParent;
+		std::vector< int > mGroupStart;
+		std::vector< int > mGroupMembers;
+
+		std::vector< int > mFill;	// insertion positions of the counting sorts
+
+		// dense problem of a group
+		std::vector< int > mGroupTracks;
+		std::vector< int > mGroupBlobs;
+		std::vector< int > mBlobIndex;
+		std::vector< double > mCost;
+		std::vector< double > mU, mV, mMinV;
+		std::vector< int > mMatch, mWay;
+		std::vector< bool > mUsed;
+};
+
+} // namespace mndl
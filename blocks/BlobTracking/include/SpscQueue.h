@@ -0,0 +1,100 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace mndl {
+
+//! Lock-free queue of a single producer and a single consumer thread.
+/*! A ring buffer with a power of two size. The producer only writes the
+	tail and the consumer only writes the head, so neither of them waits
+	for the other. Both keep a copy of the other index and only reload it
+	when the queue seems full or empty. */
+template< typename T >
+class SpscQueue
+{
+	public:
+		//! Creates a queue holding at least \a capacity elements.
+		explicit SpscQueue( size_t capacity = 1024 ) :
+			mHead( 0 ), mCachedTail( 0 ), mTail( 0 ), mCachedHead( 0 )
+		{
+			size_t size = 2;
+			while ( size < capacity + 1 )
+				size *= 2;
+			mBuffer.resize( size );
+			mMask = size - 1;
+		}
+
+		//! Appends \a value, returns false if the queue is full. Called by the producer thread only.
+		bool push( const T &value )
+		{
+			size_t tail = mTail.load( std::memory_order_relaxed );
+			size_t next = ( tail + 1 ) & mMask;
+			if ( next == mCachedHead )
+			{
+				mCachedHead = mHead.load( std::memory_order_acquire );
+				if ( next == mCachedHead )
+					return false;
+			}
+			mBuffer[ tail ] = value;
+			mTail.store( next, std::memory_order_release );
+			return true;
+		}
+
+		//! Removes the oldest element into \a value, returns false if the queue is empty. Called by the consumer thread only.
+		bool pop( T &value )
+		{
+			size_t head = mHead.load( std::memory_order_relaxed );
+			if ( head == mCachedTail )
+			{
+				mCachedTail = mTail.load( std::memory_order_acquire );
+				if ( head == mCachedTail )
+					return false;
+			}
+			value = mBuffer[ head ];
+			// the slot does not keep anything alive until it is reused
+			mBuffer[ head ] = T();
+			mHead.store( ( head + 1 ) & mMask, std::memory_order_release );
+			return true;
+		}
+
+		size_t capacity() const { return mMask; }
+
+	private:
+		SpscQueue( const SpscQueue & );
+		SpscQueue & operator=( const SpscQueue & );
+
+		static const size_t CACHE_LINE = 64;
+
+		std::vector< T > mBuffer;
+		size_t mMask;
+
+		// the indices of the two threads are on separate cache lines
+		char mPad0[ CACHE_LINE ];
+		std::atomic< size_t > mHead;	//!< next element to pop, written by the consumer
+		size_t mCachedTail;				//!< tail seen by the consumer
+		char mPad1[ CACHE_LINE ];
+		std::atomic< size_t > mTail;	//!< next free slot, written by the producer
+		size_t mCachedHead;				//!< head seen by the producer
+		char mPad2[ CACHE_LINE ];
+};
+
+} // namespace mndl
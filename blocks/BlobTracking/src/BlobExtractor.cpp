@@ -0,0 +1,318 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && ( _M_IX86_FP >= 2 ) )
+#define BLOBEXTRACTOR_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "BlobExtractor.h"
+
+namespace mndl {
+
+// sum of the squares of 0..n
+static inline int64_t sumOfSquares( int64_t n )
+{
+	return n * ( n + 1 ) * ( 2 * n + 1 ) / 6;
+}
+
+void BlobExtractor::process( const cv::Mat &image, int threshold )
+{
+	CV_Assert( image.type() == CV_8UC1 );
+
+	const int width = image.cols;
+	const int height = image.rows;
+	const uint8_t thr = (uint8_t)std::max( 0, std::min( threshold, 255 ) );
+
+	mThresholded.create( height, width, CV_8UC1 );
+	mRuns.clear();
+	mRowStart.resize( height + 1 );
+
+#ifdef BLOBEXTRACTOR_SSE2
+	// unsigned comparison by flipping the sign bits
+	const __m128i bias = _mm_set1_epi8( (char)0x80 );
+	const __m128i thrBiased = _mm_set1_epi8( (char)( thr ^ 0x80 ) );
+#endif
+
+	for ( int y = 0; y < height; y++ )
+	{
+		const uint8_t *src = image.ptr< uint8_t >( y );
+		uint8_t *dst = mThresholded.ptr< uint8_t >( y );
+		mRowStart[ y ] = (int)mRuns.size();
+
+		int runStart = -1;
+		int x = 0;
+#ifdef BLOBEXTRACTOR_SSE2
+		for ( ; x + 16 <= width; x += 16 )
+		{
+			__m128i v = _mm_xor_si128( _mm_loadu_si128( (const __m128i *)( src + x ) ), bias );
+			__m128i mask = _mm_cmpgt_epi8( v, thrBiased );
+			_mm_storeu_si128( (__m128i *)( dst + x ), mask );
+
+			// blocks continuing the current state have no run boundary
+			int bits = _mm_movemask_epi8( mask );
+			if ( bits == ( runStart >= 0 ? 0xffff : 0 ) )
+				continue;
+
+			for ( int i = 0; i < 16; i++ )
+			{
+				bool on = ( bits >> i ) & 1;
+				if ( on && ( runStart < 0 ) )
+				{
+					runStart = x + i;
+				}
+				else
+				if ( !on && ( runStart >= 0 ) )
+				{
+					addRun( mRuns, y, runStart, x + i );
+					runStart = -1;
+				}
+			}
+		}
+#endif
+		for ( ; x < width; x++ )
+		{
+			bool on = src[ x ] > thr;
+			dst[ x ] = on ? 255 : 0;
+			if ( on && ( runStart < 0 ) )
+			{
+				runStart = x;
+			}
+			else
+			if ( !on && ( runStart >= 0 ) )
+			{
+				addRun( mRuns, y, runStart, x );
+				runStart = -1;
+			}
+		}
+		if ( runStart >= 0 )
+			addRun( mRuns, y, runStart, width );
+
+		if ( y > 0 )
+			linkRows( mRuns, mRowStart[ y - 1 ], mRowStart[ y ], (int)mRuns.size(), 0 );
+	}
+	mRowStart[ height ] = (int)mRuns.size();
+
+	for ( size_t r = 0; r < mRuns.size(); r++ )
+		mRuns[ r ].label = findRoot( mRuns, (int)r );
+
+	// roots are the first runs of their components, so the components are
+	// created before any of their other runs is summed
+	mComponents.clear();
+	mSums.clear();
+	mLeftRuns.clear();
+	for ( size_t r = 0; r < mRuns.size(); r++ )
+	{
+		Run &run = mRuns[ r ];
+		if ( run.label == (int)r )
+		{
+			Component c;
+			c.area = 0;
+			c.bbox = cv::Rect( run.x0, run.y, 0, 0 );
+			mComponents.push_back( c );
+			mSums.resize( mSums.size() + 5, 0. );
+			mLeftRuns.push_back( (int)r );
+			run.label = (int)mComponents.size() - 1;
+		}
+		else
+		{
+			// the root has its component index already
+			run.label = mRuns[ run.label ].label;
+		}
+
+		Component &c = mComponents[ run.label ];
+		double *s = &mSums[ run.label * 5 ];
+		int64_t n = run.x1 - run.x0;
+		int64_t sx = n * ( run.x0 + run.x1 - 1 ) / 2;
+		int64_t sxx = sumOfSquares( run.x1 - 1 ) - sumOfSquares( run.x0 - 1 );
+		double y = run.y;
+		c.area += (int)n;
+		s[ 0 ] += (double)sx;
+		s[ 1 ] += n * y;
+		s[ 2 ] += (double)sxx;
+		s[ 3 ] += sx * y;
+		s[ 4 ] += n * y * y;
+
+		if ( run.x0 < c.bbox.x )
+			mLeftRuns[ run.label ] = (int)r;
+		int left = std::min( c.bbox.x, run.x0 );
+		int right = std::max( c.bbox.x + c.bbox.width, run.x1 );
+		c.bbox.x = left;
+		c.bbox.width = right - left;
+		c.bbox.height = run.y + 1 - c.bbox.y;
+	}
+
+	for ( size_t i = 0; i < mComponents.size(); i++ )
+	{
+		Component &c = mComponents[ i ];
+		const double *s = &mSums[ i * 5 ];
+		double cx = s[ 0 ] / c.area;
+		double cy = s[ 1 ] / c.area;
+		c.centroid = cv::Point2f( (float)cx, (float)cy );
+		c.mu20 = (float)( s[ 2 ] / c.area - cx * cx );
+		c.mu11 = (float)( s[ 3 ] / c.area - cx * cy );
+		c.mu02 = (float)( s[ 4 ] / c.area - cy * cy );
+	}
+
+	labelGaps( width, height );
+	dropNested( width, height );
+}
+
+void BlobExtractor::labelGaps( int width, int height )
+{
+	// the background between the runs, 4-connected as the complement of
+	// the 8-connected components
+	mGaps.clear();
+	mLeftGaps.resize( mRuns.size() );
+	int prevBegin = 0;
+	for ( int y = 0; y < height; y++ )
+	{
+		int begin = (int)mGaps.size();
+		int x = 0;
+		for ( int r = mRowStart[ y ]; r < mRowStart[ y + 1 ]; r++ )
+		{
+			if ( mRuns[ r ].x0 > x )
+				addRun( mGaps, y, x, mRuns[ r ].x0 );
+			mLeftGaps[ r ] = ( mRuns[ r ].x0 > 0 ) ? (int)mGaps.size() - 1 : -1;
+			x = mRuns[ r ].x1;
+		}
+		if ( x < width )
+			addRun( mGaps, y, x, width );
+
+		if ( y > 0 )
+			linkRows( mGaps, prevBegin, begin, (int)mGaps.size(), 1 );
+		prevBegin = begin;
+	}
+
+	mOutside.assign( mGaps.size(), 0 );
+	for ( size_t g = 0; g < mGaps.size(); g++ )
+	{
+		const Run &gap = mGaps[ g ];
+		if ( ( gap.y == 0 ) || ( gap.y == height - 1 ) || ( gap.x0 == 0 ) || ( gap.x1 == width ) )
+			mOutside[ findRoot( mGaps, (int)g ) ] = 1;
+	}
+}
+
+void BlobExtractor::dropNested( int width, int height )
+{
+	// the background left of the leftmost pixel of a component is either
+	// outside or in the hole of another component that surrounds it, its
+	// own holes always have some of its pixels on the left
+	// the leftmost runs are replaced by the new component indices
+	std::vector< int > &remap = mLeftRuns;
+	size_t n = 0;
+	for ( size_t i = 0; i < mComponents.size(); i++ )
+	{
+		const cv::Rect &bbox = mComponents[ i ].bbox;
+		bool outer = ( bbox.x == 0 ) || ( bbox.y == 0 ) ||
+			( bbox.x + bbox.width == width ) || ( bbox.y + bbox.height == height ) ||
+			mOutside[ findRoot( mGaps, mLeftGaps[ mLeftRuns[ i ] ] ) ];
+		if ( outer )
+		{
+			mComponents[ n ] = mComponents[ i ];
+			remap[ i ] = (int)n++;
+		}
+		else
+		{
+			remap[ i ] = -1;
+		}
+	}
+	if ( n == mComponents.size() )
+		return;
+
+	mComponents.resize( n );
+	for ( size_t r = 0; r < mRuns.size(); r++ )
+		mRuns[ r ].label = remap[ mRuns[ r ].label ];
+}
+
+void BlobExtractor::addRun( std::vector< Run > &runs, int y, int x0, int x1 )
+{
+	Run run;
+	run.y = y;
+	run.x0 = x0;
+	run.x1 = x1;
+	run.label = (int)runs.size();
+	runs.push_back( run );
+}
+
+void BlobExtractor::linkRows( std::vector< Run > &runs, int prevBegin, int begin, int end, int slack )
+{
+	// both rows are sorted, runs touch when they overlap or, without slack,
+	// meet diagonally
+	int p = prevBegin;
+	for ( int r = begin; r < end; r++ )
+	{
+		while ( ( p < begin ) && ( runs[ p ].x1 < runs[ r ].x0 + slack ) )
+			p++;
+		for ( int q = p; ( q < begin ) && ( runs[ q ].x0 <= runs[ r ].x1 - slack ); q++ )
+		{
+			int a = findRoot( runs, q );
+			int b = findRoot( runs, r );
+			// the smaller index becomes the root
+			if ( a < b )
+				runs[ b ].label = a;
+			else
+			if ( b < a )
+				runs[ a ].label = b;
+		}
+	}
+}
+
+int BlobExtractor::findRoot( std::vector< Run > &runs, int r )
+{
+	while ( runs[ r ].label != r )
+	{
+		// path halving
+		runs[ r ].label = runs[ runs[ r ].label ].label;
+		r = runs[ r ].label;
+	}
+	return r;
+}
+
+void BlobExtractor::getContour( size_t i, std::vector< cv::Point > &contour )
+{
+	contour.clear();
+	if ( i >= mComponents.size() )
+		return;
+
+	// the runs of the component are drawn into a mask of the bounding box
+	// with a free border, which findContours needs
+	const cv::Rect &bbox = mComponents[ i ].bbox;
+	mContourMask.create( bbox.height + 2, bbox.width + 2, CV_8UC1 );
+	mContourMask.setTo( cv::Scalar( 0 ) );
+	for ( int y = bbox.y; y < bbox.y + bbox.height; y++ )
+	{
+		uint8_t *dst = mContourMask.ptr< uint8_t >( y - bbox.y + 1 ) + 1 - bbox.x;
+		for ( int r = mRowStart[ y ]; r < mRowStart[ y + 1 ]; r++ )
+		{
+			if ( mRuns[ r ].label == (int)i )
+				std::fill( dst + mRuns[ r ].x0, dst + mRuns[ r ].x1, 255 );
+		}
+	}
+
+	cv::findContours( mContourMask, mContours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE,
+			cv::Point( bbox.x - 1, bbox.y - 1 ) );
+	// a component has a single outer contour
+	if ( !mContours.empty() )
+		contour.swap( mContours[ 0 ] );
+}
+
+} // namespace mndl
@@ -0,0 +1,284 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "BlobMatcher.h"
+
+namespace mndl {
+
+// grids of tiny gates are coarsened to this many cells
+static const int MAX_CELLS = 1 << 16;
+
+void BlobMatcher::match( const std::vector< cv::Point2f > &tracks, const std::vector< cv::Point2f > &blobs,
+		float gate, std::vector< int > &assignment )
+{
+	const int numTracks = (int)tracks.size();
+	const int numBlobs = (int)blobs.size();
+
+	assignment.assign( numTracks, -1 );
+	mEdgeStart.assign( numTracks + 1, 0 );
+	mEdgeBlob.clear();
+	mEdgeCost.clear();
+	if ( ( numTracks == 0 ) || ( numBlobs == 0 ) || !( gate > 0.f ) )
+		return;
+
+	findCandidates( tracks, blobs, gate );
+
+	// tracks and blobs connected by candidate pairs form the groups, the
+	// blobs are numbered after the tracks
+	const int numNodes = numTracks + numBlobs;
+	mParent.resize( numNodes );
+	for ( int n = 0; n < numNodes; n++ )
+		mParent[ n ] = n;
+	for ( int t = 0; t < numTracks; t++ )
+	{
+		for ( int e = mEdgeStart[ t ]; e < mEdgeStart[ t + 1 ]; e++ )
+		{
+			int a = findRoot( t );
+			int b = findRoot( numTracks + mEdgeBlob[ e ] );
+			if ( a != b )
+				mParent[ std::max( a, b ) ] = std::min( a, b );
+		}
+	}
+
+	// members listed by group, tracks before blobs in every group
+	mGroupStart.assign( numNodes + 1, 0 );
+	for ( int n = 0; n < numNodes; n++ )
+		mGroupStart[ findRoot( n ) + 1 ]++;
+	for ( int n = 0; n < numNodes; n++ )
+		mGroupStart[ n + 1 ] += mGroupStart[ n ];
+	mGroupMembers.resize( numNodes );
+	mFill.assign( mGroupStart.begin(), mGroupStart.end() - 1 );
+	for ( int n = 0; n < numNodes; n++ )
+		mGroupMembers[ mFill[ findRoot( n ) ]++ ] = n;
+
+	for ( int g = 0; g < numTracks; g++ )
+	{
+		// only tracks can be roots of groups with candidate pairs
+		int begin = mGroupStart[ g ];
+		int end = mGroupStart[ g + 1 ];
+		if ( end - begin < 2 )
+			continue;
+
+		if ( end - begin == 2 )
+		{
+			// a single pair within the gate
+			assignment[ mGroupMembers[ begin ] ] = mGroupMembers[ begin + 1 ] - numTracks;
+			continue;
+		}
+
+		mGroupTracks.clear();
+		mGroupBlobs.clear();
+		for ( int i = begin; i < end; i++ )
+		{
+			int n = mGroupMembers[ i ];
+			if ( n < numTracks )
+				mGroupTracks.push_back( n );
+			else
+				mGroupBlobs.push_back( n - numTracks );
+		}
+		solveGroup( mGroupTracks, mGroupBlobs, gate, assignment );
+	}
+}
+
+void BlobMatcher::findCandidates( const std::vector< cv::Point2f > &tracks, const std::vector< cv::Point2f > &blobs,
+		float gate )
+{
+	const int numTracks = (int)tracks.size();
+	const int numBlobs = (int)blobs.size();
+
+	// grid of gate sized cells over all points, the candidates of a track
+	// are in the 3x3 cells around it
+	float minX = blobs[ 0 ].x;
+	float minY = blobs[ 0 ].y;
+	float maxX = minX;
+	float maxY = minY;
+	for ( int i = 0; i < numBlobs + numTracks; i++ )
+	{
+		const cv::Point2f &p = ( i < numBlobs ) ? blobs[ i ] : tracks[ i - numBlobs ];
+		minX = std::min( minX, p.x );
+		minY = std::min( minY, p.y );
+		maxX = std::max( maxX, p.x );
+		maxY = std::max( maxY, p.y );
+	}
+
+	float cellSize = gate;
+	float cellsX = ( maxX - minX ) / cellSize + 1.f;
+	float cellsY = ( maxY - minY ) / cellSize + 1.f;
+	if ( cellsX * cellsY > MAX_CELLS )
+	{
+		cellSize *= std::sqrt( cellsX * cellsY / MAX_CELLS ) + 1.f;
+		cellsX = ( maxX - minX ) / cellSize + 1.f;
+		cellsY = ( maxY - minY ) / cellSize + 1.f;
+	}
+	const int cols = (int)cellsX;
+	const int rows = (int)cellsY;
+	const float invCellSize = 1.f / cellSize;
+
+	// counting sort of the blobs by cell
+	mCellStart.assign( cols * rows + 1, 0 );
+	mBlobCell.resize( numBlobs );
+	for ( int b = 0; b < numBlobs; b++ )
+	{
+		int cx = std::min( (int)( ( blobs[ b ].x - minX ) * invCellSize ), cols - 1 );
+		int cy = std::min( (int)( ( blobs[ b ].y - minY ) * invCellSize ), rows - 1 );
+		mBlobCell[ b ] = cy * cols + cx;
+		mCellStart[ mBlobCell[ b ] + 1 ]++;
+	}
+	for ( int c = 0; c < cols * rows; c++ )
+		mCellStart[ c + 1 ] += mCellStart[ c ];
+	mCellBlobs.resize( numBlobs );
+	mFill.assign( mCellStart.begin(), mCellStart.end() - 1 );
+	for ( int b = 0; b < numBlobs; b++ )
+		mCellBlobs[ mFill[ mBlobCell[ b ] ]++ ] = b;
+
+	const float gate2 = gate * gate;
+	for ( int t = 0; t < numTracks; t++ )
+	{
+		const cv::Point2f &p = tracks[ t ];
+		int cx = std::min( (int)( ( p.x - minX ) * invCellSize ), cols - 1 );
+		int cy = std::min( (int)( ( p.y - minY ) * invCellSize ), rows - 1 );
+		for ( int y = std::max( cy - 1, 0 ); y <= std::min( cy + 1, rows - 1 ); y++ )
+		{
+			for ( int x = std::max( cx - 1, 0 ); x <= std::min( cx + 1, cols - 1 ); x++ )
+			{
+				int c = y * cols + x;
+				for ( int i = mCellStart[ c ]; i < mCellStart[ c + 1 ]; i++ )
+				{
+					int b = mCellBlobs[ i ];
+					float dx = blobs[ b ].x - p.x;
+					float dy = blobs[ b ].y - p.y;
+					float d2 = dx * dx + dy * dy;
+					if ( d2 <= gate2 )
+					{
+						mEdgeBlob.push_back( b );
+						mEdgeCost.push_back( d2 );
+					}
+				}
+			}
+		}
+		mEdgeStart[ t + 1 ] = (int)mEdgeBlob.size();
+	}
+}
+
+void BlobMatcher::solveGroup( const std::vector< int > &groupTracks, const std::vector< int > &groupBlobs,
+		float gate, std::vector< int > &assignment )
+{
+	// every track has its own column for staying unmatched at the cost of
+	// the squared gate, pairs out of the gate cost more than leaving all
+	// tracks unmatched, so they are never chosen
+	const int n = (int)groupTracks.size();
+	const int numBlobs = (int)groupBlobs.size();
+	const int m = numBlobs + n;
+	const double gate2 = (double)gate * gate;
+	const double outOfGate = gate2 * ( n + 1 );
+
+	mBlobIndex.resize( mBlobCell.size() );
+	for ( int j = 0; j < numBlobs; j++ )
+		mBlobIndex[ groupBlobs[ j ] ] = j;
+
+	mCost.assign( n * m, outOfGate );
+	for ( int i = 0; i < n; i++ )
+	{
+		double *row = &mCost[ i * m ];
+		int t = groupTracks[ i ];
+		for ( int e = mEdgeStart[ t ]; e < mEdgeStart[ t + 1 ]; e++ )
+			row[ mBlobIndex[ mEdgeBlob[ e ] ] ] = mEdgeCost[ e ];
+		row[ numBlobs + i ] = gate2;
+	}
+
+	// Hungarian method with potentials, rows and columns are 1-based, the
+	// 0th column is the row being added
+	const double inf = std::numeric_limits< double >::max();
+	mU.assign( n + 1, 0. );
+	mV.assign( m + 1, 0. );
+	mMatch.assign( m + 1, 0 );
+	mWay.assign( m + 1, 0 );
+	for ( int i = 1; i <= n; i++ )
+	{
+		mMatch[ 0 ] = i;
+		int j0 = 0;
+		mMinV.assign( m + 1, inf );
+		mUsed.assign( m + 1, false );
+		do
+		{
+			mUsed[ j0 ] = true;
+			int i0 = mMatch[ j0 ];
+			double delta = inf;
+			int j1 = 0;
+			const double *row = &mCost[ ( i0 - 1 ) * m ];
+			for ( int j = 1; j <= m; j++ )
+			{
+				if ( mUsed[ j ] )
+					continue;
+				double cur = row[ j - 1 ] - mU[ i0 ] - mV[ j ];
+				if ( cur < mMinV[ j ] )
+				{
+					mMinV[ j ] = cur;
+					mWay[ j ] = j0;
+				}
+				if ( mMinV[ j ] < delta )
+				{
+					delta = mMinV[ j ];
+					j1 = j;
+				}
+			}
+			for ( int j = 0; j <= m; j++ )
+			{
+				if ( mUsed[ j ] )
+				{
+					mU[ mMatch[ j ] ] += delta;
+					mV[ j ] -= delta;
+				}
+				else
+				{
+					mMinV[ j ] -= delta;
+				}
+			}
+			j0 = j1;
+		} while ( mMatch[ j0 ] != 0 );
+
+		do
+		{
+			int j1 = mWay[ j0 ];
+			mMatch[ j0 ] = mMatch[ j1 ];
+			j0 = j1;
+		} while ( j0 != 0 );
+	}
+
+	for ( int j = 1; j <= numBlobs; j++ )
+	{
+		int i = mMatch[ j ];
+		if ( ( i != 0 ) && ( mCost[ ( i - 1 ) * m + j - 1 ] < outOfGate ) )
+			assignment[ groupTracks[ i - 1 ] ] = groupBlobs[ j - 1 ];
+	}
+}
+
+int BlobMatcher::findRoot( int n )
+{
+	while ( mParent[ n ] != n )
+	{
+		mParent[ n ] = mParent[ mParent[ n ] ];
+		n = mParent[ n ];
+	}
+	return n;
+}
+
+} // namespace mndl
@@ -0,0 +1,180 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// deterministic headless benchmark of the mpm liquid. runs scripted
+// scenes with boundary masks, flow fields and drags, reports the average
+// time of the simulation phases and a checksum of the final state, which
+// has to be the same for any number of threads.
+//
+// build from the blocks/MpmLiquid directory:
+// c++ -std=c++11 -O3 -Iinclude -I../WorkerPool/include bench/LiquidBench.cpp
+//     src/MpmLiquid.cpp ../WorkerPool/src/WorkerPool.cpp -lpthread -o liquidbench
+//
+// usage: liquidbench [frames] [particles] [threads...], 0 threads uses all
+// cores
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "MpmLiquid.h"
+
+using namespace mndl;
+
+static const int GRID_WIDTH = 240;
+static const int GRID_HEIGHT = 180;
+
+enum Scene { SCENE_DAM = 0, SCENE_MASK, SCENE_FLOW, SCENE_DRAG, SCENE_COUNT };
+static const char *sceneNames[ SCENE_COUNT ] = { "dam", "mask", "flow", "drag" };
+
+// block of particles in the middle of the grid, the spacing follows the
+// density like in the apps, the jitter comes from a fixed sequence
+static void resetParticles( MpmLiquidRef liquid )
+{
+	int count = liquid->getMaxParticles();
+	float mul = std::min( 1.f / sqrtf( liquid->getParams().density ), .72f );
+	int pc = (int)sqrtf( count ) + 1;
+	float cx = GRID_WIDTH / 2 - pc * mul / 2;
+	float cy = GRID_HEIGHT * .4f - pc * mul / 2;
+
+	unsigned seed = 1;
+	for ( int n = 0; n < count; n++ )
+	{
+		seed = seed * 1664525u + 1013904223u;
+		float rx = ( seed >> 8 ) / 16777216.f;
+		seed = seed * 1664525u + 1013904223u;
+		float ry = ( seed >> 8 ) / 16777216.f;
+		liquid->setParticle( n, cx + ( n % pc + rx ) * mul, cy + ( n / pc + ry ) * mul );
+	}
+	liquid->setNumParticles( count );
+}
+
+// unit normals pointing into a circular obstacle within a ring around it,
+// the layout of Vec2f[ GRID_WIDTH ][ GRID_HEIGHT ]
+static void circleMask( std::vector< float > &normals, float ox, float oy, float r )
+{
+	normals.assign( GRID_WIDTH * GRID_HEIGHT * 2, 0.f );
+	for ( int x = 0; x < GRID_WIDTH; x++ )
+	{
+		for ( int y = 0; y < GRID_HEIGHT; y++ )
+		{
+			float dx = ox - x;
+			float dy = oy - y;
+			float d = sqrtf( dx * dx + dy * dy );
+			if ( ( d < r ) && ( d > 0.f ) )
+			{
+				normals[ ( x * GRID_HEIGHT + y ) * 2 ] = dx / d;
+				normals[ ( x * GRID_HEIGHT + y ) * 2 + 1 ] = dy / d;
+			}
+		}
+	}
+}
+
+// rotating vortex in the rows of a CV_32FC2 matrix
+static void vortexFlow( std::vector< float > &flow, int frame )
+{
+	flow.resize( GRID_WIDTH * GRID_HEIGHT * 2 );
+	float a = frame * .01f;
+	float ox = GRID_WIDTH * ( .5f + .25f * cosf( a ) );
+	float oy = GRID_HEIGHT * ( .5f + .25f * sinf( a ) );
+	for ( int y = 0; y < GRID_HEIGHT; y++ )
+	{
+		for ( int x = 0; x < GRID_WIDTH; x++ )
+		{
+			float dx = x - ox;
+			float dy = y - oy;
+			float s = 20.f / ( 20.f + dx * dx + dy * dy );
+			flow[ ( y * GRID_WIDTH + x ) * 2 ] = -dy * s;
+			flow[ ( y * GRID_WIDTH + x ) * 2 + 1 ] = dx * s;
+		}
+	}
+}
+
+static void runScene( Scene scene, int frames, int particles, int threads )
+{
+	MpmLiquidRef liquid = MpmLiquid::create( GRID_WIDTH, GRID_HEIGHT, particles, threads );
+	MpmLiquid::Params &params = liquid->getParams();
+	params.gravity = ( scene == SCENE_DAM ) ? .05f : .01f;
+	liquid->setSortInterval( 30 );
+	resetParticles( liquid );
+
+	std::vector< float > mask, flow;
+	if ( scene == SCENE_MASK )
+	{
+		circleMask( mask, GRID_WIDTH * .5f, GRID_HEIGHT * .75f, 30.f );
+		liquid->setBoundary( &mask[ 0 ] );
+	}
+
+	double phaseTimes[ MpmLiquid::PHASE_COUNT ] = { 0. };
+	double total = 0.;
+	for ( int f = 0; f < frames; f++ )
+	{
+		if ( scene == SCENE_FLOW )
+		{
+			vortexFlow( flow, f );
+			liquid->setFlow( &flow[ 0 ], GRID_WIDTH, GRID_HEIGHT, .05f );
+		}
+		else
+		if ( scene == SCENE_DRAG )
+		{
+			float a = f * .05f;
+			liquid->setDrag( GRID_WIDTH * ( .5f + .3f * cosf( a ) ), GRID_HEIGHT * ( .5f + .3f * sinf( a ) ),
+					-2.f * sinf( a ), 2.f * cosf( a ) );
+		}
+
+		liquid->step();
+
+		for ( int i = 0; i < MpmLiquid::PHASE_COUNT; i++ )
+			phaseTimes[ i ] += liquid->getPhaseTime( MpmLiquid::Phase( i ) );
+		total += liquid->getStepTime();
+	}
+
+	printf( "%-6s %8d %8d", sceneNames[ scene ], liquid->getNumThreads(), frames );
+	for ( int i = 0; i < MpmLiquid::PHASE_COUNT; i++ )
+		printf( " %8.3f", phaseTimes[ i ] / frames );
+	printf( " %8.3f   %08x\n", total / frames, liquid->getChecksum() );
+}
+
+int main( int argc, char **argv )
+{
+	int frames = ( argc > 1 ) ? atoi( argv[ 1 ] ) : 600;
+	int particles = ( argc > 2 ) ? atoi( argv[ 2 ] ) : 14000;
+	std::vector< int > threads;
+	for ( int i = 3; i < argc; i++ )
+		threads.push_back( atoi( argv[ i ] ) );
+	if ( threads.empty() )
+	{
+		threads.push_back( 1 );
+		threads.push_back( 0 );
+	}
+
+	printf( "%d particles on a %dx%d grid, times in ms\n", particles, GRID_WIDTH, GRID_HEIGHT );
+	printf( "%-6s %8s %8s", "scene", "threads", "frames" );
+	for ( int i = 0; i < MpmLiquid::PHASE_COUNT; i++ )
+		printf( " %8s", MpmLiquid::getPhaseName( MpmLiquid::Phase( i ) ) );
+	printf( " %8s   %s\n", "total", "checksum" );
+
+	for ( int s = 0; s < SCENE_COUNT; s++ )
+	{
+		for ( size_t t = 0; t < threads.size(); t++ )
+			runScene( Scene( s ), frames, particles, threads[ t ] );
+	}
+
+	return 0;
+}
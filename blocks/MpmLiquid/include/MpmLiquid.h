@@ -0,0 +1,221 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "WorkerPool.h"
+
+namespace mndl {
+
+typedef std::shared_ptr< class MpmLiquid > MpmLiquidRef;
+
+//! Material point method liquid on a regular grid, without any window or GL dependency.
+/*! The particles are simulated on the worker pool in vertical strips of the
+	grid. The result does not depend on the number of threads, the same
+	inputs always give the same particle state. Positions and velocities
+	are in grid cells. */
+class MpmLiquid
+{
+	public:
+		//! Creates a liquid on a \a gridWidth x \a gridHeight grid with room for \a maxParticles.
+		/*! The simulation runs on \a numThreads threads including the calling
+			one, 0 uses all cores. */
+		static MpmLiquidRef create( int gridWidth, int gridHeight, int maxParticles, int numThreads = 0 )
+		{ return MpmLiquidRef( new MpmLiquid( gridWidth, gridHeight, maxParticles, numThreads ) ); }
+
+		struct Params
+		{
+			Params() : density( 2.f ), stiffness( 1.f ), bulkViscosity( 1.f ),
+				elasticity( 0.f ), viscosity( .1f ), yieldRate( 0.f ),
+				gravity( 0.f ), smoothing( 0.f ) {}
+
+			float density;
+			float stiffness;
+			float bulkViscosity;
+			float elasticity;
+			float viscosity;
+			float yieldRate;
+			float gravity;
+			float smoothing;
+		};
+
+		//! Particles in structure of arrays layout.
+		struct Particles
+		{
+			std::vector< float > x, y;		//!< position
+			std::vector< float > u, v;		//!< velocity
+			std::vector< float > gu, gv;	//!< velocity gathered from the grid in the last step
+			std::vector< float > T00, T01, T11;	//!< stress tensor
+			std::vector< int > cx, cy;		//!< cell of the 3x3 node neighbourhood
+
+			// quadratic b-spline weights and gradients of the 3x3 nodes
+			std::vector< float > px[ 3 ], py[ 3 ], gx[ 3 ], gy[ 3 ];
+
+			void resize( int n );
+		};
+
+		//! Phases of step() with separate timings.
+		enum Phase
+		{
+			PHASE_SORT = 0,
+			PHASE_WEIGHTS,
+			PHASE_P2G,
+			PHASE_STRESS,
+			PHASE_FORCES,
+			PHASE_VELOCITY,
+			PHASE_ADVECT,
+			PHASE_COUNT
+		};
+
+		Params & getParams() { return mParams; }
+		const Params & getParams() const { return mParams; }
+
+		int getGridWidth() const { return mGridWidth; }
+		int getGridHeight() const { return mGridHeight; }
+		int getMaxParticles() const { return mMaxParticles; }
+		int getNumThreads() const;
+
+		//! Sets the number of simulated particles, the rest are kept as they are.
+		void setNumParticles( int n );
+		int getNumParticles() const { return mNumParticles; }
+
+		//! Places particle \a i at \a x, \a y at rest.
+		void setParticle( int i, float x, float y, float u = 0.f, float v = 0.f );
+		const Particles & getParticles() const { return mParticles; }
+
+		//! Pulls the particles within 10 cells of \a x, \a y towards the velocity \a dx, \a dy for the next step.
+		void setDrag( float x, float y, float dx, float dy );
+		void clearDrag() { mDrag = false; }
+
+		//! Adds \a multiplier times the flow to the particle velocities.
+		/*! \a flow is \a width x \a height interleaved x, y velocities in rows,
+			like a CV_32FC2 matrix, stretched over the grid. The velocities are
+			scaled from flow pixels to grid cells if the sizes differ. It is
+			resampled onto the grid nodes right away, so it can be released afterwards,
+			and the particles read it with their node weights. Only needs to
+			be called when the flow changes. NULL disables it. */
+		void setFlow( const float *flow, int width, int height, float multiplier );
+		void setFlowMultiplier( float multiplier ) { mFlowMultiplier = multiplier; }
+
+		//! Normals of the boundary pushing the particles away.
+		/*! \a normals are grid width x grid height x, y pairs in column major
+			order, the layout of a Vec2f[ gridWidth ][ gridHeight ] array. Zero
+			or NaN normals have no effect, NULL disables the boundary. */
+		void setBoundary( const float *normals ) { mBoundary = normals; }
+		//! Velocity field added to the particles, in the layout of the boundary normals, NULL disables it.
+		void setAttractor( const float *field ) { mAttractor = field; }
+
+		//! Reorders the particles along the z-order curve of their cells every \a frames steps, 0 disables.
+		void setSortInterval( int frames ) { mSortInterval = frames; }
+		int getSortInterval() const { return mSortInterval; }
+
+		//! Advances the simulation by one step.
+		void step();
+
+		//! Duration of \a phase in the last step in milliseconds.
+		double getPhaseTime( Phase phase ) const { return mPhaseTimes[ phase ]; }
+		//! Duration of the last step in milliseconds.
+		double getStepTime() const;
+		static const char * getPhaseName( Phase phase );
+
+		//! Hash of the particle state, changes if any bit of the positions or velocities change.
+		uint32_t getChecksum() const;
+
+	private:
+		MpmLiquid( int gridWidth, int gridHeight, int maxParticles, int numThreads );
+		MpmLiquid( const MpmLiquid & );
+		MpmLiquid & operator=( const MpmLiquid & );
+
+		struct Node
+		{
+			float m;
+			float gx;
+			float gy;
+			float u;
+			float v;
+			float ax;
+			float ay;
+		};
+
+		Node & node( int x, int y ) { return mGrid[ x * mGridHeight + y ]; }
+
+		void calcWeights( int begin, int end );
+		void binParticles();
+		void sortParticles();
+		void parallelFor( int count, const std::function< void( int ) > &fn );
+		void forEachStrip( const std::function< void( int ) > &fn );
+		void forEachParticleBlock( const std::function< void( int, int ) > &fn );
+		void forEachActiveBlock( const std::function< void( Node *, Node * ) > &fn );
+		void collectActiveBlocks();
+		void clearActiveBlocks();
+		void applyForces( int k, uint32_t *random );
+
+		// particles are binned into vertical strips of the grid by their
+		// cell, strips of the same parity do not share nodes
+		static const int STRIP_WIDTH = 4;
+		static const int PARTICLE_BLOCK = 1024;
+		// nodes are tracked in blocks of consecutive nodes of a column
+		static const int NODE_BLOCK = 16;
+
+		int mGridWidth, mGridHeight;
+		int mMaxParticles;
+		int mNumParticles;
+
+		Params mParams;
+		Particles mParticles;
+		std::vector< Node > mGrid;
+
+		int mNumStrips;
+		std::vector< int > mStripParticles;	// particle indices ordered by strip
+		std::vector< int > mStripStart;
+
+		// blocks touched by the scatter are flagged, and listed in memory
+		// order for the grid passes, untouched blocks stay zero
+		int mNumColumnBlocks;
+		std::vector< uint8_t > mBlockTouched;
+		std::vector< int > mActiveBlocks;
+
+		std::vector< uint32_t > mBlockRandom;	// jitter generator state of the particle blocks
+
+		bool mDrag;
+		float mDragX, mDragY, mDragU, mDragV;
+
+		bool mFlow;
+		std::vector< float > mFlowNodes;	// flow velocities in the node layout
+		float mFlowMultiplier;
+
+		const float *mBoundary;
+		const float *mAttractor;
+
+		int mSortInterval;
+		int mSortFrame;
+		std::vector< uint32_t > mSortKeys[ 2 ];
+		std::vector< int > mSortOrder[ 2 ];
+		std::vector< float > mSortScratch;
+
+		double mPhaseTimes[ PHASE_COUNT ];
+
+		WorkerPoolRef mWorkerPool;
+};
+
+} // namespace mndl
@@ -0,0 +1,811 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "MpmLiquid.h"
+
+namespace mndl {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double elapsedMs( Clock::time_point &start )
+{
+	Clock::time_point now = Clock::now();
+	double ms = std::chrono::duration< double, std::milli >( now - start ).count();
+	start = now;
+	return ms;
+}
+
+// xorshift, the jitter only has to be deterministic and cheap
+static inline float randFloat( uint32_t *state )
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return ( x >> 8 ) * ( 1.f / 16777216.f );
+}
+
+// spreads the lower 16 bits of v to the even bits
+static inline uint32_t spreadBits( uint32_t v )
+{
+	v = ( v | ( v << 8 ) ) & 0x00ff00ff;
+	v = ( v | ( v << 4 ) ) & 0x0f0f0f0f;
+	v = ( v | ( v << 2 ) ) & 0x33333333;
+	v = ( v | ( v << 1 ) ) & 0x55555555;
+	return v;
+}
+
+void MpmLiquid::Particles::resize( int n )
+{
+	std::vector< float > *fields[] = { &x, &y, &u, &v, &gu, &gv, &T00, &T01, &T11 };
+	for ( size_t i = 0; i < sizeof( fields ) / sizeof( fields[ 0 ] ); i++ )
+		fields[ i ]->resize( n, 0.f );
+	cx.resize( n, 0 );
+	cy.resize( n, 0 );
+	for ( int i = 0; i < 3; i++ )
+	{
+		px[ i ].resize( n );
+		py[ i ].resize( n );
+		gx[ i ].resize( n );
+		gy[ i ].resize( n );
+	}
+}
+
+MpmLiquid::MpmLiquid( int gridWidth, int gridHeight, int maxParticles, int numThreads ) :
+	mGridWidth( gridWidth ),
+	mGridHeight( gridHeight ),
+	mMaxParticles( maxParticles ),
+	mNumParticles( maxParticles ),
+	mDrag( false ),
+	mFlow( false ),
+	mFlowMultiplier( 0.f ),
+	mBoundary( NULL ),
+	mAttractor( NULL ),
+	mSortInterval( 0 ),
+	mSortFrame( 0 )
+{
+	mParticles.resize( mMaxParticles );
+
+	mGrid.resize( mGridWidth * mGridHeight );
+	std::memset( &mGrid[ 0 ], 0, mGrid.size() * sizeof( Node ) );
+
+	mNumStrips = ( mGridWidth + STRIP_WIDTH - 1 ) / STRIP_WIDTH;
+	mStripStart.resize( mNumStrips + 1 );
+
+	mNumColumnBlocks = ( mGridHeight + NODE_BLOCK - 1 ) / NODE_BLOCK;
+	mBlockTouched.assign( mGridWidth * mNumColumnBlocks, 0 );
+
+	mBlockRandom.resize( ( mMaxParticles + PARTICLE_BLOCK - 1 ) / PARTICLE_BLOCK );
+	for ( size_t i = 0; i < mBlockRandom.size(); i++ )
+		mBlockRandom[ i ] = 2463534242u + i * 2654435761u;
+
+	for ( int i = 0; i < PHASE_COUNT; i++ )
+		mPhaseTimes[ i ] = 0.;
+
+	// a single thread runs the loops without a pool
+	if ( numThreads != 1 )
+		mWorkerPool = WorkerPool::create( numThreads > 1 ? numThreads - 1 : 0 );
+}
+
+int MpmLiquid::getNumThreads() const
+{
+	return mWorkerPool ? mWorkerPool->getNumThreads() : 1;
+}
+
+void MpmLiquid::parallelFor( int count, const std::function< void( int ) > &fn )
+{
+	if ( mWorkerPool )
+	{
+		mWorkerPool->parallelFor( count, fn );
+	}
+	else
+	{
+		for ( int i = 0; i < count; i++ )
+			fn( i );
+	}
+}
+
+void MpmLiquid::setNumParticles( int n )
+{
+	mNumParticles = std::max( 0, std::min( n, mMaxParticles ) );
+}
+
+void MpmLiquid::setParticle( int i, float x, float y, float u, float v )
+{
+	mParticles.x[ i ] = x;
+	mParticles.y[ i ] = y;
+	mParticles.u[ i ] = u;
+	mParticles.v[ i ] = v;
+	mParticles.gu[ i ] = 0.f;
+	mParticles.gv[ i ] = 0.f;
+	mParticles.T00[ i ] = mParticles.T01[ i ] = mParticles.T11[ i ] = 0.f;
+}
+
+void MpmLiquid::setDrag( float x, float y, float dx, float dy )
+{
+	mDrag = true;
+	mDragX = x;
+	mDragY = y;
+	mDragU = dx;
+	mDragV = dy;
+}
+
+void MpmLiquid::setFlow( const float *flow, int width, int height, float multiplier )
+{
+	mFlowMultiplier = multiplier;
+	mFlow = flow && ( width > 0 ) && ( height > 0 );
+	if ( !mFlow )
+		return;
+
+	// bilinear samples of the flow at the node positions, pixel centers
+	// are at half cells, the velocities are converted to grid cells
+	mFlowNodes.resize( mGridWidth * mGridHeight * 2 );
+	const float scaleX = width / (float)mGridWidth;
+	const float scaleY = height / (float)mGridHeight;
+	const float velScale[ 2 ] = { 1.f / scaleX, 1.f / scaleY };
+	parallelFor( mGridWidth, [&]( int x )
+		{
+			float fx = std::max( 0.f, std::min( x * scaleX - .5f, width - 1.f ) );
+			int x0 = (int)fx;
+			int x1 = std::min( x0 + 1, width - 1 );
+			float wx = fx - x0;
+			float *dst = &mFlowNodes[ x * mGridHeight * 2 ];
+			for ( int y = 0; y < mGridHeight; y++ )
+			{
+				float fy = std::max( 0.f, std::min( y * scaleY - .5f, height - 1.f ) );
+				int y0 = (int)fy;
+				int y1 = std::min( y0 + 1, height - 1 );
+				float wy = fy - y0;
+				const float *f00 = flow + ( y0 * width + x0 ) * 2;
+				const float *f01 = flow + ( y0 * width + x1 ) * 2;
+				const float *f10 = flow + ( y1 * width + x0 ) * 2;
+				const float *f11 = flow + ( y1 * width + x1 ) * 2;
+				for ( int c = 0; c < 2; c++ )
+				{
+					float top = f00[ c ] + wx * ( f01[ c ] - f00[ c ] );
+					float bottom = f10[ c ] + wx * ( f11[ c ] - f10[ c ] );
+					dst[ y * 2 + c ] = ( top + wy * ( bottom - top ) ) * velScale[ c ];
+				}
+			}
+		} );
+}
+
+double MpmLiquid::getStepTime() const
+{
+	double t = 0.;
+	for ( int i = 0; i < PHASE_COUNT; i++ )
+		t += mPhaseTimes[ i ];
+	return t;
+}
+
+const char * MpmLiquid::getPhaseName( Phase phase )
+{
+	static const char *names[ PHASE_COUNT ] = { "sort", "weights", "p2g", "stress",
+		"forces", "velocity", "advect" };
+	return names[ phase ];
+}
+
+uint32_t MpmLiquid::getChecksum() const
+{
+	// fnv-1a of the bits of the particle state
+	uint32_t h = 2166136261u;
+	const std::vector< float > *fields[] = { &mParticles.x, &mParticles.y, &mParticles.u, &mParticles.v };
+	for ( size_t f = 0; f < sizeof( fields ) / sizeof( fields[ 0 ] ); f++ )
+	{
+		const unsigned char *bytes = reinterpret_cast< const unsigned char * >( &( *fields[ f ] )[ 0 ] );
+		for ( size_t i = 0; i < mNumParticles * sizeof( float ); i++ )
+		{
+			h ^= bytes[ i ];
+			h *= 16777619u;
+		}
+	}
+	return h;
+}
+
+void MpmLiquid::forEachStrip( const std::function< void( int ) > &fn )
+{
+	// a particle scatters to 3 columns from its cell, so strips of the same
+	// parity never write the same nodes
+	for ( int parity = 0; parity < 2; parity++ )
+	{
+		parallelFor( ( mNumStrips - parity + 1 ) / 2,
+				[&]( int i ) { fn( 2 * i + parity ); } );
+	}
+}
+
+void MpmLiquid::forEachParticleBlock( const std::function< void( int, int ) > &fn )
+{
+	const int count = mNumParticles;
+	parallelFor( ( count + PARTICLE_BLOCK - 1 ) / PARTICLE_BLOCK,
+			[&]( int b ) { fn( b, std::min( count, ( b + 1 ) * PARTICLE_BLOCK ) ); } );
+}
+
+void MpmLiquid::forEachActiveBlock( const std::function< void( Node *, Node * ) > &fn )
+{
+	// a task handles the blocks of a few columns
+	const int blocksPerTask = 4 * mNumColumnBlocks;
+	const int count = (int)mActiveBlocks.size();
+	parallelFor( ( count + blocksPerTask - 1 ) / blocksPerTask, [&]( int t )
+		{
+			int end = std::min( count, ( t + 1 ) * blocksPerTask );
+			for ( int i = t * blocksPerTask; i < end; i++ )
+			{
+				int b = mActiveBlocks[ i ];
+				int x = b / mNumColumnBlocks;
+				int y = ( b % mNumColumnBlocks ) * NODE_BLOCK;
+				Node *n = &node( x, y );
+				fn( n, n + std::min( NODE_BLOCK, mGridHeight - y ) );
+			}
+		} );
+}
+
+void MpmLiquid::collectActiveBlocks()
+{
+	mActiveBlocks.clear();
+	for ( size_t b = 0; b < mBlockTouched.size(); b++ )
+	{
+		if ( mBlockTouched[ b ] )
+			mActiveBlocks.push_back( b );
+	}
+}
+
+void MpmLiquid::clearActiveBlocks()
+{
+	forEachActiveBlock( [&]( Node *begin, Node *end )
+		{
+			std::memset( begin, 0, ( end - begin ) * sizeof( Node ) );
+		} );
+	for ( size_t i = 0; i < mActiveBlocks.size(); i++ )
+		mBlockTouched[ mActiveBlocks[ i ] ] = 0;
+	mActiveBlocks.clear();
+}
+
+void MpmLiquid::step()
+{
+	Particles &p = mParticles;
+	const int gsizeX = mGridWidth;
+	const int gsizeY = mGridHeight;
+
+	Clock::time_point phaseStart = Clock::now();
+
+	if ( ( mSortInterval > 0 ) && ( ++mSortFrame >= mSortInterval ) )
+	{
+		sortParticles();
+		mSortFrame = 0;
+	}
+	mPhaseTimes[ PHASE_SORT ] = elapsedMs( phaseStart );
+
+	forEachParticleBlock( [&]( int b, int end )
+		{
+			calcWeights( b * PARTICLE_BLOCK, end );
+		} );
+	binParticles();
+	mPhaseTimes[ PHASE_WEIGHTS ] = elapsedMs( phaseStart );
+
+	// nodes of the last step
+	clearActiveBlocks();
+
+	forEachStrip( [&]( int s )
+	{
+		for (int q = mStripStart[s]; q < mStripStart[s + 1]; q++)
+		{
+			int k = mStripParticles[q];
+			// the 3 rows span at most two blocks of a column, strips of
+			// the same parity flag different columns
+			uint8_t *touched = &mBlockTouched[p.cx[k] * mNumColumnBlocks];
+			int b0 = p.cy[k] / NODE_BLOCK;
+			int b1 = (p.cy[k] + 2) / NODE_BLOCK;
+			for (int i = 0; i < 3; i++)
+			{
+				touched[i * mNumColumnBlocks + b0] = 1;
+				touched[i * mNumColumnBlocks + b1] = 1;
+			}
+
+			for (int i = 0; i < 3; i++)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					Node *n = &node(p.cx[k] + i, p.cy[k] + j);
+					float phi = p.px[i][k] * p.py[j][k];
+					n->m += phi;
+					float dx = p.gx[i][k] * p.py[j][k];
+					float dy = p.px[i][k] * p.gy[j][k];
+					n->gx += dx;
+					n->gy += dy;
+					n->u += phi * p.u[k];
+					n->v += phi * p.v[k];
+				}
+			}
+		}
+	} );
+
+	collectActiveBlocks();
+
+	forEachActiveBlock( [&]( Node *begin, Node *end )
+	{
+		for (Node *n = begin; n != end; n++)
+		{
+			if (n->m > 0)
+			{
+				n->u /= n->m;
+				n->v /= n->m;
+			}
+		}
+	} );
+	mPhaseTimes[ PHASE_P2G ] = elapsedMs( phaseStart );
+
+	const Params &params = mParams;
+	forEachStrip( [&]( int s )
+	{
+		for (int q = mStripStart[s]; q < mStripStart[s + 1]; q++)
+		{
+			int k = mStripParticles[q];
+
+			float dudx = 0.0;
+			float dudy = 0.0;
+			float dvdx = 0.0;
+			float dvdy = 0.0;
+			for (int i = 0; i < 3; i++)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					Node *n = &node(p.cx[k] + i, p.cy[k] + j);
+					float gx = p.gx[i][k] * p.py[j][k];
+					float gy = p.px[i][k] * p.gy[j][k];
+					dudx += n->u * gx;
+					dudy += n->u * gy;
+					dvdx += n->v * gx;
+					dvdy += n->v * gy;
+				}
+			}
+
+			float w1 = dudy - dvdx;
+			float wT0 = w1 * p.T01[k];
+			float wT1 = 0.5F * w1 * (p.T00[k] - p.T11[k]);
+			float D00 = dudx;
+			float D01 = 0.5F * (dudy + dvdx);
+			float D11 = dvdy;
+			float trace = 0.5F * (D00 + D11);
+			D00 -= trace;
+			D11 -= trace;
+			p.T00[k] += -wT0 + D00 - params.yieldRate * p.T00[k];
+			p.T01[k] += wT1 + D01 - params.yieldRate * p.T01[k];
+			p.T11[k] += wT0 + D11 - params.yieldRate * p.T11[k];
+
+			float norm = p.T00[k] * p.T00[k] + 2.0 * p.T01[k] * p.T01[k] + p.T11[k] * p.T11[k];
+			if (norm > 5.0)
+				p.T00[k] = p.T01[k] = p.T11[k] = 0.0;
+
+			int cx = (int)p.x[k];
+			int cy = (int)p.y[k];
+			if (cx > gsizeX - 5)
+				cx = gsizeX - 5;
+			else
+			if (cx < 0)
+				cx = 0;
+			if (cy > gsizeY - 5)
+				cy = gsizeY - 5;
+			else
+			if (cy < 0)
+				cy = 0;
+			int cxi = cx + 1;
+			int cyi = cy + 1;
+
+			const Node &n00 = node(cx, cy);
+			const Node &n01 = node(cx, cyi);
+			const Node &n10 = node(cxi, cy);
+			const Node &n11 = node(cxi, cyi);
+			float p00 = n00.m;
+			float x00 = n00.gx;
+			float y00 = n00.gy;
+			float p01 = n01.m;
+			float x01 = n01.gx;
+			float y01 = n01.gy;
+			float p10 = n10.m;
+			float x10 = n10.gx;
+			float y10 = n10.gy;
+			float p11 = n11.m;
+			float x11 = n11.gx;
+			float y11 = n11.gy;
+
+			float pdx = p10 - p00;
+			float pdy = p01 - p00;
+			float C20 = 3.0 * pdx - x10 - 2.0 * x00;
+			float C02 = 3.0 * pdy - y01 - 2.0 * y00;
+			float C30 = -2.0 * pdx + x10 + x00;
+			float C03 = -2.0 * pdy + y01 + y00;
+			float csum1 = p00 + y00 + C02 + C03;
+			float csum2 = p00 + x00 + C20 + C30;
+			float C21 = 3.0 * p11 - 2.0 * x01 - x11 - 3.0 * csum1 - C20;
+			float C31 = -2.0 * p11 + x01 + x11 + 2.0 * csum1 - C30;
+			float C12 = 3.0 * p11 - 2.0 * y10 - y11 - 3.0 * csum2 - C02;
+			float C13 = -2.0 * p11 + y10 + y11 + 2.0 * csum2 - C03;
+			float C11 = x01 - C13 - C12 - x00;
+
+			float u = p.x[k] - cx;
+			float u2 = u * u;
+			float u3 = u * u2;
+			float v = p.y[k] - cy;
+			float v2 = v * v;
+			float v3 = v * v2;
+			float density = p00 + x00 * u + y00 * v + C20 * u2 + C02 * v2 +
+				C30 * u3 + C03 * v3 + C21 * u2 * v + C31 * u3 * v + C12 *
+				u * v2 + C13 * u * v3 + C11 * u * v;
+
+			float pressure = params.stiffness / std::max(1.0f, params.density) * (density - params.density);
+			if (pressure > 2.0) {
+				pressure = 2.0;
+			}
+
+			float fx = 0.0;
+			float fy = 0.0;
+			if (p.x[k] < 3.0)
+				fx += 3.0 - p.x[k];
+			else
+			if (p.x[k] > gsizeX - 4)
+				fx += gsizeX - 4 - p.x[k];
+
+			if (p.y[k] < 3.0F)
+				fy += 3.0F - p.y[k];
+			else
+			if (p.y[k] > gsizeY - 4)
+				fy += gsizeY - 4 - p.y[k];
+
+			trace *= params.stiffness;
+			float T00 = params.elasticity * p.T00[k] + params.viscosity * D00 + pressure + params.bulkViscosity * trace;
+			float T01 = params.elasticity * p.T01[k] + params.viscosity * D01;
+			float T11 = params.elasticity * p.T11[k] + params.viscosity * D11 + pressure + params.bulkViscosity * trace;
+
+			for (int i = 0; i < 3; i++)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					Node *n = &node(p.cx[k] + i, p.cy[k] + j);
+					float phi = p.px[i][k] * p.py[j][k];
+					float dx = p.gx[i][k] * p.py[j][k];
+					float dy = p.px[i][k] * p.gy[j][k];
+
+					n->ax += -(dx * T00 + dy * T01) + fx * phi;
+					n->ay += -(dx * T01 + dy * T11) + fy * phi;
+				}
+			}
+		}
+	} );
+
+	forEachActiveBlock( [&]( Node *begin, Node *end )
+	{
+		for (Node *n = begin; n != end; n++)
+		{
+			if (n->m > 0)
+			{
+				n->ax /= n->m;
+				n->ay /= n->m;
+				n->u = 0;
+				n->v = 0;
+			}
+		}
+	} );
+	mPhaseTimes[ PHASE_STRESS ] = elapsedMs( phaseStart );
+
+	// the gather of the accelerations only reads the grid, so the external
+	// forces run over particle blocks
+	forEachParticleBlock( [&]( int b, int end )
+	{
+		for (int k = b * PARTICLE_BLOCK; k < end; k++)
+		{
+			if (mFlow)
+			{
+				// the optical flow is gathered from the nodes with the
+				// same weights
+				const float mult = mFlowMultiplier;
+				for (int i = 0; i < 3; i++)
+				{
+					const float *f = &mFlowNodes[((p.cx[k] + i) * gsizeY + p.cy[k]) * 2];
+					for (int j = 0; j < 3; j++)
+					{
+						Node *n = &node(p.cx[k] + i, p.cy[k] + j);
+						float phi = p.px[i][k] * p.py[j][k];
+						p.u[k] += phi * (n->ax + mult * f[j * 2]);
+						p.v[k] += phi * (n->ay + mult * f[j * 2 + 1]);
+					}
+				}
+			}
+			else
+			{
+				for (int i = 0; i < 3; i++)
+				{
+					for (int j = 0; j < 3; j++)
+					{
+						Node *n = &node(p.cx[k] + i, p.cy[k] + j);
+						float phi = p.px[i][k] * p.py[j][k];
+						p.u[k] += phi * n->ax;
+						p.v[k] += phi * n->ay;
+					}
+				}
+			}
+			p.v[k] += params.gravity;
+
+			applyForces(k, &mBlockRandom[b]);
+		}
+	} );
+	mPhaseTimes[ PHASE_FORCES ] = elapsedMs( phaseStart );
+
+	forEachStrip( [&]( int s )
+	{
+		for (int q = mStripStart[s]; q < mStripStart[s + 1]; q++)
+		{
+			int k = mStripParticles[q];
+			for (int i = 0; i < 3; i++)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					Node *n = &node(p.cx[k] + i, p.cy[k] + j);
+					float phi = p.px[i][k] * p.py[j][k];
+					n->u += phi * p.u[k];
+					n->v += phi * p.v[k];
+				}
+			}
+		}
+	} );
+
+	forEachActiveBlock( [&]( Node *begin, Node *end )
+	{
+		for (Node *n = begin; n != end; n++)
+		{
+			if (n->m > 0)
+			{
+				n->u /= n->m;
+				n->v /= n->m;
+			}
+		}
+	} );
+	mPhaseTimes[ PHASE_VELOCITY ] = elapsedMs( phaseStart );
+
+	forEachParticleBlock( [&]( int b, int end )
+	{
+		for (int k = b * PARTICLE_BLOCK; k < end; k++)
+		{
+			float gu = 0.0;
+			float gv = 0.0;
+			for (int i = 0; i < 3; i++)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					Node *n = &node(p.cx[k] + i, p.cy[k] + j);
+					float phi = p.px[i][k] * p.py[j][k];
+					gu += phi * n->u;
+					gv += phi * n->v;
+				}
+			}
+
+			p.gu[k] = gu;
+			p.gv[k] = gv;
+
+			p.x[k] += gu;
+			p.y[k] += gv;
+			p.u[k] += params.smoothing * (gu - p.u[k]);
+			p.v[k] += params.smoothing * (gv - p.v[k]);
+		}
+	} );
+	mPhaseTimes[ PHASE_ADVECT ] = elapsedMs( phaseStart );
+}
+
+void MpmLiquid::applyForces( int k, uint32_t *random )
+{
+	Particles &p = mParticles;
+	const int gsizeX = mGridWidth;
+	const int gsizeY = mGridHeight;
+
+	if (mDrag)
+	{
+		float vx = std::abs(p.x[k] - mDragX);
+		float vy = std::abs(p.y[k] - mDragY);
+		if ((vx < 10.0) && (vy < 10.0))
+		{
+			float weight = (1.0 - vx / 10.0) * (1.0 - vy / 10.0);
+			p.u[k] += weight * (mDragU - p.u[k]);
+			p.v[k] += weight * (mDragV - p.v[k]);
+		}
+	}
+
+	if (mBoundary || mAttractor)
+	{
+		int xi = (int)(p.x[k] + p.u[k]);
+		int yi = (int)(p.y[k] + p.v[k]);
+		if ((xi >= 0) && (xi < gsizeX) &&
+			(yi >= 0) && (yi < gsizeY))
+		{
+			int o = (xi * gsizeY + yi) * 2;
+			// boundary repels, the comparison also skips normals that
+			// are not numbers
+			if (mBoundary)
+			{
+				float nx = mBoundary[o];
+				float ny = mBoundary[o + 1];
+				if (nx * nx + ny * ny > 0)
+				{
+					p.u[k] -= nx;
+					p.v[k] -= ny;
+				}
+			}
+			// attractor
+			if (mAttractor)
+			{
+				p.u[k] += mAttractor[o];
+				p.v[k] += mAttractor[o + 1];
+			}
+		}
+	}
+
+	float x = p.x[k] + p.u[k];
+	float y = p.y[k] + p.v[k];
+	if (x < 2.0)
+		p.u[k] += 2.0 - x + randFloat(random) * 0.01;
+	else
+	if (x > gsizeX - 3)
+		p.u[k] += gsizeX - 3 - x - randFloat(random) * 0.01;
+
+	if (y < 2.0)
+		p.v[k] += 2.0 - y + randFloat(random) * 0.01;
+	else
+	if (y > gsizeY - 3)
+		p.v[k] += gsizeY - 3 - y - randFloat(random) * 0.01;
+}
+
+void MpmLiquid::calcWeights( int begin, int end )
+{
+	Particles &p = mParticles;
+	const int maxX = mGridWidth - 4;
+	const int maxY = mGridHeight - 4;
+
+	for (int k = begin; k < end; k++)
+	{
+		int cx = (int)(p.x[k] - 0.5f);
+		cx = cx > maxX ? maxX : cx;
+		cx = cx < 0 ? 0 : cx;
+		p.cx[k] = cx;
+
+		int cy = (int)(p.y[k] - 0.5f);
+		cy = cy > maxY ? maxY : cy;
+		cy = cy < 0 ? 0 : cy;
+		p.cy[k] = cy;
+	}
+
+	for (int k = begin; k < end; k++)
+	{
+		float x = p.cx[k] - p.x[k];
+		p.px[0][k] = (0.5f * x * x + 1.5f * x + 1.125f);
+		p.gx[0][k] = (x + 1.5f);
+		x += 1.0f;
+		p.px[1][k] = (-x * x + 0.75f);
+		p.gx[1][k] = (-2.0f * x);
+		x += 1.0f;
+		p.px[2][k] = (0.5f * x * x - 1.5f * x + 1.125f);
+		p.gx[2][k] = (x - 1.5f);
+
+		float y = p.cy[k] - p.y[k];
+		p.py[0][k] = (0.5f * y * y + 1.5f * y + 1.125f);
+		p.gy[0][k] = (y + 1.5f);
+		y += 1.0f;
+		p.py[1][k] = (-y * y + 0.75f);
+		p.gy[1][k] = (-2.0f * y);
+		y += 1.0f;
+		p.py[2][k] = (0.5f * y * y - 1.5f * y + 1.125f);
+		p.gy[2][k] = (y - 1.5f);
+	}
+}
+
+void MpmLiquid::binParticles()
+{
+	// counting sort of the particle indices by strip, the order within a
+	// strip is the particle order, so the results do not depend on the
+	// number of threads
+	const int count = mNumParticles;
+	std::vector< int > &start = mStripStart;
+
+	std::fill( start.begin(), start.end(), 0 );
+	for ( int k = 0; k < count; k++ )
+		start[ mParticles.cx[ k ] / STRIP_WIDTH + 1 ]++;
+	for ( int s = 0; s < mNumStrips; s++ )
+		start[ s + 1 ] += start[ s ];
+
+	mStripParticles.resize( count );
+	for ( int k = 0; k < count; k++ )
+		mStripParticles[ start[ mParticles.cx[ k ] / STRIP_WIDTH ]++ ] = k;
+
+	// the insertion advanced every start to the next strip
+	for ( int s = mNumStrips; s > 0; s-- )
+		start[ s ] = start[ s - 1 ];
+	start[ 0 ] = 0;
+}
+
+void MpmLiquid::sortParticles()
+{
+	const int count = mNumParticles;
+	Particles &p = mParticles;
+	if ( count == 0 )
+		return;
+
+	for ( int i = 0; i < 2; i++ )
+	{
+		mSortKeys[ i ].resize( count );
+		mSortOrder[ i ].resize( count );
+	}
+	mSortScratch.resize( count );
+
+	int bits = 0;
+	while ( ( 1 << bits ) < std::max( mGridWidth, mGridHeight ) )
+		bits++;
+
+	// morton code of the cell
+	for ( int k = 0; k < count; k++ )
+	{
+		int cx = std::max( 0, std::min( (int)p.x[ k ], mGridWidth - 1 ) );
+		int cy = std::max( 0, std::min( (int)p.y[ k ], mGridHeight - 1 ) );
+		mSortKeys[ 0 ][ k ] = spreadBits( cx ) | ( spreadBits( cy ) << 1 );
+		mSortOrder[ 0 ][ k ] = k;
+	}
+
+	// stable 8 bit lsd radix sort passes, the particles are mostly in order
+	// since the last sort, so the scattered writes stay local
+	int passes = ( 2 * bits + 7 ) / 8;
+	int src = 0;
+	for ( int pass = 0; pass < passes; pass++, src ^= 1 )
+	{
+		const std::vector< uint32_t > &keys = mSortKeys[ src ];
+		const std::vector< int > &order = mSortOrder[ src ];
+		std::vector< uint32_t > &sortedKeys = mSortKeys[ src ^ 1 ];
+		std::vector< int > &sortedOrder = mSortOrder[ src ^ 1 ];
+		int shift = pass * 8;
+
+		int offsets[ 256 ] = { 0 };
+		for ( int k = 0; k < count; k++ )
+			offsets[ ( keys[ k ] >> shift ) & 0xff ]++;
+		for ( int i = 0, sum = 0; i < 256; i++ )
+		{
+			int c = offsets[ i ];
+			offsets[ i ] = sum;
+			sum += c;
+		}
+		for ( int k = 0; k < count; k++ )
+		{
+			int d = offsets[ ( keys[ k ] >> shift ) & 0xff ]++;
+			sortedKeys[ d ] = keys[ k ];
+			sortedOrder[ d ] = order[ k ];
+		}
+	}
+
+	// cells and weights are recalculated before use, only the state of the
+	// particles is permuted
+	const std::vector< int > &order = mSortOrder[ src ];
+	std::vector< float > *fields[] = { &p.x, &p.y, &p.u, &p.v, &p.gu, &p.gv, &p.T00, &p.T01, &p.T11 };
+	for ( size_t f = 0; f < sizeof( fields ) / sizeof( fields[ 0 ] ); f++ )
+	{
+		std::vector< float > &field = *fields[ f ];
+		for ( int k = 0; k < count; k++ )
+			mSortScratch[ k ] = field[ order[ k ] ];
+		std::copy( mSortScratch.begin(), mSortScratch.end(), field.begin() );
+	}
+}
+
+} // namespace mndl
@@ -0,0 +1,295 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// headless benchmark of the optical flow of the apps. reads a recorded
+// image sequence, runs the capture preprocessing and the flow
+// configurations of FluidParticles, LiquidKoln and OptFlow on it, and
+// reports latency percentiles of the stages, the mean endpoint error
+// against Farneback and a hash of the flow fields. the error is averaged
+// over the flows of other methods only. the hash only changes if the flow
+// results change, for the same build, input and machine. it is not printed
+// for the auto method, which picks the backends by their measured time.
+//
+// build from the blocks/OpticalFlow directory:
+// c++ -std=c++11 -O3 -Iinclude bench/FlowBench.cpp src/FlowBackend.cpp
+//     src/GreyDownsampler.cpp `pkg-config --cflags --libs opencv` -o flowbench
+//
+// usage: flowbench [-c config] [-m method] [-l loops] [frames...]
+//   config: fluidparticles, liquidkoln, optflow or all (default)
+//   method: app (the method of the app, default), bm, lk, dis, farneback,
+//           auto or all
+// without frames a synthetic 640x480 sequence is used
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/video/tracking.hpp"
+
+#include "FlowBackend.h"
+#include "GreyDownsampler.h"
+
+using namespace mndl;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct Config
+{
+	const char *name;
+	int width, height;
+	bool mirror;
+	FlowParams params;
+};
+
+// the flow input sizes and parameters the apps use by default
+static std::vector< Config > appConfigs()
+{
+	std::vector< Config > configs;
+
+	Config fluidParticles = { "fluidparticles", 160, 120, true, FlowParams() };
+	fluidParticles.params.flags = cv::OPTFLOW_FARNEBACK_GAUSSIAN;
+	configs.push_back( fluidParticles );
+
+	Config liquidKoln = { "liquidkoln", 240, 180, true, FlowParams() };
+	configs.push_back( liquidKoln );
+
+	Config optFlow = { "optflow", 80, 60, true, FlowParams() };
+	configs.push_back( optFlow );
+
+	return configs;
+}
+
+static const char *methodArgs[] = { "bm", "lk", "dis", "farneback", "auto" };
+
+// moving and rotating texture, so every frame has some motion
+static std::vector< cv::Mat > syntheticFrames( int count )
+{
+	std::vector< cv::Mat > frames;
+	const int width = 640;
+	const int height = 480;
+	for ( int f = 0; f < count; f++ )
+	{
+		cv::Mat frame( height, width, CV_8UC3 );
+		float a = f * .02f;
+		float ox = 6.f * f * cosf( a );
+		float oy = 4.f * f * sinf( a );
+		for ( int y = 0; y < height; y++ )
+		{
+			uint8_t *row = frame.ptr< uint8_t >( y );
+			for ( int x = 0; x < width; x++ )
+			{
+				float u = x + ox;
+				float v = y + oy;
+				float t = sinf( u * .05f ) * cosf( v * .07f ) + .5f * sinf( ( u + v ) * .013f );
+				row[ x * 3 ] = uint8_t( 128 + 80 * t );
+				row[ x * 3 + 1 ] = uint8_t( 128 + 60 * t * cosf( v * .01f ) );
+				row[ x * 3 + 2 ] = uint8_t( 128 - 70 * t );
+			}
+		}
+		frames.push_back( frame );
+	}
+	return frames;
+}
+
+static double percentile( std::vector< double > times, double p )
+{
+	if ( times.empty() )
+		return 0.;
+	std::sort( times.begin(), times.end() );
+	size_t i = std::min( size_t( p * times.size() ), times.size() - 1 );
+	return times[ i ];
+}
+
+static uint32_t fnv1a( uint32_t hash, const cv::Mat &m )
+{
+	for ( int y = 0; y < m.rows; y++ )
+	{
+		const uint8_t *p = m.ptr< uint8_t >( y );
+		const size_t rowBytes = m.cols * m.elemSize();
+		for ( size_t i = 0; i < rowBytes; i++ )
+		{
+			hash ^= p[ i ];
+			hash *= 16777619u;
+		}
+	}
+	return hash;
+}
+
+static double elapsed( Clock::time_point start, Clock::time_point end )
+{
+	return std::chrono::duration< double, std::milli >( end - start ).count();
+}
+
+// method < 0 runs the method of the app
+static void run( const Config &config, int method, const std::vector< cv::Mat > &frames, int loops )
+{
+	FlowParams params = config.params;
+	if ( method >= 0 )
+		params.method = FlowMethod( method );
+
+	GreyDownsamplerRef downsampler = GreyDownsampler::create();
+	FlowMethodSelector selector;
+	FlowBackendRef backends[ FLOW_METHOD_COUNT ];
+	FlowBackendRef reference = FlowBackend::create( FLOW_FARNEBACK );
+
+	std::vector< double > prepTimes, flowTimes;
+	double errorSum = 0.;
+	int errorCount = 0;
+	uint32_t hash = 2166136261u;
+
+	cv::Mat prev( config.height, config.width, CV_8UC1 );
+	cv::Mat next( config.height, config.width, CV_8UC1 );
+	for ( int l = 0; l < loops; l++ )
+	{
+		for ( size_t f = 0; f < frames.size(); f++ )
+		{
+			// the layout of the BGR images of cv::imread
+			const cv::Mat &frame = frames[ f ];
+			Clock::time_point start = Clock::now();
+			downsampler->process( frame.data, frame.cols, frame.rows, int( frame.step ),
+					GreyDownsampler::Layout( 3, 2, 1, 0 ), next, config.mirror );
+			prepTimes.push_back( elapsed( start, Clock::now() ) );
+
+			if ( f > 0 )
+			{
+				FlowMethod m = selector.select( params );
+				if ( !backends[ m ] )
+					backends[ m ] = FlowBackend::create( m );
+
+				cv::Mat flow;
+				start = Clock::now();
+				backends[ m ]->calc( prev, next, flow, params );
+				double t = elapsed( start, Clock::now() );
+				flowTimes.push_back( t );
+				selector.update( m, t, params );
+
+				if ( m != FLOW_FARNEBACK )
+				{
+					cv::Mat referenceFlow;
+					reference->calc( prev, next, referenceFlow, params );
+					errorSum += flowEndpointError( flow, referenceFlow );
+					errorCount++;
+				}
+
+				hash = fnv1a( hash, flow );
+			}
+			std::swap( prev, next );
+		}
+	}
+
+	char errorStr[ 16 ] = "-";
+	if ( errorCount > 0 )
+		snprintf( errorStr, sizeof( errorStr ), "%7.3f", errorSum / errorCount );
+	char hashStr[ 16 ] = "-";
+	if ( params.method != FLOW_AUTO )
+		snprintf( hashStr, sizeof( hashStr ), "%08x", hash );
+
+	printf( "%-15s %-15s %6d  %7.3f %7.3f %7.3f  %7.3f %7.3f %7.3f  %7s   %s\n",
+			config.name, ( method < 0 ) ? "app" : FlowBackend::getMethodName( params.method ),
+			int( flowTimes.size() ),
+			percentile( prepTimes, .5 ), percentile( prepTimes, .9 ), percentile( prepTimes, .99 ),
+			percentile( flowTimes, .5 ), percentile( flowTimes, .9 ), percentile( flowTimes, .99 ),
+			errorStr, hashStr );
+}
+
+int main( int argc, char **argv )
+{
+	std::string configArg = "all";
+	std::string methodArg = "app";
+	int loops = 1;
+	std::vector< std::string > paths;
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg = argv[ i ];
+		if ( ( arg == "-c" ) && ( i + 1 < argc ) )
+			configArg = argv[ ++i ];
+		else
+		if ( ( arg == "-m" ) && ( i + 1 < argc ) )
+			methodArg = argv[ ++i ];
+		else
+		if ( ( arg == "-l" ) && ( i + 1 < argc ) )
+			loops = std::max( atoi( argv[ ++i ] ), 1 );
+		else
+			paths.push_back( arg );
+	}
+
+	std::vector< int > methods;
+	if ( methodArg == "app" )
+		methods.push_back( -1 );
+	for ( int m = 0; m <= FLOW_AUTO; m++ )
+	{
+		if ( ( methodArg == "all" ) || ( methodArg == methodArgs[ m ] ) )
+		{
+			if ( ( m == FLOW_AUTO ) || FlowBackend::isAvailable( FlowMethod( m ) ) )
+				methods.push_back( m );
+			else
+				fprintf( stderr, "%s is not available\n", methodArgs[ m ] );
+		}
+	}
+	if ( methods.empty() )
+	{
+		fprintf( stderr, "unknown method %s\n", methodArg.c_str() );
+		return 1;
+	}
+
+	// all frames are loaded first, so reading the files is not measured
+	std::vector< cv::Mat > frames;
+	for ( size_t i = 0; i < paths.size(); i++ )
+	{
+		cv::Mat frame = cv::imread( paths[ i ] );
+		if ( frame.empty() || ( frame.type() != CV_8UC3 ) )
+		{
+			fprintf( stderr, "cannot read %s\n", paths[ i ].c_str() );
+			return 1;
+		}
+		frames.push_back( frame );
+	}
+	if ( frames.empty() )
+		frames = syntheticFrames( 120 );
+	printf( "%d frames of %dx%d, times in ms, error in pixels against farneback\n",
+			int( frames.size() ), frames[ 0 ].cols, frames[ 0 ].rows );
+
+	printf( "%-15s %-15s %6s  %7s %7s %7s  %7s %7s %7s  %7s   %s\n",
+			"config", "method", "flows", "prep50", "prep90", "prep99",
+			"flow50", "flow90", "flow99", "error", "hash" );
+
+	std::vector< Config > configs = appConfigs();
+	bool found = false;
+	for ( size_t c = 0; c < configs.size(); c++ )
+	{
+		if ( ( configArg != "all" ) && ( configArg != configs[ c ].name ) )
+			continue;
+		found = true;
+		for ( size_t m = 0; m < methods.size(); m++ )
+			run( configs[ c ], methods[ m ], frames, loops );
+	}
+	if ( !found )
+	{
+		fprintf( stderr, "unknown config %s\n", configArg.c_str() );
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "FrameMailbox.h"
+
+namespace mndl {
+
+typedef std::shared_ptr< class FeatureTracker > FeatureTrackerRef;
+
+//! Incremental sparse feature tracking on its own thread.
+/*! The tracked points are kept from frame to frame and followed with
+	pyramidal Lucas-Kanade. The frame is divided into tiles, and new
+	features are only detected in the tiles that lost most of theirs, so
+	in steady state the detection touches a small part of the frame. Frames
+	are passed through a FrameMailbox like in FlowWorker. */
+class FeatureTracker
+{
+	public:
+		static FeatureTrackerRef create() { return FeatureTrackerRef( new FeatureTracker() ); }
+		~FeatureTracker();
+
+		struct Params
+		{
+			Params() : maxFeatures( 128 ), tilesX( 4 ), tilesY( 4 ), refillRatio( .5 ),
+				refillInterval( 15 ), qualityLevel( .005 ), minDistance( 3. ), winSize( 21 ),
+				levels( 3 ) {}
+
+			int maxFeatures;		//!< features tracked at most, shared evenly by the tiles
+			int tilesX, tilesY;		//!< detection grid
+			double refillRatio;		//!< tiles holding less than this ratio of their share are refilled
+			int refillInterval;		//!< frames before a tile the refill left depleted is searched again
+			double qualityLevel;	//!< see cv::goodFeaturesToTrack
+			double minDistance;		//!< minimum distance of the features in pixels
+			int winSize;			//!< Lucas-Kanade window size
+			int levels;				//!< Lucas-Kanade pyramid levels above the image
+		};
+
+		//! Features of the last frame the worker took.
+		/*! Tracked features have a non-zero status and their position in
+			the previous frame in \a prevPoints. Features detected in this
+			frame are appended with zero status and the same position in both
+			vectors. */
+		struct Features
+		{
+			Features() : timestamp( 0. ), frameId( 0 ), numDetected( 0 ) {}
+
+			std::vector< cv::Point2f > points;
+			std::vector< cv::Point2f > prevPoints;
+			std::vector< uint8_t > statuses;
+			double timestamp;		//!< timestamp of the frame
+			uint32_t frameId;		//!< id of the frame, as returned by pushFrame()
+			size_t numDetected;		//!< number of features detected in this frame
+		};
+
+		//! Sets the parameters used from the next frame.
+		void setParams( const Params &params );
+		Params getParams();
+
+		//! Returns a \a width x \a height CV_8UC1 frame to be filled and passed to pushFrame().
+		cv::Mat acquireFrame( int width, int height ) { return mMailbox.acquireFrame( width, height ); }
+
+		//! Passes a single channel 8-bit \a frame to the worker, replacing the waiting frame, if any.
+		/*! The frame is not copied, so it must not be modified afterwards.
+			Frames of a different size than the previous one restart the
+			tracking. Returns the id of the frame. */
+		uint32_t pushFrame( const cv::Mat &frame, double timestamp ) { return mMailbox.pushFrame( frame, timestamp ); }
+
+		//! Returns true if features newer than the last ones returned by getFeatures() are available.
+		bool checkNewFeatures();
+		//! Returns the latest features.
+		Features getFeatures();
+
+		//! Duration of the last tracking and detection in milliseconds.
+		double getTrackTime();
+		//! Number of frames replaced in the mailbox before the worker took them.
+		uint32_t getNumDroppedFrames() { return mMailbox.getNumDroppedFrames(); }
+
+	private:
+		FeatureTracker();
+		FeatureTracker( const FeatureTracker & );
+		FeatureTracker & operator=( const FeatureTracker & );
+
+		void threadFn();
+
+		void track( const cv::Mat &prevFrame, const cv::Mat &frame, const Params &params, Features &features );
+		void detect( const cv::Mat &frame, const Params &params, Features &features );
+
+		std::shared_ptr< std::thread > mThread;
+		std::mutex mMutex;
+
+		Params mParams;
+
+		FrameMailbox mMailbox;
+
+		Features mFeatures;
+		bool mNewFeatures;
+		double mTrackTime;
+
+		// used by the worker thread only
+		std::vector< cv::Point2f > mPoints;
+		std::vector< cv::Point2f > mNextPoints;
+		std::vector< uchar > mStatuses;
+		std::vector< float > mErrors;
+		std::vector< int > mTileCounts;
+		std::vector< int > mTileWaits;	//!< frames left before the tiles are searched again
+		cv::Mat mMask;
+};
+
+} // namespace mndl
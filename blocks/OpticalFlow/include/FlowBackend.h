@@ -0,0 +1,125 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "opencv2/core/core.hpp"
+
+namespace mndl {
+
+//! Dense optical flow methods, from the cheapest and coarsest to the most accurate.
+enum FlowMethod
+{
+	FLOW_BLOCK_MATCHING = 0,	//!< SAD block matching, one vector per block
+	FLOW_SPARSE_LK,				//!< pyramidal Lucas-Kanade on a sparse grid
+	FLOW_DIS,					//!< dense inverse search, needs OpenCV 4
+	FLOW_FARNEBACK,				//!< Farneback polynomial expansion
+	FLOW_METHOD_COUNT,
+	FLOW_AUTO = FLOW_METHOD_COUNT	//!< the most accurate method fitting the time budget
+};
+
+//! Parameters of the flow methods.
+struct FlowParams
+{
+	FlowParams() : method( FLOW_FARNEBACK ), timeBudget( 10. ), qualityInterval( 0 ),
+		pyrScale( .5 ), levels( 5 ), winSize( 13 ), iterations( 5 ), polyN( 5 ), polySigma( 1.1 ), flags( 0 ),
+		gridStep( 8 ), searchRadius( 4 ), lkWinSize( 15 ), lkLevels( 2 ) {}
+
+	FlowMethod method;
+	double timeBudget;		//!< milliseconds per frame for FLOW_AUTO
+	int qualityInterval;	//!< measure the error against Farneback on every n-th flow, 0 turns it off
+
+	// Farneback, see cv::calcOpticalFlowFarneback
+	double pyrScale;
+	int levels;
+	int winSize;
+	int iterations;
+	int polyN;
+	double polySigma;
+	int flags;
+
+	// block matching and sparse Lucas-Kanade
+	int gridStep;		//!< block size and spacing of the tracked points in pixels
+	int searchRadius;	//!< block matching search range in pixels
+	int lkWinSize;		//!< Lucas-Kanade window size
+	int lkLevels;		//!< Lucas-Kanade pyramid levels above the image
+};
+
+typedef std::shared_ptr< class FlowBackend > FlowBackendRef;
+
+//! Dense optical flow algorithm.
+/*! All backends take single channel 8-bit frames of the same size and
+	return CV_32FC2 displacements of the pixels of the first frame. The
+	coarse methods interpolate their vectors to every pixel. */
+class FlowBackend
+{
+	public:
+		//! Returns the backend of \a method, or an empty reference if it is not available in this build.
+		static FlowBackendRef create( FlowMethod method );
+		static bool isAvailable( FlowMethod method );
+		static const char *getMethodName( FlowMethod method );
+
+		virtual ~FlowBackend() {}
+
+		//! Calculates the flow from \a prev to \a next. \a flow is allocated if needed.
+		virtual void calc( const cv::Mat &prev, const cv::Mat &next, cv::Mat &flow, const FlowParams &params ) = 0;
+
+		FlowMethod getMethod() const { return mMethod; }
+
+	protected:
+		FlowBackend( FlowMethod method ) : mMethod( method ) {}
+
+	private:
+		FlowBackend( const FlowBackend & );
+		FlowBackend & operator=( const FlowBackend & );
+
+		FlowMethod mMethod;
+};
+
+//! Picks the method of FLOW_AUTO.
+/*! Keeps a running average of the time of every method and moves one
+	step up or down the method list to fit in the time budget. Methods not
+	measured yet are tried, all measurements are dropped every few hundred
+	flows so methods found too slow earlier are retried. */
+class FlowMethodSelector
+{
+	public:
+		FlowMethodSelector();
+
+		//! Returns the method to use with \a params.
+		FlowMethod select( const FlowParams &params ) const;
+		//! Records that \a method took \a time milliseconds.
+		void update( FlowMethod method, double time, const FlowParams &params );
+		//! Drops the measured times, for example when the frame size changes.
+		void reset();
+
+	private:
+		double mTimes[ FLOW_METHOD_COUNT ];	//!< running average, -1 if not measured
+		FlowMethod mAutoMethod;
+		uint32_t mCount;
+		static const uint32_t RETRY_INTERVAL = 300;
+};
+
+//! Mean endpoint error of \a flow against \a reference in pixels.
+/*! Both have to be CV_32FC2 matrices of the same size, returns -1 otherwise. */
+double flowEndpointError( const cv::Mat &flow, const cv::Mat &reference );
+
+} // namespace mndl
@@ -0,0 +1,118 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "opencv2/core/core.hpp"
+
+#include "FlowBackend.h"
+#include "FrameMailbox.h"
+
+namespace mndl {
+
+typedef std::shared_ptr< class FlowWorker > FlowWorkerRef;
+
+//! Dense optical flow calculated on its own thread.
+/*! Frames are passed through a FrameMailbox. A new frame replaces the one
+	still waiting, so the worker always continues with the latest frame and
+	the caller never waits for the calculation. */
+class FlowWorker
+{
+	public:
+		static FlowWorkerRef create() { return FlowWorkerRef( new FlowWorker() ); }
+		~FlowWorker();
+
+		//! Method and its parameters, Farneback by default.
+		/*! With FLOW_AUTO the worker measures the time of the methods and
+			uses the most accurate one fitting in the time budget. */
+		typedef FlowParams Params;
+
+		//! Flow between the last two frames the worker took.
+		struct Flow
+		{
+			Flow() : timestamp( 0. ), frameId( 0 ), method( FLOW_FARNEBACK ) {}
+
+			cv::Mat flow;		//!< CV_32FC2 displacements from the older frame
+			double timestamp;	//!< timestamp of the newer frame
+			uint32_t frameId;	//!< id of the newer frame, as returned by pushFrame()
+			FlowMethod method;	//!< method the flow was calculated with
+		};
+
+		//! Sets the parameters used from the next frame.
+		void setParams( const Params &params );
+		Params getParams();
+
+		//! Returns a \a width x \a height CV_8UC1 frame to be filled and passed to pushFrame().
+		/*! The frames the worker has finished with are reused, so after the
+			first few frames no memory is allocated. */
+		cv::Mat acquireFrame( int width, int height ) { return mMailbox.acquireFrame( width, height ); }
+
+		//! Passes a single channel 8-bit \a frame to the worker, replacing the waiting frame, if any.
+		/*! The frame is not copied, so it must not be modified afterwards.
+			Pushed frames are recycled by acquireFrame() when the worker is done
+			with them. Frames of a different size than the previous one restart
+			the flow. Returns the id of the frame. */
+		uint32_t pushFrame( const cv::Mat &frame, double timestamp ) { return mMailbox.pushFrame( frame, timestamp ); }
+
+		//! Returns true if a flow newer than the last one returned by getFlow() is available.
+		bool checkNewFlow();
+		//! Returns the latest flow, empty before the first two frames.
+		Flow getFlow();
+
+		//! Duration of the last flow calculation in milliseconds.
+		double getFlowTime();
+		//! Last mean endpoint error against Farneback in pixels, -1 if it was not measured.
+		/*! Measured on every Params::qualityInterval-th flow, which takes the
+			time of an extra Farneback calculation on those frames. */
+		double getFlowError();
+		//! Number of frames replaced in the mailbox before the worker took them.
+		uint32_t getNumDroppedFrames() { return mMailbox.getNumDroppedFrames(); }
+
+	private:
+		FlowWorker();
+		FlowWorker( const FlowWorker & );
+		FlowWorker & operator=( const FlowWorker & );
+
+		void threadFn();
+
+		FlowBackendRef getBackend( FlowMethod method );
+
+		std::shared_ptr< std::thread > mThread;
+		std::mutex mMutex;
+
+		Params mParams;
+
+		FrameMailbox mMailbox;
+
+		Flow mFlow;
+		bool mNewFlow;
+		double mFlowTime;
+		double mFlowError;
+
+		// used by the worker thread only
+		FlowBackendRef mBackends[ FLOW_METHOD_COUNT ];
+		FlowMethodSelector mMethodSelector;
+		uint32_t mFlowCount;
+};
+
+} // namespace mndl
@@ -0,0 +1,80 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+namespace mndl {
+
+//! Single slot mailbox passing grey frames to a worker thread.
+/*! A new frame replaces the one still waiting, so the worker always
+	continues with the latest frame and the caller never waits for it. The
+	frames the worker has finished with are recycled, so after the first
+	few frames no memory is allocated. */
+class FrameMailbox
+{
+	public:
+		FrameMailbox();
+
+		//! Returns a \a width x \a height CV_8UC1 frame to be filled and passed to pushFrame().
+		cv::Mat acquireFrame( int width, int height );
+
+		//! Passes \a frame to the worker, replacing the waiting frame, if any.
+		/*! The frame is not copied, so it must not be modified afterwards.
+			Returns the id of the frame. */
+		uint32_t pushFrame( const cv::Mat &frame, double timestamp );
+
+		//! Waits for the next frame on the worker thread.
+		/*! Returns false if the mailbox was closed. */
+		bool waitFrame( cv::Mat &frame, double &timestamp, uint32_t &id );
+		//! Returns a \a frame the worker has finished with to acquireFrame() and releases it.
+		void recycleFrame( cv::Mat &frame );
+
+		//! Wakes the worker up and makes waitFrame() return false.
+		void close();
+
+		//! Number of frames replaced before the worker took them.
+		uint32_t getNumDroppedFrames();
+
+	private:
+		FrameMailbox( const FrameMailbox & );
+		FrameMailbox & operator=( const FrameMailbox & );
+
+		void recycleFrameLocked( cv::Mat &frame );
+
+		std::mutex mMutex;
+		std::condition_variable mFrameCond;
+
+		cv::Mat mFrame;
+		double mFrameTimestamp;
+		uint32_t mFrameId;
+		bool mFrameWaiting;
+		uint32_t mNumDroppedFrames;
+		bool mClosed;
+
+		std::vector< cv::Mat > mFreeFrames;
+		static const size_t MAX_FREE_FRAMES = 4;
+};
+
+} // namespace mndl
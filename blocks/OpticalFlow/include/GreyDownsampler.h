@@ -0,0 +1,82 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+namespace mndl {
+
+typedef std::shared_ptr< class GreyDownsampler > GreyDownsamplerRef;
+
+//! Prepares captured frames for the optical flow.
+/*! Converts 8-bit RGB or grey images to grey, area downsamples and
+	optionally mirrors them in a single pass over the source, writing
+	straight into the destination matrix. The column bins and the row
+	accumulator are kept between frames, so nothing is allocated while the
+	sizes stay the same. */
+class GreyDownsampler
+{
+	public:
+		static GreyDownsamplerRef create() { return GreyDownsamplerRef( new GreyDownsampler() ); }
+
+		//! Layout of the source pixels.
+		struct Layout
+		{
+			//! Grey pixels.
+			Layout() : pixelInc( 1 ), redOffset( 0 ), greenOffset( 0 ), blueOffset( 0 ) {}
+			//! Interleaved color pixels \a pixelInc bytes apart with the channel offsets within a pixel.
+			Layout( int pixelInc, int redOffset, int greenOffset, int blueOffset ) :
+				pixelInc( pixelInc ), redOffset( redOffset ), greenOffset( greenOffset ), blueOffset( blueOffset ) {}
+
+			int pixelInc;
+			int redOffset;
+			int greenOffset;
+			int blueOffset;
+		};
+
+		//! Downsamples the \a width x \a height source image at \a data into \a dst.
+		/*! \a dst has to be an allocated CV_8UC1 matrix, its size is the size
+			of the result. Every destination pixel is the average of the source
+			pixels it covers, with Rec. 601 weights for color sources. The image
+			is mirrored horizontally if \a mirror is true. */
+		void process( const uint8_t *data, int width, int height, int rowBytes,
+				const Layout &layout, cv::Mat &dst, bool mirror = false );
+
+	private:
+		GreyDownsampler() : mSrcWidth( 0 ), mSrcHeight( 0 ), mDstWidth( 0 ), mDstHeight( 0 ) {}
+		GreyDownsampler( const GreyDownsampler & );
+		GreyDownsampler & operator=( const GreyDownsampler & );
+
+		void setup( int srcWidth, int srcHeight, int dstWidth, int dstHeight );
+		void accumulateRow( const uint8_t *src, int width, const Layout &layout );
+
+		int mSrcWidth, mSrcHeight;
+		int mDstWidth, mDstHeight;
+
+		std::vector< int > mColumnBegin;	//!< source column range of the destination columns
+		std::vector< int > mColumnEnd;
+		std::vector< float > mColumnScale;	//!< reciprocal of the column range widths
+		std::vector< uint32_t > mRowSum;	//!< weighted column sums of the current destination row
+};
+
+} // namespace mndl
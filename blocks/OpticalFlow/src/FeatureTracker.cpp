@@ -0,0 +1,220 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/video/tracking.hpp"
+
+#include "FeatureTracker.h"
+
+namespace mndl {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+FeatureTracker::FeatureTracker() :
+	mNewFeatures( false ),
+	mTrackTime( 0. )
+{
+	mThread = std::shared_ptr< std::thread >( new std::thread( &FeatureTracker::threadFn, this ) );
+}
+
+FeatureTracker::~FeatureTracker()
+{
+	mMailbox.close();
+	mThread->join();
+}
+
+void FeatureTracker::setParams( const Params &params )
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	mParams = params;
+}
+
+FeatureTracker::Params FeatureTracker::getParams()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	return mParams;
+}
+
+bool FeatureTracker::checkNewFeatures()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	return mNewFeatures;
+}
+
+FeatureTracker::Features FeatureTracker::getFeatures()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	mNewFeatures = false;
+	return mFeatures;
+}
+
+double FeatureTracker::getTrackTime()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	return mTrackTime;
+}
+
+void FeatureTracker::threadFn()
+{
+	cv::Mat prevFrame;
+	cv::Mat frame;
+	double timestamp;
+	uint32_t id;
+	while ( mMailbox.waitFrame( frame, timestamp, id ) )
+	{
+		Features features;
+		features.timestamp = timestamp;
+		features.frameId = id;
+		Params params = getParams();
+
+		Clock::time_point start = Clock::now();
+		if ( prevFrame.data && ( prevFrame.size() == frame.size() ) &&
+			 ( prevFrame.type() == frame.type() ) )
+			track( prevFrame, frame, params, features );
+		else
+		{
+			mPoints.clear();
+			mTileWaits.clear();
+		}
+		detect( frame, params, features );
+		double trackTime = std::chrono::duration< double, std::milli >( Clock::now() - start ).count();
+
+		{
+			std::lock_guard< std::mutex > lock( mMutex );
+			mFeatures = features;
+			mNewFeatures = true;
+			mTrackTime = trackTime;
+		}
+		mMailbox.recycleFrame( prevFrame );
+		prevFrame = frame;
+	}
+}
+
+void FeatureTracker::track( const cv::Mat &prevFrame, const cv::Mat &frame, const Params &params, Features &features )
+{
+	if ( mPoints.empty() )
+		return;
+
+	int winSize = std::max( params.winSize, 3 );
+	cv::calcOpticalFlowPyrLK( prevFrame, frame, mPoints, mNextPoints, mStatuses, mErrors,
+			cv::Size( winSize, winSize ), std::max( params.levels, 0 ) );
+
+	// lost features and the ones leaving the frame are dropped
+	size_t kept = 0;
+	for ( size_t i = 0; i < mPoints.size(); i++ )
+	{
+		const cv::Point2f &p = mNextPoints[ i ];
+		if ( !mStatuses[ i ] || ( p.x < 0.f ) || ( p.y < 0.f ) ||
+			 ( p.x >= frame.cols ) || ( p.y >= frame.rows ) )
+			continue;
+
+		features.prevPoints.push_back( mPoints[ i ] );
+		features.points.push_back( p );
+		features.statuses.push_back( 1 );
+		mPoints[ kept++ ] = p;
+	}
+	mPoints.resize( kept );
+}
+
+void FeatureTracker::detect( const cv::Mat &frame, const Params &params, Features &features )
+{
+	int tilesX = std::max( params.tilesX, 1 );
+	int tilesY = std::max( params.tilesY, 1 );
+	int tileWidth = ( frame.cols + tilesX - 1 ) / tilesX;
+	int tileHeight = ( frame.rows + tilesY - 1 ) / tilesY;
+	int tileShare = std::max( params.maxFeatures / ( tilesX * tilesY ), 1 );
+	int refillLimit = std::max( (int)std::ceil( tileShare * params.refillRatio ), 1 );
+
+	mTileCounts.assign( tilesX * tilesY, 0 );
+	for ( size_t i = 0; i < mPoints.size(); i++ )
+	{
+		int tx = std::min( (int)mPoints[ i ].x / tileWidth, tilesX - 1 );
+		int ty = std::min( (int)mPoints[ i ].y / tileHeight, tilesY - 1 );
+		mTileCounts[ ty * tilesX + tx ]++;
+	}
+
+	// tiles without enough texture never reach the refill limit, so a tile
+	// the refill left depleted waits a few frames before the next search
+	if ( mTileWaits.size() != mTileCounts.size() )
+		mTileWaits.assign( mTileCounts.size(), 0 );
+	int available = params.maxFeatures - (int)mPoints.size();
+	bool refill = false;
+	for ( size_t t = 0; t < mTileCounts.size(); t++ )
+	{
+		if ( mTileWaits[ t ] > 0 )
+			mTileWaits[ t ]--;
+		refill = refill || ( ( mTileWaits[ t ] == 0 ) && ( mTileCounts[ t ] < refillLimit ) );
+	}
+	if ( !refill || ( available <= 0 ) )
+		return;
+
+	// the surroundings of the tracked features are masked out so they are
+	// not detected again
+	mMask.create( frame.size(), CV_8UC1 );
+	mMask.setTo( cv::Scalar( 255 ) );
+	int r = std::max( (int)std::ceil( params.minDistance ), 0 );
+	for ( size_t i = 0; i < mPoints.size(); i++ )
+	{
+		int x0 = std::max( (int)mPoints[ i ].x - r, 0 );
+		int x1 = std::min( (int)mPoints[ i ].x + r, frame.cols - 1 );
+		int y0 = std::max( (int)mPoints[ i ].y - r, 0 );
+		int y1 = std::min( (int)mPoints[ i ].y + r, frame.rows - 1 );
+		for ( int y = y0; y <= y1; y++ )
+			std::fill( mMask.ptr( y ) + x0, mMask.ptr( y ) + x1 + 1, 0 );
+	}
+
+	// only the depleted tiles are searched for new features
+	std::vector< cv::Point2f > corners;
+	for ( int ty = 0; ty < tilesY; ty++ )
+	{
+		for ( int tx = 0; tx < tilesX; tx++ )
+		{
+			int t = ty * tilesX + tx;
+			int count = mTileCounts[ t ];
+			int wanted = std::min( tileShare - count, available );
+			if ( ( count >= refillLimit ) || ( mTileWaits[ t ] > 0 ) || ( wanted <= 0 ) )
+				continue;
+
+			cv::Rect tile( tx * tileWidth, ty * tileHeight,
+					std::min( tileWidth, frame.cols - tx * tileWidth ),
+					std::min( tileHeight, frame.rows - ty * tileHeight ) );
+			if ( ( tile.width <= 0 ) || ( tile.height <= 0 ) )
+				continue;
+
+			cv::goodFeaturesToTrack( frame( tile ), corners, wanted, params.qualityLevel,
+					params.minDistance, mMask( tile ) );
+			for ( size_t i = 0; i < corners.size(); i++ )
+			{
+				cv::Point2f p( corners[ i ].x + tile.x, corners[ i ].y + tile.y );
+				mPoints.push_back( p );
+				features.points.push_back( p );
+				features.prevPoints.push_back( p );
+				features.statuses.push_back( 0 );
+			}
+			features.numDetected += corners.size();
+			available -= (int)corners.size();
+			if ( count + (int)corners.size() < refillLimit )
+				mTileWaits[ t ] = std::max( params.refillInterval, 0 );
+		}
+	}
+}
+
+} // namespace mndl
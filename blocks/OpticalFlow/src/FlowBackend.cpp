@@ -0,0 +1,349 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "opencv2/video/tracking.hpp"
+
+#include "FlowBackend.h"
+
+// dense inverse search is part of the video module from OpenCV 4, 2.4 has
+// CV_VERSION_EPOCH and CV_VERSION_MAJOR 4
+#if !defined( CV_VERSION_EPOCH ) && defined( CV_VERSION_MAJOR ) && ( CV_VERSION_MAJOR >= 4 )
+#define FLOWBACKEND_DIS
+#endif
+
+namespace mndl {
+
+namespace {
+
+// bilinear interpolation of the vectors at the centers of the step x step
+// grid cells to every pixel of flow
+void interpolateGrid( const std::vector< cv::Point2f > &grid, int gridWidth, int gridHeight, int step, cv::Mat &flow )
+{
+	std::vector< int > x0( flow.cols ), x1( flow.cols );
+	std::vector< float > fx( flow.cols );
+	for ( int x = 0; x < flow.cols; x++ )
+	{
+		float g = std::min( std::max( ( x + .5f ) / step - .5f, 0.f ), float( gridWidth - 1 ) );
+		x0[ x ] = int( g );
+		x1[ x ] = std::min( x0[ x ] + 1, gridWidth - 1 );
+		fx[ x ] = g - x0[ x ];
+	}
+
+	for ( int y = 0; y < flow.rows; y++ )
+	{
+		float g = std::min( std::max( ( y + .5f ) / step - .5f, 0.f ), float( gridHeight - 1 ) );
+		int y0 = int( g );
+		int y1 = std::min( y0 + 1, gridHeight - 1 );
+		float fy = g - y0;
+		const cv::Point2f *row0 = &grid[ y0 * gridWidth ];
+		const cv::Point2f *row1 = &grid[ y1 * gridWidth ];
+
+		cv::Point2f *out = flow.ptr< cv::Point2f >( y );
+		for ( int x = 0; x < flow.cols; x++ )
+		{
+			float ax = row0[ x0[ x ] ].x + ( row0[ x1[ x ] ].x - row0[ x0[ x ] ].x ) * fx[ x ];
+			float ay = row0[ x0[ x ] ].y + ( row0[ x1[ x ] ].y - row0[ x0[ x ] ].y ) * fx[ x ];
+			float bx = row1[ x0[ x ] ].x + ( row1[ x1[ x ] ].x - row1[ x0[ x ] ].x ) * fx[ x ];
+			float by = row1[ x0[ x ] ].y + ( row1[ x1[ x ] ].y - row1[ x0[ x ] ].y ) * fx[ x ];
+			out[ x ].x = ax + ( bx - ax ) * fy;
+			out[ x ].y = ay + ( by - ay ) * fy;
+		}
+	}
+}
+
+class BlockMatchingFlow : public FlowBackend
+{
+	public:
+		BlockMatchingFlow() : FlowBackend( FLOW_BLOCK_MATCHING ) {}
+
+		void calc( const cv::Mat &prev, const cv::Mat &next, cv::Mat &flow, const FlowParams &params )
+		{
+			const int step = std::max( params.gridStep, 2 );
+			const int radius = std::max( params.searchRadius, 0 );
+			const int gridWidth = ( prev.cols + step - 1 ) / step;
+			const int gridHeight = ( prev.rows + step - 1 ) / step;
+			mGrid.resize( gridWidth * gridHeight );
+
+			for ( int by = 0; by < gridHeight; by++ )
+			{
+				for ( int bx = 0; bx < gridWidth; bx++ )
+				{
+					const int x0 = bx * step;
+					const int y0 = by * step;
+					const int bw = std::min( step, prev.cols - x0 );
+					const int bh = std::min( step, prev.rows - y0 );
+					// displacements cost an eighth of a grey level per pixel
+					// and search step, so flat or noisy blocks stay still
+					const int penalty = std::max( bw * bh / 8, 1 );
+
+					int best = sad( prev, next, x0, y0, 0, 0, bw, bh, INT_MAX );
+					int bestX = 0, bestY = 0;
+					for ( int dy = -radius; dy <= radius; dy++ )
+					{
+						if ( ( y0 + dy < 0 ) || ( y0 + dy + bh > prev.rows ) )
+							continue;
+						for ( int dx = -radius; dx <= radius; dx++ )
+						{
+							if ( ( x0 + dx < 0 ) || ( x0 + dx + bw > prev.cols ) ||
+								 ( ( dx == 0 ) && ( dy == 0 ) ) )
+								continue;
+							int cost = penalty * ( std::abs( dx ) + std::abs( dy ) );
+							if ( cost >= best )
+								continue;
+							cost += sad( prev, next, x0, y0, dx, dy, bw, bh, best - cost );
+							if ( cost < best )
+							{
+								best = cost;
+								bestX = dx;
+								bestY = dy;
+							}
+						}
+					}
+					mGrid[ by * gridWidth + bx ] = cv::Point2f( bestX, bestY );
+				}
+			}
+
+			flow.create( prev.size(), CV_32FC2 );
+			interpolateGrid( mGrid, gridWidth, gridHeight, step, flow );
+		}
+
+	private:
+		// sum of absolute differences, stops after the row reaching limit
+		static int sad( const cv::Mat &prev, const cv::Mat &next, int x0, int y0,
+				int dx, int dy, int bw, int bh, int limit )
+		{
+			int s = 0;
+			for ( int y = 0; y < bh; y++ )
+			{
+				const uint8_t *p = prev.ptr< uint8_t >( y0 + y ) + x0;
+				const uint8_t *n = next.ptr< uint8_t >( y0 + dy + y ) + x0 + dx;
+				for ( int x = 0; x < bw; x++ )
+					s += std::abs( p[ x ] - n[ x ] );
+				if ( s >= limit )
+					break;
+			}
+			return s;
+		}
+
+		std::vector< cv::Point2f > mGrid;
+};
+
+class SparseLkFlow : public FlowBackend
+{
+	public:
+		SparseLkFlow() : FlowBackend( FLOW_SPARSE_LK ) {}
+
+		void calc( const cv::Mat &prev, const cv::Mat &next, cv::Mat &flow, const FlowParams &params )
+		{
+			const int step = std::max( params.gridStep, 2 );
+			const int gridWidth = ( prev.cols + step - 1 ) / step;
+			const int gridHeight = ( prev.rows + step - 1 ) / step;
+
+			mPoints.resize( gridWidth * gridHeight );
+			for ( int gy = 0; gy < gridHeight; gy++ )
+			{
+				for ( int gx = 0; gx < gridWidth; gx++ )
+				{
+					mPoints[ gy * gridWidth + gx ] = cv::Point2f(
+							std::min( gx * step + ( step - 1 ) * .5f, prev.cols - 1.f ),
+							std::min( gy * step + ( step - 1 ) * .5f, prev.rows - 1.f ) );
+				}
+			}
+
+			cv::calcOpticalFlowPyrLK( prev, next, mPoints, mNextPoints, mStatus, mErrors,
+					cv::Size( params.lkWinSize, params.lkWinSize ), params.lkLevels );
+
+			// lost and untrackable flat points do not move
+			mGrid.resize( mPoints.size() );
+			for ( size_t i = 0; i < mPoints.size(); i++ )
+				mGrid[ i ] = mStatus[ i ] ? mNextPoints[ i ] - mPoints[ i ] : cv::Point2f( 0.f, 0.f );
+
+			flow.create( prev.size(), CV_32FC2 );
+			interpolateGrid( mGrid, gridWidth, gridHeight, step, flow );
+		}
+
+	private:
+		std::vector< cv::Point2f > mPoints;
+		std::vector< cv::Point2f > mNextPoints;
+		std::vector< uchar > mStatus;
+		std::vector< float > mErrors;
+		std::vector< cv::Point2f > mGrid;
+};
+
+#ifdef FLOWBACKEND_DIS
+class DisFlow : public FlowBackend
+{
+	public:
+		DisFlow() : FlowBackend( FLOW_DIS ),
+			mDis( cv::DISOpticalFlow::create( cv::DISOpticalFlow::PRESET_ULTRAFAST ) ) {}
+
+		void calc( const cv::Mat &prev, const cv::Mat &next, cv::Mat &flow, const FlowParams & )
+		{
+			mDis->calc( prev, next, flow );
+		}
+
+	private:
+		cv::Ptr< cv::DISOpticalFlow > mDis;
+};
+#endif
+
+class FarnebackFlow : public FlowBackend
+{
+	public:
+		FarnebackFlow() : FlowBackend( FLOW_FARNEBACK ) {}
+
+		void calc( const cv::Mat &prev, const cv::Mat &next, cv::Mat &flow, const FlowParams &params )
+		{
+			cv::calcOpticalFlowFarneback( prev, next, flow,
+					params.pyrScale, params.levels, params.winSize,
+					params.iterations, params.polyN, params.polySigma,
+					params.flags );
+		}
+};
+
+} // anonymous namespace
+
+FlowBackendRef FlowBackend::create( FlowMethod method )
+{
+	switch ( method )
+	{
+		case FLOW_BLOCK_MATCHING:
+			return FlowBackendRef( new BlockMatchingFlow() );
+
+		case FLOW_SPARSE_LK:
+			return FlowBackendRef( new SparseLkFlow() );
+
+#ifdef FLOWBACKEND_DIS
+		case FLOW_DIS:
+			return FlowBackendRef( new DisFlow() );
+#endif
+
+		case FLOW_FARNEBACK:
+			return FlowBackendRef( new FarnebackFlow() );
+
+		default:
+			return FlowBackendRef();
+	}
+}
+
+bool FlowBackend::isAvailable( FlowMethod method )
+{
+#ifndef FLOWBACKEND_DIS
+	if ( method == FLOW_DIS )
+		return false;
+#endif
+	return ( method >= 0 ) && ( method < FLOW_METHOD_COUNT );
+}
+
+const char *FlowBackend::getMethodName( FlowMethod method )
+{
+	static const char *names[] = { "block matching", "sparse lk", "dis", "farneback", "auto" };
+	if ( ( method < 0 ) || ( method > FLOW_AUTO ) )
+		return "";
+	return names[ method ];
+}
+
+FlowMethodSelector::FlowMethodSelector() :
+	mAutoMethod( FLOW_BLOCK_MATCHING ),
+	mCount( 0 )
+{
+	reset();
+}
+
+void FlowMethodSelector::reset()
+{
+	std::fill( mTimes, mTimes + FLOW_METHOD_COUNT, -1. );
+}
+
+FlowMethod FlowMethodSelector::select( const FlowParams &params ) const
+{
+	if ( params.method == FLOW_AUTO )
+		return mAutoMethod;
+	else
+	if ( FlowBackend::isAvailable( params.method ) )
+		return params.method;
+	else
+		return FLOW_FARNEBACK;
+}
+
+void FlowMethodSelector::update( FlowMethod method, double time, const FlowParams &params )
+{
+	double &avg = mTimes[ method ];
+	avg = ( avg < 0. ) ? time : avg * .8 + time * .2;
+
+	if ( params.method == FLOW_AUTO )
+	{
+		if ( avg > params.timeBudget )
+		{
+			for ( int m = method - 1; m >= 0; m-- )
+			{
+				if ( FlowBackend::isAvailable( FlowMethod( m ) ) )
+				{
+					mAutoMethod = FlowMethod( m );
+					break;
+				}
+			}
+		}
+		else
+		{
+			// unmeasured methods are tried
+			for ( int m = method + 1; m < FLOW_METHOD_COUNT; m++ )
+			{
+				if ( FlowBackend::isAvailable( FlowMethod( m ) ) )
+				{
+					if ( mTimes[ m ] <= params.timeBudget )
+						mAutoMethod = FlowMethod( m );
+					break;
+				}
+			}
+		}
+	}
+
+	// methods found too slow are retried now and then, the load of the
+	// machine changes
+	if ( ++mCount % RETRY_INTERVAL == 0 )
+		reset();
+}
+
+double flowEndpointError( const cv::Mat &flow, const cv::Mat &reference )
+{
+	if ( flow.empty() || ( flow.type() != CV_32FC2 ) ||
+		 ( reference.type() != CV_32FC2 ) || ( flow.size() != reference.size() ) )
+		return -1.;
+
+	double sum = 0.;
+	for ( int y = 0; y < flow.rows; y++ )
+	{
+		const cv::Point2f *f = flow.ptr< cv::Point2f >( y );
+		const cv::Point2f *r = reference.ptr< cv::Point2f >( y );
+		for ( int x = 0; x < flow.cols; x++ )
+		{
+			float dx = f[ x ].x - r[ x ].x;
+			float dy = f[ x ].y - r[ x ].y;
+			sum += sqrtf( dx * dx + dy * dy );
+		}
+	}
+	return sum / ( flow.cols * flow.rows );
+}
+
+} // namespace mndl
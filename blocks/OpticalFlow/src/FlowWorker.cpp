@@ -0,0 +1,151 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+
+#include "FlowWorker.h"
+
+namespace mndl {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+FlowWorker::FlowWorker() :
+	mNewFlow( false ),
+	mFlowTime( 0. ),
+	mFlowError( -1. ),
+	mFlowCount( 0 )
+{
+	mThread = std::shared_ptr< std::thread >( new std::thread( &FlowWorker::threadFn, this ) );
+}
+
+FlowWorker::~FlowWorker()
+{
+	mMailbox.close();
+	mThread->join();
+}
+
+void FlowWorker::setParams( const Params &params )
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	mParams = params;
+}
+
+FlowWorker::Params FlowWorker::getParams()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	return mParams;
+}
+
+bool FlowWorker::checkNewFlow()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	return mNewFlow;
+}
+
+FlowWorker::Flow FlowWorker::getFlow()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	mNewFlow = false;
+	return mFlow;
+}
+
+double FlowWorker::getFlowTime()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	return mFlowTime;
+}
+
+double FlowWorker::getFlowError()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	return mFlowError;
+}
+
+void FlowWorker::threadFn()
+{
+	cv::Mat prevFrame;
+	cv::Mat frame;
+	double timestamp;
+	uint32_t id;
+	while ( mMailbox.waitFrame( frame, timestamp, id ) )
+	{
+		Params params = getParams();
+
+		bool flowReady = false;
+		cv::Mat flow;
+		double flowTime = 0.;
+		FlowMethod method = FLOW_FARNEBACK;
+		double flowError = -1.;
+		if ( prevFrame.data && ( prevFrame.size() == frame.size() ) &&
+			 ( prevFrame.type() == frame.type() ) )
+		{
+			// the flow is allocated for every frame, the previous one may
+			// still be used by the caller
+			method = mMethodSelector.select( params );
+			Clock::time_point start = Clock::now();
+			getBackend( method )->calc( prevFrame, frame, flow, params );
+			flowTime = std::chrono::duration< double, std::milli >( Clock::now() - start ).count();
+			flowReady = true;
+			mMethodSelector.update( method, flowTime, params );
+			mFlowCount++;
+
+			if ( ( params.qualityInterval > 0 ) && ( mFlowCount % params.qualityInterval == 0 ) )
+			{
+				if ( method == FLOW_FARNEBACK )
+				{
+					flowError = 0.;
+				}
+				else
+				{
+					cv::Mat reference;
+					getBackend( FLOW_FARNEBACK )->calc( prevFrame, frame, reference, params );
+					flowError = flowEndpointError( flow, reference );
+				}
+			}
+		}
+		else
+		if ( prevFrame.data )
+		{
+			// the timings of another frame size are meaningless
+			mMethodSelector.reset();
+		}
+
+		if ( flowReady )
+		{
+			std::lock_guard< std::mutex > lock( mMutex );
+			mFlow.flow = flow;
+			mFlow.timestamp = timestamp;
+			mFlow.frameId = id;
+			mFlow.method = method;
+			mNewFlow = true;
+			mFlowTime = flowTime;
+			if ( flowError >= 0. )
+				mFlowError = flowError;
+		}
+		mMailbox.recycleFrame( prevFrame );
+		prevFrame = frame;
+	}
+}
+
+FlowBackendRef FlowWorker::getBackend( FlowMethod method )
+{
+	if ( !mBackends[ method ] )
+		mBackends[ method ] = FlowBackend::create( method );
+	return mBackends[ method ];
+}
+
+} // namespace mndl
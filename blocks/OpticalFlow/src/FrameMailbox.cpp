@@ -0,0 +1,117 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FrameMailbox.h"
+
+namespace mndl {
+
+FrameMailbox::FrameMailbox() :
+	mFrameTimestamp( 0. ),
+	mFrameId( 0 ),
+	mFrameWaiting( false ),
+	mNumDroppedFrames( 0 ),
+	mClosed( false )
+{
+}
+
+cv::Mat FrameMailbox::acquireFrame( int width, int height )
+{
+	{
+		std::lock_guard< std::mutex > lock( mMutex );
+		for ( size_t i = 0; i < mFreeFrames.size(); i++ )
+		{
+			if ( ( mFreeFrames[ i ].cols == width ) && ( mFreeFrames[ i ].rows == height ) &&
+				 ( mFreeFrames[ i ].type() == CV_8UC1 ) )
+			{
+				cv::Mat frame = mFreeFrames[ i ];
+				mFreeFrames.erase( mFreeFrames.begin() + i );
+				return frame;
+			}
+		}
+	}
+	return cv::Mat( height, width, CV_8UC1 );
+}
+
+uint32_t FrameMailbox::pushFrame( const cv::Mat &frame, double timestamp )
+{
+	uint32_t id;
+	{
+		std::lock_guard< std::mutex > lock( mMutex );
+		if ( mFrameWaiting )
+		{
+			mNumDroppedFrames++;
+			recycleFrameLocked( mFrame );
+		}
+		mFrame = frame;
+		mFrameTimestamp = timestamp;
+		id = ++mFrameId;
+		mFrameWaiting = true;
+	}
+	mFrameCond.notify_one();
+	return id;
+}
+
+bool FrameMailbox::waitFrame( cv::Mat &frame, double &timestamp, uint32_t &id )
+{
+	std::unique_lock< std::mutex > lock( mMutex );
+	while ( !mClosed && !mFrameWaiting )
+		mFrameCond.wait( lock );
+	if ( mClosed )
+		return false;
+
+	frame = mFrame;
+	mFrame.release();
+	mFrameWaiting = false;
+	timestamp = mFrameTimestamp;
+	id = mFrameId;
+	return true;
+}
+
+void FrameMailbox::recycleFrame( cv::Mat &frame )
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	recycleFrameLocked( frame );
+}
+
+// called with the mutex locked
+void FrameMailbox::recycleFrameLocked( cv::Mat &frame )
+{
+	if ( frame.data )
+	{
+		if ( mFreeFrames.size() >= MAX_FREE_FRAMES )
+			mFreeFrames.erase( mFreeFrames.begin() );
+		mFreeFrames.push_back( frame );
+		frame.release();
+	}
+}
+
+void FrameMailbox::close()
+{
+	{
+		std::lock_guard< std::mutex > lock( mMutex );
+		mClosed = true;
+	}
+	mFrameCond.notify_one();
+}
+
+uint32_t FrameMailbox::getNumDroppedFrames()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	return mNumDroppedFrames;
+}
+
+} // namespace mndl
@@ -0,0 +1,157 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && ( _M_IX86_FP >= 2 ) )
+#define GREYDOWNSAMPLER_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "GreyDownsampler.h"
+
+namespace mndl {
+
+// Rec. 601 luma weights in 8-bit fixed point, their sum is 256
+static const int RED_WEIGHT = 77;
+static const int GREEN_WEIGHT = 150;
+static const int BLUE_WEIGHT = 29;
+
+void GreyDownsampler::setup( int srcWidth, int srcHeight, int dstWidth, int dstHeight )
+{
+	mSrcWidth = srcWidth;
+	mSrcHeight = srcHeight;
+	mDstWidth = dstWidth;
+	mDstHeight = dstHeight;
+
+	// every destination column covers at least one source column, so
+	// upsampling also works
+	mColumnBegin.resize( dstWidth );
+	mColumnEnd.resize( dstWidth );
+	mColumnScale.resize( dstWidth );
+	for ( int x = 0; x < dstWidth; x++ )
+	{
+		int begin = std::min( x * srcWidth / dstWidth, srcWidth - 1 );
+		int end = std::max( ( x + 1 ) * srcWidth / dstWidth, begin + 1 );
+		mColumnBegin[ x ] = begin;
+		mColumnEnd[ x ] = end;
+		mColumnScale[ x ] = 1.f / ( end - begin );
+	}
+
+	mRowSum.resize( srcWidth );
+}
+
+void GreyDownsampler::accumulateRow( const uint8_t *src, int width, const Layout &layout )
+{
+	uint32_t *sum = &mRowSum[ 0 ];
+	int x = 0;
+
+	if ( layout.pixelInc == 1 )
+	{
+#ifdef GREYDOWNSAMPLER_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		for ( ; x + 16 <= width; x += 16 )
+		{
+			__m128i p = _mm_loadu_si128( (const __m128i *)( src + x ) );
+			__m128i lo = _mm_unpacklo_epi8( p, zero );
+			__m128i hi = _mm_unpackhi_epi8( p, zero );
+			__m128i *s = (__m128i *)( sum + x );
+			_mm_storeu_si128( s, _mm_add_epi32( _mm_loadu_si128( s ), _mm_unpacklo_epi16( lo, zero ) ) );
+			_mm_storeu_si128( s + 1, _mm_add_epi32( _mm_loadu_si128( s + 1 ), _mm_unpackhi_epi16( lo, zero ) ) );
+			_mm_storeu_si128( s + 2, _mm_add_epi32( _mm_loadu_si128( s + 2 ), _mm_unpacklo_epi16( hi, zero ) ) );
+			_mm_storeu_si128( s + 3, _mm_add_epi32( _mm_loadu_si128( s + 3 ), _mm_unpackhi_epi16( hi, zero ) ) );
+		}
+#endif
+		for ( ; x < width; x++ )
+			sum[ x ] += src[ x ];
+		return;
+	}
+
+#ifdef GREYDOWNSAMPLER_SSE2
+	if ( layout.pixelInc == 4 )
+	{
+		// the weights of the four bytes of a pixel, twice, as the bytes of two
+		// pixels are multiplied and summed pairwise by _mm_madd_epi16
+		int16_t w[ 4 ] = { 0, 0, 0, 0 };
+		w[ layout.redOffset ] = RED_WEIGHT;
+		w[ layout.greenOffset ] = GREEN_WEIGHT;
+		w[ layout.blueOffset ] = BLUE_WEIGHT;
+		const __m128i weights = _mm_setr_epi16( w[ 0 ], w[ 1 ], w[ 2 ], w[ 3 ], w[ 0 ], w[ 1 ], w[ 2 ], w[ 3 ] );
+		const __m128i zero = _mm_setzero_si128();
+
+		for ( ; x + 4 <= width; x += 4 )
+		{
+			__m128i p = _mm_loadu_si128( (const __m128i *)( src + x * 4 ) );
+			// the two partial sums of pixels 0, 1 and 2, 3
+			__m128i lo = _mm_madd_epi16( _mm_unpacklo_epi8( p, zero ), weights );
+			__m128i hi = _mm_madd_epi16( _mm_unpackhi_epi8( p, zero ), weights );
+			__m128 even = _mm_shuffle_ps( _mm_castsi128_ps( lo ), _mm_castsi128_ps( hi ), _MM_SHUFFLE( 2, 0, 2, 0 ) );
+			__m128 odd = _mm_shuffle_ps( _mm_castsi128_ps( lo ), _mm_castsi128_ps( hi ), _MM_SHUFFLE( 3, 1, 3, 1 ) );
+			__m128i grey = _mm_add_epi32( _mm_castps_si128( even ), _mm_castps_si128( odd ) );
+			__m128i *s = (__m128i *)( sum + x );
+			_mm_storeu_si128( s, _mm_add_epi32( _mm_loadu_si128( s ), grey ) );
+		}
+	}
+#endif
+
+	const uint8_t *r = src + layout.redOffset;
+	const uint8_t *g = src + layout.greenOffset;
+	const uint8_t *b = src + layout.blueOffset;
+	const int inc = layout.pixelInc;
+	for ( ; x < width; x++ )
+	{
+		int i = x * inc;
+		sum[ x ] += RED_WEIGHT * r[ i ] + GREEN_WEIGHT * g[ i ] + BLUE_WEIGHT * b[ i ];
+	}
+}
+
+void GreyDownsampler::process( const uint8_t *data, int width, int height, int rowBytes,
+		const Layout &layout, cv::Mat &dst, bool mirror )
+{
+	if ( ( data == NULL ) || ( width <= 0 ) || ( height <= 0 ) ||
+		 dst.empty() || ( dst.type() != CV_8UC1 ) )
+		return;
+
+	if ( ( width != mSrcWidth ) || ( height != mSrcHeight ) ||
+		 ( dst.cols != mDstWidth ) || ( dst.rows != mDstHeight ) )
+		setup( width, height, dst.cols, dst.rows );
+
+	const float weightScale = ( layout.pixelInc == 1 ) ? 1.f : 1.f / ( RED_WEIGHT + GREEN_WEIGHT + BLUE_WEIGHT );
+
+	for ( int y = 0; y < mDstHeight; y++ )
+	{
+		int rowBegin = std::min( y * height / mDstHeight, height - 1 );
+		int rowEnd = std::max( ( y + 1 ) * height / mDstHeight, rowBegin + 1 );
+
+		std::fill( mRowSum.begin(), mRowSum.end(), 0 );
+		for ( int sy = rowBegin; sy < rowEnd; sy++ )
+			accumulateRow( data + sy * rowBytes, width, layout );
+
+		const float rowScale = weightScale / ( rowEnd - rowBegin );
+		uint8_t *out = dst.ptr< uint8_t >( y );
+		for ( int x = 0; x < mDstWidth; x++ )
+		{
+			uint32_t s = 0;
+			for ( int sx = mColumnBegin[ x ]; sx < mColumnEnd[ x ]; sx++ )
+				s += mRowSum[ sx ];
+			int dx = mirror ? mDstWidth - 1 - x : x;
+			out[ dx ] = (uint8_t)std::min( s * rowScale * mColumnScale[ x ] + .5f, 255.f );
+		}
+	}
+}
+
+} // namespace mndl
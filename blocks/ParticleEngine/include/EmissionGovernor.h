@@ -0,0 +1,117 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+
+#include "cinder/Timer.h"
+
+namespace mndl { namespace particles {
+
+//! Scales particle emission to hold a target frame time.
+/*! Call beginUpdate/endUpdate around the particle update and
+	beginDraw/endDraw around the particle draw to measure the cost per
+	particle, then endFrame once per frame with the number of active
+	particles. endFrame also starts measuring the cpu work of the frame,
+	call endWork at the end of the update and beginWork/endWork around
+	each draw, so the buffer swap is left out. The governor reacts to the
+	work time, with vertical sync the frame time never drops below the
+	refresh period. The governor keeps a smoothed work time and only reacts when
+	it leaves the [ target * lowRatio, target * highRatio ] band for
+	holdFrames consecutive frames. Overload is answered with a
+	multiplicative decrease of the particle density, recovery is additive,
+	so the density does not oscillate around the budget. */
+class EmissionGovernor
+{
+	public:
+		enum State { STEADY, THROTTLING, RECOVERING };
+
+		EmissionGovernor( double targetFrameTime = 1. / 60. );
+
+		void setTargetFrameTime( double seconds ) { mTargetFrameTime = seconds; }
+		double getTargetFrameTime() const { return mTargetFrameTime; }
+
+		//! Sets the hysteresis band as ratios of the target frame time.
+		void setBand( double lowRatio, double highRatio ) { mLowRatio = lowRatio; mHighRatio = highRatio; }
+		void setHoldFrames( int frames ) { mHoldFrames = frames; }
+		void setMinDensity( float density ) { mMinDensity = density; }
+		void setEnabled( bool enabled );
+		bool isEnabled() const { return mEnabled; }
+
+		void beginUpdate() { mUpdateTimer.start(); }
+		void endUpdate() { mUpdateTimer.stop(); mUpdateSeconds = mUpdateTimer.getSeconds(); }
+		void beginDraw() { mDrawTimer.start(); }
+		void endDraw() { mDrawTimer.stop(); mDrawSeconds = mDrawTimer.getSeconds(); }
+
+		//! Measures the frame time and adjusts the density, starts measuring the work of the next frame.
+		void endFrame( int numParticles );
+		//! Measures the cpu work of the frame between beginWork and endWork.
+		/*! Without endWork the frame time including the swap is used. */
+		void beginWork() { mWorkTimer.start(); }
+		void endWork();
+
+		//! Returns the governed number of particles to emit instead of \a requested.
+		/*! Fractional parts are accumulated across calls, so small requests are
+			thinned out instead of dropped. */
+		int getEmissionCount( int requested );
+
+		//! Particle density in [minDensity, 1], the multiplier of the emission counts.
+		/*! The lifetimes are left alone, so the number of live particles
+			follows the density. */
+		float getDensity() const { return mDensity; }
+
+		State getState() const { return mState; }
+		double getSmoothedFrameTime() const { return mFrameTime; }
+		//! Smoothed cpu time of update and draw without the swap.
+		double getSmoothedWorkTime() const { return mWorkTime; }
+		//! Smoothed update + draw cost of one particle in seconds.
+		double getParticleCost() const { return mParticleCost; }
+		//! Number of particles the particle share of the frame budget can afford.
+		int getParticleBudget() const;
+
+		//! Returns the current decisions as a single log line.
+		std::string getStatus() const;
+
+	private:
+		bool mEnabled;
+
+		double mTargetFrameTime;
+		double mLowRatio, mHighRatio;
+		int mHoldFrames;
+		float mMinDensity;
+
+		ci::Timer mFrameTimer;
+		ci::Timer mUpdateTimer, mDrawTimer;
+		double mUpdateSeconds, mDrawSeconds;
+		ci::Timer mWorkTimer;
+		double mWorkSeconds; //!< work of the current frame so far
+		bool mWorkMeasured;
+
+		double mFrameTime;
+		double mWorkTime;
+		double mParticleTime;
+		double mParticleCost;
+		int mNumParticles;
+
+		int mOverCount, mUnderCount;
+		float mDensity;
+		float mEmissionRemainder;
+		State mState;
+};
+
+} } // namespace mndl::particles
@@ -0,0 +1,231 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Vector.h"
+#include "cinder/Rand.h"
+#include "cinder/gl/gl.h"
+
+#include "ciMsaFluidSolver.h"
+
+namespace mndl { namespace particles {
+
+//! Per-particle state shared by all fluid particle engines.
+struct FluidParticle
+{
+	FluidParticle() : mLifeSpan( 0 ) {}
+
+	ci::Vec2f mPos;
+	ci::Vec2f mVel;
+	float mLifeSpan;
+	float mMass;
+};
+
+//! Moves the particle with the fluid velocity, keeping some of its momentum.
+struct FluidAdvection
+{
+	static inline void advect( FluidParticle &p, const ciMsaFluidSolver *solver,
+			const ci::Vec2f &windowSize, const ci::Vec2f &invWindowSize )
+	{
+		static const float sMomentum = 0.6f;
+		static const float sFluidForce = 0.9f;
+
+		p.mVel = solver->getVelocityAtPos( p.mPos * invWindowSize ) * ( p.mMass * sFluidForce ) * windowSize +
+				 p.mVel * sMomentum;
+	}
+};
+
+//! Adds random jitter to every particle.
+struct JitterAlways
+{
+	static inline void jitter( FluidParticle &p )
+	{
+		p.mVel += ci::Rand::randVec2f() * 3.f;
+	}
+};
+
+//! Adds random jitter only to slow particles, so they keep drifting.
+struct JitterSlow
+{
+	static inline void jitter( FluidParticle &p )
+	{
+		if ( p.mVel.lengthSquared() < 10 )
+			p.mVel += ci::Rand::randVec2f() * 3.f;
+	}
+};
+
+//! Exponential aging, dead under 0.01.
+struct ExponentialAging
+{
+	static inline void age( FluidParticle &p, float aging )
+	{
+		p.mLifeSpan *= aging;
+		if ( p.mLifeSpan < 0.01f )
+			p.mLifeSpan = 0;
+	}
+};
+
+//! Flickering grey streak with lifespan as alpha.
+struct FlickerGreyColor
+{
+	static inline void color( const FluidParticle &p, float *colors )
+	{
+		float col = ci::Rand::randFloat();
+		colors[ 0 ] = colors[ 4 ] = col;
+		colors[ 1 ] = colors[ 5 ] = col;
+		colors[ 2 ] = colors[ 6 ] = col;
+		colors[ 3 ] = colors[ 7 ] = p.mLifeSpan;
+	}
+};
+
+//! Fixed capacity ring buffer particle system driven by an msaFluid solver.
+/*! The capacity and the per-particle behaviour are compile-time parameters,
+	so each app gets its own specialized update loop with the policies inlined.
+	\a MAX_PARTICLES has to be a power of two. Each living particle is drawn
+	as a streak of two vertices. */
+template< int MAX_PARTICLES,
+		  class JitterPolicy = JitterSlow,
+		  class ColorPolicy = FlickerGreyColor,
+		  bool ADDITIVE = true,
+		  class AdvectionPolicy = FluidAdvection,
+		  class AgingPolicy = ExponentialAging >
+class FluidParticleSystem
+{
+	public:
+		FluidParticleSystem() : mSolver( NULL ), mCurrent( 0 ), mActive( 0 )
+		{
+			setWindowSize( ci::Vec2i( 1, 1 ) );
+		}
+
+		void setWindowSize( ci::Vec2i winSize )
+		{
+			mWindowSize = winSize;
+			mInvWindowSize = ci::Vec2f( 1.0f / winSize.x, 1.0f / winSize.y );
+		}
+		void setFluidSolver( const ciMsaFluidSolver *aSolver ) { mSolver = aSolver; }
+
+		void update( double seconds );
+		void draw();
+
+		void addParticle( const ci::Vec2f &pos, int count = 1 );
+
+		int getNumActive() const { return mActive; }
+		static int getCapacity() { return MAX_PARTICLES; }
+
+		static float getAging() { return sAging; }
+		static void setAging( float a ) { sAging = a; }
+
+	private:
+		static_assert( ( MAX_PARTICLES & ( MAX_PARTICLES - 1 ) ) == 0,
+				"MAX_PARTICLES must be a power of two" );
+
+		void spawn( FluidParticle &p, const ci::Vec2f &pos )
+		{
+			p.mPos = pos;
+			p.mVel = ci::Vec2f::zero();
+			p.mLifeSpan = ci::Rand::randFloat( 0.3f, 1 );
+			p.mMass = ci::Rand::randFloat( 0.1f, 1 );
+		}
+
+		ci::Vec2f mWindowSize;
+		ci::Vec2f mInvWindowSize;
+
+		const ciMsaFluidSolver *mSolver;
+
+		static float sAging;
+
+		int mCurrent;
+		int mActive;
+
+		float mPositions[ MAX_PARTICLES * 2 * 2 ];
+		float mColors[ MAX_PARTICLES * 4 * 2 ];
+		FluidParticle mParticles[ MAX_PARTICLES ];
+};
+
+template< int N, class J, class C, bool A, class Ad, class Ag >
+float FluidParticleSystem< N, J, C, A, Ad, Ag >::sAging = 0.995f;
+
+template< int N, class J, class C, bool A, class Ad, class Ag >
+void FluidParticleSystem< N, J, C, A, Ad, Ag >::update( double seconds )
+{
+	const float aging = sAging;
+	float *positions = mPositions;
+	float *colors = mColors;
+
+	mActive = 0;
+	for ( int i = 0; i < N; i++ )
+	{
+		FluidParticle &p = mParticles[ i ];
+		if ( p.mLifeSpan <= 0 )
+			continue;
+
+		Ad::advect( p, mSolver, mWindowSize, mInvWindowSize );
+		J::jitter( p );
+		p.mPos += p.mVel;
+		Ag::age( p, aging );
+
+		ci::Vec2f velLimited = p.mVel.limited( 10 );
+		positions[ 0 ] = p.mPos.x - velLimited.x;
+		positions[ 1 ] = p.mPos.y - velLimited.y;
+		positions[ 2 ] = p.mPos.x;
+		positions[ 3 ] = p.mPos.y;
+
+		C::color( p, colors );
+
+		positions += 4;
+		colors += 8;
+		mActive++;
+	}
+}
+
+template< int N, class J, class C, bool A, class Ad, class Ag >
+void FluidParticleSystem< N, J, C, A, Ad, Ag >::draw()
+{
+	if ( A )
+		ci::gl::enableAdditiveBlending();
+	ci::gl::disable( GL_TEXTURE_2D );
+	ci::gl::enable( GL_LINE_SMOOTH );
+
+	glEnableClientState( GL_VERTEX_ARRAY );
+	glVertexPointer( 2, GL_FLOAT, 0, mPositions );
+
+	glEnableClientState( GL_COLOR_ARRAY );
+	glColorPointer( 4, GL_FLOAT, 0, mColors );
+
+	glDrawArrays( GL_LINES, 0, mActive * 2 );
+
+	glDisableClientState( GL_VERTEX_ARRAY );
+	glDisableClientState( GL_COLOR_ARRAY );
+	if ( A )
+		ci::gl::disableAlphaBlending();
+}
+
+template< int N, class J, class C, bool A, class Ad, class Ag >
+void FluidParticleSystem< N, J, C, A, Ad, Ag >::addParticle( const ci::Vec2f &pos, int count /* = 1 */ )
+{
+	spawn( mParticles[ mCurrent ], pos );
+	for ( int i = count - 1; i > 0; i-- )
+	{
+		mCurrent = ( mCurrent + 1 ) & ( N - 1 );
+		spawn( mParticles[ mCurrent ], pos + ci::Rand::randVec2f() * 10 );
+	}
+	mCurrent = ( mCurrent + 1 ) & ( N - 1 );
+}
+
+} } // namespace mndl::particles
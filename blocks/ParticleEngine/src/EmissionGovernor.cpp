@@ -0,0 +1,171 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sstream>
+
+#include "cinder/CinderMath.h"
+
+#include "EmissionGovernor.h"
+
+namespace mndl { namespace particles {
+
+// exponential smoothing factor of the frame and particle timings
+static const double sSmoothing = .1;
+// density decrease factor on overload and increase step on recovery
+static const float sDecrease = .8f;
+static const float sIncrease = .02f;
+
+EmissionGovernor::EmissionGovernor( double targetFrameTime ) :
+	mEnabled( true ),
+	mTargetFrameTime( targetFrameTime ),
+	mLowRatio( .85 ),
+	mHighRatio( 1.05 ),
+	mHoldFrames( 10 ),
+	mMinDensity( .05f ),
+	mUpdateSeconds( 0 ),
+	mDrawSeconds( 0 ),
+	mWorkSeconds( 0 ),
+	mWorkMeasured( false ),
+	mFrameTime( targetFrameTime ),
+	mWorkTime( targetFrameTime ),
+	mParticleTime( 0 ),
+	mParticleCost( 0 ),
+	mNumParticles( 0 ),
+	mOverCount( 0 ),
+	mUnderCount( 0 ),
+	mDensity( 1.f ),
+	mEmissionRemainder( 0.f ),
+	mState( STEADY )
+{
+}
+
+void EmissionGovernor::setEnabled( bool enabled )
+{
+	mEnabled = enabled;
+	if ( !mEnabled )
+	{
+		mDensity = 1.f;
+		mOverCount = mUnderCount = 0;
+		mState = STEADY;
+	}
+}
+
+void EmissionGovernor::endFrame( int numParticles )
+{
+	// the first call only starts the frame clock
+	if ( mFrameTimer.isStopped() )
+	{
+		mFrameTimer.start();
+		mWorkTimer.start();
+		return;
+	}
+
+	double frameTime = mFrameTimer.getSeconds();
+	mFrameTimer.start();
+
+	mFrameTime += ( frameTime - mFrameTime ) * sSmoothing;
+	// the frame time includes the vsync wait, the work time is the load
+	double workTime = mWorkMeasured ? mWorkSeconds : frameTime;
+	mWorkTime += ( workTime - mWorkTime ) * sSmoothing;
+	mWorkSeconds = 0;
+	mWorkTimer.start();
+	double particleTime = mUpdateSeconds + mDrawSeconds;
+	mParticleTime += ( particleTime - mParticleTime ) * sSmoothing;
+	mNumParticles = numParticles;
+	if ( numParticles > 0 )
+		mParticleCost += ( particleTime / numParticles - mParticleCost ) * sSmoothing;
+
+	if ( !mEnabled )
+		return;
+
+	if ( mWorkTime > mTargetFrameTime * mHighRatio )
+	{
+		mUnderCount = 0;
+		if ( ++mOverCount >= mHoldFrames )
+		{
+			mDensity = ci::math< float >::max( mDensity * sDecrease, mMinDensity );
+			mOverCount = 0;
+			mState = THROTTLING;
+		}
+	}
+	else
+	if ( ( mWorkTime < mTargetFrameTime * mLowRatio ) && ( mDensity < 1.f ) )
+	{
+		mOverCount = 0;
+		if ( ++mUnderCount >= mHoldFrames )
+		{
+			mDensity = ci::math< float >::min( mDensity + sIncrease, 1.f );
+			mUnderCount = 0;
+			mState = ( mDensity < 1.f ) ? RECOVERING : STEADY;
+		}
+	}
+	else
+	{
+		// inside the band, hold the current decision
+		mOverCount = mUnderCount = 0;
+		if ( mDensity >= 1.f )
+			mState = STEADY;
+	}
+}
+
+void EmissionGovernor::endWork()
+{
+	mWorkTimer.stop();
+	mWorkSeconds += mWorkTimer.getSeconds();
+	mWorkMeasured = true;
+}
+
+int EmissionGovernor::getEmissionCount( int requested )
+{
+	if ( !mEnabled || ( mDensity >= 1.f ) )
+		return requested;
+
+	// the lifespan is not scaled, with exponential aging that would only cut
+	// off a few frames and dim the particles, so the emission is scaled by
+	// the density
+	float count = requested * mDensity + mEmissionRemainder;
+	int n = static_cast< int >( count );
+	mEmissionRemainder = count - n;
+	return n;
+}
+
+int EmissionGovernor::getParticleBudget() const
+{
+	if ( mParticleCost <= 0 )
+		return mNumParticles;
+
+	double otherTime = ci::math< double >::max( mWorkTime - mParticleTime, 0. );
+	double particleBudget = ci::math< double >::max( mTargetFrameTime - otherTime, 0. );
+	return static_cast< int >( particleBudget / mParticleCost );
+}
+
+std::string EmissionGovernor::getStatus() const
+{
+	static const char *stateNames[] = { "steady", "throttling", "recovering" };
+
+	std::stringstream ss;
+	ss << "governor " << stateNames[ mState ]
+	   << " frame " << mFrameTime * 1000. << "ms"
+	   << " work " << mWorkTime * 1000. << "ms"
+	   << " target " << mTargetFrameTime * 1000. << "ms"
+	   << " particles " << mNumParticles << "/" << getParticleBudget()
+	   << " cost " << mParticleCost * 1e9 << "ns"
+	   << " density " << mDensity;
+	return ss.str();
+}
+
+} } // namespace mndl::particles
@@ -0,0 +1,72 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mndl {
+
+typedef std::shared_ptr< class WorkerPool > WorkerPoolRef;
+
+//! Fixed set of worker threads running parallel for loops.
+/*! The threads are started once and sleep between the loops, so the pool
+	is cheap enough to be used several times per frame. */
+class WorkerPool
+{
+	public:
+		//! Creates a pool with \a numThreads workers, 0 means one less than the number of cores.
+		static WorkerPoolRef create( int numThreads = 0 ) { return WorkerPoolRef( new WorkerPool( numThreads ) ); }
+		~WorkerPool();
+
+		//! Calls \a fn( i ) for every i in [0, count) on the workers and on the calling thread.
+		/*! Returns when all calls have finished. Not reentrant, \a fn must not
+			call parallelFor on the same pool. */
+		void parallelFor( int count, const std::function< void( int ) > &fn );
+
+		//! Number of threads taking part in a loop, including the calling thread.
+		int getNumThreads() const { return mThreads.size() + 1; }
+
+	private:
+		WorkerPool( int numThreads );
+		WorkerPool( const WorkerPool & );
+		WorkerPool & operator=( const WorkerPool & );
+
+		void threadFn();
+		void runTasks();
+
+		std::vector< std::shared_ptr< std::thread > > mThreads;
+
+		std::mutex mMutex;
+		std::condition_variable mStartCond;
+		std::condition_variable mDoneCond;
+
+		const std::function< void( int ) > *mFn;
+		int mCount;
+		std::atomic< int > mNext;
+		int mBusy;
+		unsigned mGeneration;
+		bool mQuit;
+};
+
+} // namespace mndl
@@ -0,0 +1,111 @@
+/*
+ Copyright (C) 2013 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "WorkerPool.h"
+
+namespace mndl {
+
+WorkerPool::WorkerPool( int numThreads ) :
+	mFn( NULL ),
+	mCount( 0 ),
+	mNext( 0 ),
+	mBusy( 0 ),
+	mGeneration( 0 ),
+	mQuit( false )
+{
+	if ( numThreads <= 0 )
+		numThreads = int( std::thread::hardware_concurrency() ) - 1;
+
+	for ( int i = 0; i < numThreads; i++ )
+		mThreads.push_back( std::shared_ptr< std::thread >(
+					new std::thread( &WorkerPool::threadFn, this ) ) );
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard< std::mutex > lock( mMutex );
+		mQuit = true;
+	}
+	mStartCond.notify_all();
+
+	for ( size_t i = 0; i < mThreads.size(); i++ )
+		mThreads[ i ]->join();
+}
+
+void WorkerPool::parallelFor( int count, const std::function< void( int ) > &fn )
+{
+	if ( count <= 0 )
+		return;
+
+	if ( mThreads.empty() || ( count == 1 ) )
+	{
+		for ( int i = 0; i < count; i++ )
+			fn( i );
+		return;
+	}
+
+	{
+		std::lock_guard< std::mutex > lock( mMutex );
+		mFn = &fn;
+		mCount = count;
+		mNext = 0;
+		mBusy = mThreads.size();
+		mGeneration++;
+	}
+	mStartCond.notify_all();
+
+	runTasks();
+
+	std::unique_lock< std::mutex > lock( mMutex );
+	while ( mBusy > 0 )
+		mDoneCond.wait( lock );
+	mFn = NULL;
+}
+
+void WorkerPool::runTasks()
+{
+	int i;
+	while ( ( i = mNext++ ) < mCount )
+		( *mFn )( i );
+}
+
+void WorkerPool::threadFn()
+{
+	unsigned generation = 0;
+	while ( true )
+	{
+		{
+			std::unique_lock< std::mutex > lock( mMutex );
+			while ( !mQuit && ( generation == mGeneration ) )
+				mStartCond.wait( lock );
+			if ( mQuit )
+				return;
+			generation = mGeneration;
+		}
+
+		runTasks();
+
+		{
+			std::lock_guard< std::mutex > lock( mMutex );
+			mBusy--;
+		}
+		mDoneCond.notify_one();
+	}
+}
+
+} // namespace mndl